@@ -0,0 +1,155 @@
+#pragma once
+#ifndef UV_ARQ_SESSION_H_
+#define UV_ARQ_SESSION_H_
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <string>
+#include "uv.h"
+#include "uv_net.h"
+
+namespace uv
+{
+	class uv_udp_client;
+
+	//reliable ordered messages over a udp client in the manner of kcp. every segment carries a
+	//sequence number, acks are selective plus a cumulative una, a segment is resent when its rto
+	//expires or after enough later segments were acked, and a congestion window limits what is
+	//in flight. both ends use the same conv, datagrams from the peer are passed to input()
+	class uv_arq_session
+	{
+		typedef void(*receive_callback)(uv_arq_session* session, const char* data, size_t length);
+
+	public:
+		enum
+		{
+			HEADER_SIZE = 24,
+			MAX_FRAGMENTS = 255,
+		};
+
+		uv_arq_session(uint32_t conv, uv_udp_client* client, const sockaddr* peer);
+
+		//start the update timer on the client's loop
+		bool start();
+		//instead of delete, the session frees itself once libuv is done with its timer
+		void close();
+
+		//queue one message, split into mss sized segments.
+		//false if it needs more segments than the receive window holds
+		bool send(const char* data, const size_t length);
+		//a datagram from the peer, false if it is not a valid packet of this conv
+		bool input(const char* data, const size_t length);
+		//send pending acks and whatever the windows allow, done every interval by the timer
+		void flush();
+
+		//nodelay: lower minimum rto and flush right away on send/input
+		//interval: update period in ms
+		//resend: acks of later segments before a fast retransmit, 0 disables it
+		//congestion: false ignores the congestion window, only the peer window limits sending
+		void set_nodelay(bool nodelay, unsigned interval, unsigned resend, bool congestion);
+		void set_window(unsigned send_window, unsigned receive_window);
+		bool set_mtu(unsigned mtu);
+		//resends of one segment before the session is considered dead
+		void set_dead_link(unsigned count) { m_dead_link = count; }
+		void set_receive_callback(receive_callback callback) { m_receive_callback = callback; }
+
+		//conv of a datagram, for picking the session it belongs to
+		static bool read_conv(const char* data, const size_t length, uint32_t& conv);
+
+		uint32_t		conv()		const { return m_conv; }
+		uv_udp_client*	client()	const { return m_client; }
+		const sockaddr*	peer()		const { return (const sockaddr*)&m_peer; }
+		//segments queued or waiting for an ack
+		size_t			waiting()	const { return m_send_queue.size() + m_send_buffer.size(); }
+		unsigned		srtt()		const { return m_srtt; }
+		unsigned		rto()		const { return m_rto; }
+		unsigned		cwnd()		const { return m_cwnd; }
+		bool			dead()		const { return m_dead; }
+		void*			data()		const { return m_data; }
+		void			set_data(void* data) { m_data = data; }
+
+	protected:
+		struct segment
+		{
+			uint32_t	conv;
+			uint8_t		cmd;
+			uint8_t		frg;
+			uint16_t	wnd;
+			uint32_t	ts;
+			uint32_t	sn;
+			uint32_t	una;
+			uint32_t	resendts;
+			uint32_t	rto;
+			uint32_t	fastack;
+			uint32_t	xmit;
+			std::string	data;
+		};
+
+		virtual ~uv_arq_session();
+
+		uint32_t	now() const;
+		uint16_t	window_unused() const;
+
+		void		update_rtt(int32_t rtt);
+		void		shrink_buffer();
+		void		parse_ack(uint32_t sn);
+		void		parse_una(uint32_t una);
+		void		parse_fastack(uint32_t sn, uint32_t ts);
+		void		parse_data(segment& seg);
+		void		deliver();
+
+		void		write_segment(const segment& seg);
+		void		output();
+
+		static void on_timer(uv_timer_t* handle);
+		static void on_close(uv_handle_t* handle);
+
+	private:
+		uint32_t				m_conv;
+		uv_udp_client*			m_client;
+		sockaddr_storage		m_peer;
+		uv_timer_t				m_timer;
+		bool					m_started;
+
+		unsigned				m_mtu;
+		unsigned				m_mss;
+		uint32_t				m_snd_una;
+		uint32_t				m_snd_nxt;
+		uint32_t				m_rcv_nxt;
+		unsigned				m_snd_wnd;
+		unsigned				m_rcv_wnd;
+		unsigned				m_rmt_wnd;
+		unsigned				m_cwnd;
+		unsigned				m_ssthresh;
+		unsigned				m_incr;
+		unsigned				m_probe;
+		uint32_t				m_ts_probe;
+		unsigned				m_probe_wait;
+
+		unsigned				m_srtt;
+		unsigned				m_rttval;
+		unsigned				m_rto;
+		unsigned				m_min_rto;
+		unsigned				m_interval;
+		bool					m_nodelay;
+		unsigned				m_fastresend;
+		bool					m_congestion;
+		unsigned				m_dead_link;
+		bool					m_dead;
+
+		std::deque<segment>		m_send_queue;
+		std::deque<segment>		m_send_buffer;
+		std::deque<segment>		m_receive_queue;
+		std::deque<segment>		m_receive_buffer;
+		std::vector<uint32_t>	m_acks;				//sn, ts pairs
+		std::vector<char>		m_output;
+		size_t					m_output_length;
+		std::string				m_message;
+
+		receive_callback		m_receive_callback;
+		void*					m_data;
+	};
+}
+
+#endif // !UV_ARQ_SESSION_H_
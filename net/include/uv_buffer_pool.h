@@ -0,0 +1,93 @@
+#pragma once
+#ifndef UV_BUFFER_POOL_H_
+#define UV_BUFFER_POOL_H_
+
+#include <vector>
+#include <atomic>
+#include <stddef.h>
+#include "uv.h"
+#include "uv_net.h"
+
+namespace uv
+{
+	//fixed size read blocks recycled through a free list.
+	//acquire on the loop thread, release from any thread.
+	//every retained uv_buffer holds a reference, a pool made with new is given up with unref()
+	//instead of delete so it goes away with the last buffer
+	class uv_buffer_pool
+	{
+	public:
+		uv_buffer_pool(size_t block_size = READ_BLOCK_SIZE, size_t max_free = 64);
+		virtual ~uv_buffer_pool();
+
+		void	add_ref();
+		//the creator's reference counts as one, deletes the pool when the last one is gone
+		void	unref();
+
+		char*	acquire();
+		void	release(char* block);
+		//allocate and touch count blocks now, so their pages come from the calling thread's node
+		void	prefill(size_t count);
+
+		size_t	block_size()	const { return m_block_size; }
+
+	private:
+		uv_mutex_t			m_mutex;
+		std::atomic<long>	m_refs;
+		std::vector<char*>	m_free;
+		size_t				m_block_size;
+		size_t				m_max_free;
+	};
+
+	//owns a pooled block taken out of a receive view, gives it back when destroyed.
+	//holds a reference on the pool, so it may outlive the reader it came from. without a
+	//pool the block is a private copy and freed
+	class uv_buffer
+	{
+	public:
+		uv_buffer();
+		uv_buffer(uv_buffer_pool* pool, char* block, size_t length);
+		uv_buffer(uv_buffer&& other);
+		uv_buffer& operator=(uv_buffer&& other);
+		~uv_buffer();
+
+		const char*	data()		const { return m_block; }
+		size_t		length()	const { return m_length; }
+		bool		empty()		const { return m_block == nullptr; }
+		void		release();
+
+	private:
+		uv_buffer(const uv_buffer&);
+		uv_buffer& operator=(const uv_buffer&);
+
+		uv_buffer_pool*	m_pool;
+		char*			m_block;
+		size_t			m_length;
+	};
+
+	//the bytes of one read, only valid inside the receive callback unless retained
+	class uv_recv_view
+	{
+	public:
+		uv_recv_view(uv_buffer_pool* pool, uv_buf_t* owner, size_t length) :
+			m_pool(pool), m_owner(owner), m_data(owner->base), m_length(length) {}
+		//bytes that don't sit in a pooled block, e.g. a reassembled message. retain copies them
+		uv_recv_view(const char* data, size_t length) :
+			m_pool(nullptr), m_owner(nullptr), m_data((char*)data), m_length(length) {}
+
+		const char*	data()		const { return m_data; }
+		size_t		length()	const { return m_length; }
+		bool		retained()	const { return m_owner == nullptr && m_pool != nullptr; }
+
+		//take the block from the reader without copying, the reader picks a fresh one for the next read
+		uv_buffer	retain();
+
+	private:
+		uv_buffer_pool*	m_pool;
+		uv_buf_t*		m_owner;
+		char*			m_data;
+		size_t			m_length;
+	};
+}
+
+#endif // !UV_BUFFER_POOL_H_
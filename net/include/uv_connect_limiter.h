@@ -0,0 +1,38 @@
+#pragma once
+#ifndef UV_CONNECT_LIMITER_H_
+#define UV_CONNECT_LIMITER_H_
+
+#include <deque>
+#include <stddef.h>
+
+namespace uv
+{
+	class uv_tcp_client;
+
+	//caps the number of connects in progress on one loop, the rest wait in fifo order.
+	//not thread safe, share it only between clients of the same loop.
+	class uv_connect_limiter
+	{
+		friend class uv_tcp_client;
+	public:
+		uv_connect_limiter(size_t max_pending = 256);
+		virtual ~uv_connect_limiter();
+
+		size_t	max_pending()	const { return m_max_pending; }
+		size_t	pending()		const { return m_pending; }
+		size_t	queued()		const { return m_queue.size(); }
+
+	protected:
+		bool	acquire(uv_tcp_client* client);
+		void	release();
+		void	cancel(uv_tcp_client* client);
+		void	drain();
+
+	private:
+		size_t						m_max_pending;
+		size_t						m_pending;
+		std::deque<uv_tcp_client*>	m_queue;
+	};
+}
+
+#endif // !UV_CONNECT_LIMITER_H_
@@ -0,0 +1,299 @@
+#pragma once
+#ifndef UV_COROUTINE_H_
+#define UV_COROUTINE_H_
+
+//c++20 coroutines over the callback api, left out of older builds. the v140 (vs2015) project
+//builds without it, use a c++20 compiler (e.g. v142 with /std:c++latest) to get this api
+#if (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L) || __cplusplus >= 202002L
+#if defined(__has_include)
+#if __has_include(<coroutine>)
+#define UV_HAVE_COROUTINES 1
+#endif
+#endif
+#endif
+
+#ifdef UV_HAVE_COROUTINES
+
+#include <stddef.h>
+#include <stdint.h>
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <vector>
+#include "uv.h"
+#include "uv_net.h"
+#include "uv_tcp_client.h"
+#include "uv_tcp_session.h"
+
+namespace uv
+{
+	//coroutine frames and sleep timers come from per thread free lists, one loop per thread
+	//makes it a per loop pool. blocks are kept in 64 byte classes up to MAX_BLOCK
+	class uv_co_frame_pool
+	{
+	public:
+		enum
+		{
+			GRANULE = 64,
+			MAX_BLOCK = 4096,
+			MAX_FREE = 256,		//per class
+		};
+
+		static void*	allocate(size_t size);
+		static void		release(void* block, size_t size);
+	};
+
+	struct uv_co_promise_base
+	{
+		std::coroutine_handle<>	continuation;
+		bool					detached = false;
+
+		static void* operator new(size_t size) { return uv_co_frame_pool::allocate(size); }
+		static void operator delete(void* block, size_t size) { uv_co_frame_pool::release(block, size); }
+
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		//the library doesn't throw, an exception escaping a coroutine is a bug
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+
+	template<typename P>
+	struct uv_co_final_awaiter
+	{
+		bool await_ready() noexcept { return false; }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept
+		{
+			P& promise = handle.promise();
+			if (promise.continuation)
+			{
+				return promise.continuation;
+			}
+			if (promise.detached)
+			{
+				handle.destroy();
+			}
+			return std::noop_coroutine();
+		}
+		void await_resume() noexcept {}
+	};
+
+	//lazy task, runs when awaited or detached. awaiting resumes the awaiter when the task returns
+	template<typename T = void>
+	class uv_co_task
+	{
+	public:
+		struct promise_type : uv_co_promise_base
+		{
+			T value{};
+
+			uv_co_task get_return_object() { return uv_co_task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			uv_co_final_awaiter<promise_type> final_suspend() noexcept { return {}; }
+			void return_value(T v) { value = std::move(v); }
+		};
+
+		uv_co_task(uv_co_task&& other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+		~uv_co_task() { if (m_handle) m_handle.destroy(); }
+
+		//run it without anyone waiting, the frame frees itself at the end
+		void detach()
+		{
+			std::coroutine_handle<promise_type> handle = m_handle;
+			m_handle = nullptr;
+			handle.promise().detached = true;
+			handle.resume();
+		}
+
+		bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+		{
+			m_handle.promise().continuation = awaiter;
+			return m_handle;
+		}
+		T await_resume() { return std::move(m_handle.promise().value); }
+
+	private:
+		explicit uv_co_task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+		uv_co_task(const uv_co_task&) = delete;
+		uv_co_task& operator=(const uv_co_task&) = delete;
+
+		std::coroutine_handle<promise_type>	m_handle;
+	};
+
+	template<>
+	class uv_co_task<void>
+	{
+	public:
+		struct promise_type : uv_co_promise_base
+		{
+			uv_co_task get_return_object() { return uv_co_task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			uv_co_final_awaiter<promise_type> final_suspend() noexcept { return {}; }
+			void return_void() {}
+		};
+
+		uv_co_task(uv_co_task&& other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+		~uv_co_task() { if (m_handle) m_handle.destroy(); }
+
+		void detach()
+		{
+			std::coroutine_handle<promise_type> handle = m_handle;
+			m_handle = nullptr;
+			handle.promise().detached = true;
+			handle.resume();
+		}
+
+		bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+		{
+			m_handle.promise().continuation = awaiter;
+			return m_handle;
+		}
+		void await_resume() {}
+
+	private:
+		explicit uv_co_task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+		uv_co_task(const uv_co_task&) = delete;
+		uv_co_task& operator=(const uv_co_task&) = delete;
+
+		std::coroutine_handle<promise_type>	m_handle;
+	};
+
+	//co_await uv_co_sleep(loop, ms)
+	class uv_co_sleep
+	{
+	public:
+		uv_co_sleep(uv_loop_t* loop, uint64_t timeout) : m_loop(loop), m_timeout(timeout) {}
+		explicit uv_co_sleep(uint64_t timeout) : m_loop(uv_default_loop()), m_timeout(timeout) {}
+
+		bool	await_ready() const noexcept { return false; }
+		void	await_suspend(std::coroutine_handle<> handle);
+		void	await_resume() const noexcept {}
+
+	private:
+		uv_loop_t*	m_loop;
+		uint64_t	m_timeout;
+	};
+
+	//the bytes of a read, valid until the next read on the stream. status is 0 or a uv error
+	struct uv_co_result
+	{
+		int			status;
+		const char*	data;
+		size_t		length;
+	};
+
+	//awaitable side of one tcp session or client. it takes over the receive, connect and close
+	//callbacks and the data pointer of what it wraps. one reader and any number of writers at a time.
+	//messages are a 4 byte little endian length followed by the payload
+	class uv_co_stream
+	{
+	public:
+		explicit uv_co_stream(uv_tcp_session* session);
+		explicit uv_co_stream(uv_tcp_client* client);
+		virtual ~uv_co_stream();
+
+		class read_awaiter
+		{
+		public:
+			read_awaiter(uv_co_stream* stream, int mode, size_t length) : m_stream(stream), m_mode(mode), m_length(length) {}
+			bool			await_ready() { return m_stream->try_read(m_mode, m_length, m_result); }
+			void			await_suspend(std::coroutine_handle<> handle) { m_stream->wait_read(this, handle); }
+			uv_co_result	await_resume() { return m_result; }
+
+		private:
+			friend class uv_co_stream;
+			uv_co_stream*	m_stream;
+			int				m_mode;
+			size_t			m_length;
+			uv_co_result	m_result;
+		};
+
+		class send_awaiter
+		{
+		public:
+			send_awaiter(uv_co_stream* stream, const char* data, size_t length, bool message);
+			bool	await_ready() const noexcept { return false; }
+			bool	await_suspend(std::coroutine_handle<> handle);
+			int		await_resume() const noexcept { return m_status; }
+
+		private:
+			static void on_write(uv_write_t* req, int status);
+
+			uv_co_stream*			m_stream;
+			uv_write_t				m_req;
+			uv_buf_t				m_bufs[2];
+			unsigned				m_count;
+			char					m_header[4];
+			int						m_status;
+			std::coroutine_handle<>	m_handle;
+		};
+
+		class connect_awaiter
+		{
+		public:
+			connect_awaiter(uv_co_stream* stream, const char* ip, unsigned port) : m_stream(stream), m_ip(ip), m_port(port), m_status(0) {}
+			bool	await_ready() const noexcept { return false; }
+			bool	await_suspend(std::coroutine_handle<> handle);
+			int		await_resume() const noexcept { return m_status; }
+
+		private:
+			friend class uv_co_stream;
+			uv_co_stream*			m_stream;
+			const char*				m_ip;
+			unsigned				m_port;
+			int						m_status;
+			std::coroutine_handle<>	m_handle;
+		};
+
+		//client only, resumes with the connect status
+		connect_awaiter	connect(const char* ip, unsigned port) { return connect_awaiter(this, ip, port); }
+		//whatever arrived, at least one byte
+		read_awaiter	read() { return read_awaiter(this, READ_SOME, 0); }
+		read_awaiter	read_exact(size_t length) { return read_awaiter(this, READ_EXACT, length); }
+		read_awaiter	read_message() { return read_awaiter(this, READ_MESSAGE, 0); }
+		//resume once the write completed, the data has to stay valid until then
+		send_awaiter	send(const char* data, size_t length) { return send_awaiter(this, data, length, false); }
+		send_awaiter	send_message(const char* data, size_t length) { return send_awaiter(this, data, length, true); }
+
+		bool			closed()	const { return m_closed; }
+		uv_stream_t*	stream()	const { return m_stream; }
+		//messages above this fail the read with UV_E2BIG
+		void			set_max_message(size_t length) { m_max_message = length; }
+
+	private:
+		enum
+		{
+			READ_SOME,
+			READ_EXACT,
+			READ_MESSAGE,
+		};
+
+		bool	try_read(int mode, size_t length, uv_co_result& result);
+		void	wait_read(read_awaiter* awaiter, std::coroutine_handle<> handle);
+		void	feed(const char* data, size_t length);
+		void	shutdown(int status);
+
+		static void on_session_receive(uv_tcp_session* session, const char* data, size_t length);
+		static void on_session_close(uv_tcp_session* session);
+		static void on_client_receive(uv_tcp_client* client, char* data, size_t length);
+		static void on_client_connect(uv_tcp_client* client, int status);
+		static void on_client_close(uv_tcp_client* client);
+
+	private:
+		uv_tcp_session*			m_session;
+		uv_tcp_client*			m_client;
+		uv_stream_t*			m_stream;
+		std::vector<char>		m_buffer;
+		std::vector<char>		m_staging;		//arrived since the last read, m_buffer doesn't move under a result
+		size_t					m_head;			//consumed bytes at the front of m_buffer
+		size_t					m_consume;		//bytes handed out by the last read, dropped by the next
+		size_t					m_max_message;
+		bool					m_closed;
+		int						m_status;
+		read_awaiter*			m_reader;
+		std::coroutine_handle<>	m_read_handle;
+		connect_awaiter*		m_connector;
+	};
+}
+
+#endif // UV_HAVE_COROUTINES
+
+#endif // !UV_COROUTINE_H_
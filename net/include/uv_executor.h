@@ -0,0 +1,157 @@
+#pragma once
+#ifndef UV_EXECUTOR_H_
+#define UV_EXECUTOR_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include "uv.h"
+#include "uv_net.h"
+
+namespace uv
+{
+	class uv_executor;
+	class uv_executor_port;
+	class uv_serial_queue;
+
+	typedef void(*executor_work_callback)(void* arg);
+	//status is 0, or UV_ECANCELED when stop() dropped the work before it ran
+	typedef void(*executor_done_callback)(void* arg, int status);
+
+	struct uv_executor_task
+	{
+		executor_work_callback	work;
+		executor_done_callback	done;
+		void*					arg;
+		uv_executor_port*		port;
+		uv_serial_queue*		serial;
+		int						status;
+	};
+
+	//work stealing pool for cpu bound tasks. tasks submitted from outside, e.g. by a loop, enter
+	//one fifo injection queue. tasks submitted by a task stay on the worker's own deque, the worker
+	//runs the newest of them first and steals the oldest of another deque when it runs dry
+	class uv_executor
+	{
+	public:
+		//0 workers means one per core
+		uv_executor(size_t workers = 0);
+		virtual ~uv_executor();
+
+		bool	start();
+		//waits for the workers, the queued tasks run first or are cancelled with drain false
+		void	stop(bool drain = true);
+
+		size_t	workers()	const { return m_workers.size(); }
+		size_t	queued()	const { return m_queued.load(); }
+
+	protected:
+		friend class uv_executor_port;
+		friend class uv_serial_queue;
+
+		void	push(uv_executor_task* task);
+		void	finish(uv_executor_task* task);
+
+	private:
+		struct worker
+		{
+			uv_executor*					executor;
+			size_t							index;
+			uv_thread_t						thread;
+			uv_mutex_t						mutex;
+			std::deque<uv_executor_task*>	tasks;
+			unsigned						ticks;
+		};
+
+		enum
+		{
+			INJECT_INTERVAL = 32,	//tasks a worker runs before it looks at the injection queue first
+		};
+
+		uv_executor_task*	pop(worker* w);
+		uv_executor_task*	pop_injected();
+		uv_executor_task*	steal(worker* w);
+
+		static void	run_worker(void* arg);
+
+	private:
+		std::vector<worker*>		m_workers;
+		std::atomic<size_t>			m_queued;
+		uv_mutex_t					m_inject_mutex;
+		std::deque<uv_executor_task*>	m_injected;
+		std::atomic<int>			m_sleepers;
+		uv_mutex_t					m_mutex;
+		uv_cond_t					m_cond;
+		std::atomic<bool>			m_accepting;
+		bool						m_running;
+		bool						m_stopping;
+		std::atomic<bool>			m_cancel;
+	};
+
+	//where tasks of one loop enter the executor and their completions come back,
+	//done callbacks run on the loop thread through a uv_async
+	class uv_executor_port
+	{
+	public:
+		uv_executor_port(uv_executor* executor, uv_loop_t* loop);
+
+		bool	open();
+		bool	submit(executor_work_callback work, executor_done_callback done, void* arg);
+		//the port frees itself once the tasks in flight completed
+		void	close();
+
+		uv_executor*	executor()	const { return m_executor; }
+		uv_loop_t*		loop()		const { return m_loop; }
+		size_t			pending()	const { return m_pending; }
+
+	protected:
+		friend class uv_executor;
+		friend class uv_serial_queue;
+
+		uv_executor_task*	create(executor_work_callback work, executor_done_callback done, void* arg);
+		void				complete(uv_executor_task* task);
+
+	private:
+		~uv_executor_port();
+
+		static void	on_async(uv_async_t* handle);
+		static void	on_close(uv_handle_t* handle);
+
+	private:
+		uv_executor*					m_executor;
+		uv_loop_t*						m_loop;
+		uv_async_t						m_async;
+		uv_mutex_t						m_mutex;
+		std::vector<uv_executor_task*>	m_completed;
+		size_t							m_pending;		//loop thread only
+		bool							m_open;
+		bool							m_closing;
+	};
+
+	//tasks submitted here run one after another in submission order, on whichever worker is
+	//free, and complete in that order. e.g. one per session keeps its messages in order
+	class uv_serial_queue
+	{
+	public:
+		uv_serial_queue(uv_executor_port* port);
+		//only once every submitted task completed
+		virtual ~uv_serial_queue();
+
+		bool	submit(executor_work_callback work, executor_done_callback done, void* arg);
+
+	protected:
+		friend class uv_executor;
+
+		//on the worker that ran task: hand back its completion and start the next one
+		void	finish(uv_executor_task* task);
+
+	private:
+		uv_executor_port*				m_port;
+		uv_mutex_t						m_mutex;
+		std::deque<uv_executor_task*>	m_tasks;
+		bool							m_running;
+	};
+}
+
+#endif // !UV_EXECUTOR_H_
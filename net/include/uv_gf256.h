@@ -0,0 +1,38 @@
+#pragma once
+#ifndef UV_GF256_H_
+#define UV_GF256_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__SSSE3__) || (defined(_MSC_VER) && defined(__AVX__))
+#define UV_GF256_SSSE3 1
+#endif
+
+namespace uv
+{
+	//arithmetic in GF(2^8) with the polynomial 0x11d, as used by reed-solomon erasure codes.
+	//the region functions use ssse3 pshufb nibble tables when the build enables ssse3
+	class uv_gf256
+	{
+	public:
+		static uint8_t	add(uint8_t a, uint8_t b) { return a ^ b; }
+		static uint8_t	mul(uint8_t a, uint8_t b);
+		static uint8_t	div(uint8_t a, uint8_t b);
+		static uint8_t	inv(uint8_t a);
+
+		//dst ^= src
+		static void		add_region(uint8_t* dst, const uint8_t* src, size_t length);
+		//dst ^= c * src
+		static void		mul_add_region(uint8_t* dst, const uint8_t* src, uint8_t c, size_t length);
+		//dst = c * dst
+		static void		mul_region(uint8_t* dst, uint8_t c, size_t length);
+
+		//invert an n x n matrix in place, false if it is singular
+		static bool		invert_matrix(uint8_t* matrix, size_t n);
+
+		static bool		simd();
+	};
+}
+
+#endif // !UV_GF256_H_
@@ -0,0 +1,58 @@
+#pragma once
+#ifndef UV_HISTOGRAM_H_
+#define UV_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace uv
+{
+	//log bucketed latency histogram in fixed memory, about 1.6% value precision.
+	//one thread records, any thread may take a snapshot or read percentiles.
+	class uv_histogram
+	{
+	public:
+		enum
+		{
+			SUB_BUCKET_BITS	= 6,
+			SUB_BUCKETS		= 1 << SUB_BUCKET_BITS,
+			MAX_VALUE_BITS	= 36,
+			BUCKETS			= (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS
+		};
+
+		uv_histogram();
+		uv_histogram(const uv_histogram& other);
+		uv_histogram& operator=(const uv_histogram& other);
+
+		//values above 2^36 are clamped
+		void		record(uint64_t value);
+		void		merge(const uv_histogram& other);
+		void		reset();
+		uv_histogram snapshot() const { return *this; }
+
+		uint64_t	count()		const { return m_count.load(std::memory_order_relaxed); }
+		uint64_t	min()		const;
+		uint64_t	max()		const { return m_max.load(std::memory_order_relaxed); }
+		double		mean()		const;
+		//percent in [0, 100], returns the highest value equivalent to the bucket it falls in
+		uint64_t	percentile(double percent) const;
+
+	private:
+		static size_t	index(uint64_t value);
+		static uint64_t	highest(size_t index);
+
+		void add(std::atomic<uint64_t>& counter, uint64_t value)
+		{
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		std::atomic<uint64_t>	m_counts[BUCKETS];
+		std::atomic<uint64_t>	m_count;
+		std::atomic<uint64_t>	m_sum;
+		std::atomic<uint64_t>	m_min;
+		std::atomic<uint64_t>	m_max;
+	};
+}
+
+#endif // !UV_HISTOGRAM_H_
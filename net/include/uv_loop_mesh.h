@@ -0,0 +1,109 @@
+#pragma once
+#ifndef UV_LOOP_MESH_H_
+#define UV_LOOP_MESH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "uv.h"
+#include "uv_net.h"
+#include "uv_runtime.h"
+#include "uv_spsc_ring.h"
+
+namespace uv
+{
+	//what travels between loops, the meaning of the fields is up to the application. data
+	//belongs to the receiver once delivered
+	struct uv_mesh_message
+	{
+		uint32_t	type;
+		uint32_t	length;
+		uint64_t	id;
+		void*		data;
+	};
+
+	//one spsc ring for every ordered pair of loops of a runtime. a loop stages what it sends
+	//and publishes once per tick, before the poll and after it, then wakes each destination it
+	//published to with at most one async. the receiving loop drains all rings pointed at it in
+	//one callback. no lock is taken on either side
+	class uv_loop_mesh
+	{
+		typedef void(*receive_callback)(uv_loop_mesh* mesh, size_t from, size_t to, const uv_mesh_message& message);
+
+	public:
+		//capacity of each ring, rounded up to a power of two
+		uv_loop_mesh(uv_runtime* runtime, size_t capacity = 1024);
+		virtual ~uv_loop_mesh();
+
+		//after the runtime started, from a thread that doesn't run one of its loops.
+		//returns once every loop is attached
+		bool	open();
+		//before the runtime stops and once the loops stopped sending, from the same kind of thread.
+		//messages not yet delivered are dropped, their data isn't freed
+		void	close();
+
+		//from a loop of the runtime only. the message is delivered on the loop of index to, in the
+		//order sent. false when the ring to that loop is full or the caller isn't a runtime loop
+		bool	send(size_t to, const uv_mesh_message& message);
+		//publish what the calling loop staged right away instead of at the end of the phase
+		void	flush();
+
+		void	set_receive_callback(receive_callback callback) { m_receive_callback = callback; }
+
+		uv_runtime*	runtime()	const { return m_runtime; }
+		size_t		size()		const { return m_nodes.size(); }
+		//sends that found the ring full, from every loop
+		uint64_t	rejected()	const { return m_rejected.load(std::memory_order_relaxed); }
+		void*		data()		const { return m_data; }
+		void		set_data(void* data) { m_data = data; }
+
+	private:
+		typedef uv_spsc_ring<uv_mesh_message> ring;
+
+		enum
+		{
+			BATCH = 64,		//messages popped per ring access
+		};
+
+		//the part of the mesh that belongs to one loop
+		struct node
+		{
+			uv_loop_mesh*		mesh;
+			size_t				index;
+			uv_async_t			async;
+			uv_prepare_t		prepare;
+			uv_check_t			check;
+			int					closing;
+			bool				open;
+			//set by the first producer that publishes after the last drain
+			std::atomic<bool>	signaled;
+			//destinations with staged messages, producer side
+			std::vector<size_t>	dirty;
+			std::vector<char>	marked;
+		};
+
+		ring*	get(size_t from, size_t to) const { return m_rings[from * m_nodes.size() + to]; }
+		void	publish(node* n);
+		void	drain(node* n);
+
+		static void on_open(uv_runtime* runtime, size_t index, void* arg);
+		static void on_close_task(uv_runtime* runtime, size_t index, void* arg);
+		static void on_async(uv_async_t* handle);
+		static void on_prepare(uv_prepare_t* handle);
+		static void on_check(uv_check_t* handle);
+		static void on_close(uv_handle_t* handle);
+
+	private:
+		uv_runtime*				m_runtime;
+		std::vector<node*>		m_nodes;
+		std::vector<ring*>		m_rings;
+		uv_sem_t				m_done;
+		bool					m_open;
+		std::atomic<uint64_t>	m_rejected;
+		receive_callback		m_receive_callback;
+		void*					m_data;
+	};
+}
+
+#endif // !UV_LOOP_MESH_H_
@@ -0,0 +1,121 @@
+#pragma once
+#ifndef UV_LOOP_MONITOR_H_
+#define UV_LOOP_MONITOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "uv.h"
+#include "uv_net.h"
+#include "uv_histogram.h"
+
+namespace uv
+{
+	//one window of loop measurements, times in microseconds
+	struct uv_loop_stats
+	{
+		double		utilization;		//busy / (busy + idle)
+		uint64_t	busy;
+		uint64_t	idle;				//blocked in the poll waiting for events
+		uint64_t	iterations;
+		double		callbacks;			//library io callbacks per iteration
+		uint64_t	iteration_max;		//longest iteration, not counting the wait
+		uint64_t	lag_mean;			//how late the sampling timer fired
+		uint64_t	lag_max;
+	};
+
+	//tells a saturated loop from a slow network. a prepare and a check handle bracket the poll
+	//phase, the first io callback of the library after the poll marks the end of the wait, so
+	//busy is everything else the loop does. callbacks of plain libuv handles count as waiting.
+	//a sampling timer measures how late it fires. stats roll over every window, the average
+	//is an exponential moving average over the windows
+	class uv_loop_monitor
+	{
+		typedef void(*threshold_callback)(uv_loop_monitor* monitor, const uv_loop_stats& stats);
+
+	public:
+		uv_loop_monitor(uv_loop_t* loop = uv_default_loop());
+		virtual ~uv_loop_monitor();
+
+		//sample is the lag timer interval, window how often stats roll over, both in ms
+		bool	start(unsigned sample = 50, unsigned window = 1000);
+		void	stop();
+
+		//called at the end of every window in which utilization or mean lag (us) exceeds its limit,
+		//0 disables a limit
+		void	set_threshold(double utilization, uint64_t lag, threshold_callback callback);
+
+		//the last complete window
+		const uv_loop_stats&	last()		const { return m_last; }
+		const uv_loop_stats&	average()	const { return m_average; }
+		//every lag sample since start, in microseconds
+		const uv_histogram&		lag()		const { return m_lag; }
+		uv_loop_t*				loop()		const { return m_loop; }
+		void*					data()		const { return m_data; }
+		void					set_data(void* data) { m_data = data; }
+
+		//io callbacks of the library call this first, it costs two thread local accesses without a monitor
+		static void mark()
+		{
+			++s_dispatched;
+			uv_loop_monitor* monitor = s_current;
+			if (monitor != nullptr)
+			{
+				if (monitor->m_wake == 0)
+				{
+					monitor->m_wake = uv_hrtime();
+				}
+				++monitor->m_callbacks;
+			}
+		}
+		//io callbacks of the library that ran on the calling thread so far
+		static uint64_t dispatched() { return s_dispatched; }
+
+	protected:
+		void	roll();
+
+		static void on_prepare(uv_prepare_t* handle);
+		static void on_check(uv_check_t* handle);
+		static void on_timer(uv_timer_t* handle);
+
+	private:
+		static thread_local uv_loop_monitor* s_current;
+		static thread_local uint64_t s_dispatched;
+
+		uv_loop_t*			m_loop;
+		uv_prepare_t		m_prepare;
+		uv_check_t			m_check;
+		uv_timer_t			m_timer;
+		bool				m_started;
+		unsigned			m_sample;
+		uint64_t			m_window;		//ns
+		uint64_t			m_window_start;
+		uint64_t			m_due;			//hrtime the sampling timer should fire
+
+		uint64_t			m_prepare_time;
+		uint64_t			m_check_time;
+		uint64_t			m_wake;
+		uint64_t			m_callbacks;
+
+		//current window, ns
+		uint64_t			m_busy;
+		uint64_t			m_idle;
+		uint64_t			m_iterations;
+		uint64_t			m_iteration_callbacks;
+		uint64_t			m_iteration_max;
+		uint64_t			m_lag_sum;
+		uint64_t			m_lag_count;
+		uint64_t			m_lag_max;
+
+		uv_loop_stats		m_last;
+		uv_loop_stats		m_average;
+		bool				m_has_average;
+		uv_histogram		m_lag;
+
+		double				m_max_utilization;
+		uint64_t			m_max_lag;
+		threshold_callback	m_threshold_callback;
+		void*				m_data;
+	};
+}
+
+#endif // !UV_LOOP_MONITOR_H_
@@ -20,6 +20,10 @@
 #endif
 
 #define BUFFER_SIZE (1024*1024)
+/* Large enough for any udp datagram. */
+#define UDP_BUFFER_SIZE (64*1024)
+/* Pooled read blocks, a retained view keeps its whole block alive. */
+#define READ_BLOCK_SIZE (64*1024)
 
 inline bool little_endian()
 {
@@ -0,0 +1,85 @@
+#pragma once
+#ifndef UV_RUNTIME_H_
+#define UV_RUNTIME_H_
+
+#include <stddef.h>
+#include <vector>
+#include "uv.h"
+#include "uv_net.h"
+#include "uv_buffer_pool.h"
+
+namespace uv
+{
+	//one loop per selected core, each run by a thread pinned to that core. the loop's buffer pool
+	//is allocated and touched on its own thread, so with the default first touch policy its pages
+	//sit on the core's numa node. servers and clients are created inside a posted task with
+	//loop(index) and attached there, they belong to that thread from then on
+	class uv_runtime
+	{
+		typedef void(*task_callback)(uv_runtime* runtime, size_t index, void* arg);
+
+	public:
+		//cpus lists the cores to use, empty means one loop per core the system reports
+		uv_runtime(const std::vector<int>& cpus = std::vector<int>());
+		virtual ~uv_runtime();
+
+		//returns once every loop runs
+		bool		start();
+		//runs the tasks already posted, then ends the loops and waits for the threads.
+		//close what was attached before, the loops end anyway
+		void		stop();
+
+		//run callback on the loop thread of index, thread safe
+		bool		post(size_t index, task_callback callback, void* arg);
+
+		//block size and count of the per loop buffer pools, set before start
+		void		set_buffer_pool(size_t block_size, size_t prefill, size_t max_free = 64);
+
+		size_t			size()						const { return m_loops.size(); }
+		uv_loop_t*		loop(size_t index)			const;
+		uv_buffer_pool*	buffer_pool(size_t index)	const;
+		int				cpu(size_t index)			const;
+		//false where the thread could not be pinned, it still runs unpinned
+		bool			pinned(size_t index)		const;
+		//index of the loop the calling thread runs, -1 outside the runtime
+		static int		current();
+
+	private:
+		struct task
+		{
+			task_callback	callback;
+			void*			arg;
+		};
+
+		struct loop_thread
+		{
+			uv_runtime*			runtime;
+			size_t				index;
+			int					cpu;
+			bool				pinned;
+			bool				running;
+			bool				stopping;
+			int					error;			//of the loop setup on the thread
+			uv_thread_t			thread;
+			uv_loop_t			loop;
+			uv_async_t			async;
+			uv_mutex_t			mutex;
+			std::vector<task>	tasks;
+			uv_buffer_pool*		pool;
+		};
+
+		static bool	pin(int cpu);
+		static void	run_loop(void* arg);
+		static void	on_async(uv_async_t* handle);
+
+	private:
+		std::vector<loop_thread*>	m_loops;
+		uv_sem_t					m_ready;
+		bool						m_started;
+		size_t						m_block_size;
+		size_t						m_prefill;
+		size_t						m_max_free;
+	};
+}
+
+#endif // !UV_RUNTIME_H_
@@ -0,0 +1,118 @@
+#pragma once
+#ifndef UV_SEQ_WINDOW_H_
+#define UV_SEQ_WINDOW_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "uv.h"
+#include "uv_net.h"
+
+namespace uv
+{
+	//sliding window over 32 bit sequence numbers of one peer. a 64 bit mask remembers which of the
+	//last 64 sequences arrived, so duplicates and packets older than the window are dropped with a
+	//shift and a test. sequences wrap, newer means ahead by less than 2^31
+	class uv_seq_window
+	{
+	public:
+		enum
+		{
+			ACCEPT = 0,
+			DUPLICATE,
+			STALE,		//older than the window, or than the latest in latest only mode
+			SIZE = 64,
+		};
+
+		uv_seq_window();
+
+		//classify seq and mark it received
+		int			update(uint32_t seq);
+		//classify seq without marking it
+		int			check(uint32_t seq) const;
+		bool		accept(uint32_t seq) { return update(seq) == ACCEPT; }
+		void		reset();
+
+		//only packets newer than every one before pass, for state streams where old values are useless
+		void		set_latest_only(bool latest_only) { m_latest_only = latest_only; }
+
+		uint32_t	latest()		const { return m_latest; }
+		bool		empty()			const { return m_init == false; }
+		size_t		duplicates()	const { return m_duplicates; }
+		size_t		stale()			const { return m_stale; }
+
+	private:
+		uint64_t	m_mask;			//bit i set: latest - i arrived
+		uint32_t	m_latest;
+		bool		m_init;
+		bool		m_latest_only;
+		size_t		m_duplicates;
+		size_t		m_stale;
+	};
+
+	//holds packets that arrive ahead of a gap for a bounded time and hands them out in sequence
+	//order. a gap is given up once the oldest held packet waited longer than the hold time or the
+	//buffer runs out of room, the missing sequences are skipped then. no retransmission is asked for
+	class uv_seq_reorder
+	{
+		typedef void(*deliver_callback)(uv_seq_reorder* reorder, uint32_t seq, const char* data, size_t length);
+
+	public:
+		//capacity is rounded up to a power of two, at most 64
+		uv_seq_reorder(uv_loop_t* loop, size_t capacity = 16, unsigned hold = 50);
+
+		//false if seq was a duplicate or already passed
+		bool		input(uint32_t seq, const char* data, const size_t length);
+		//deliver everything held, skipping the gaps
+		void		flush();
+		//instead of delete and not from the deliver callback. held packets are dropped, the reorder
+		//frees itself once libuv is done with its timer
+		void		close();
+
+		void		set_deliver_callback(deliver_callback callback) { m_deliver_callback = callback; }
+		void		set_hold(unsigned hold) { m_hold = hold; }
+
+		uint32_t	next()			const { return m_next; }
+		size_t		held()			const;
+		//sequences given up on
+		size_t		skipped()		const { return m_skipped; }
+		size_t		dropped()		const { return m_dropped; }
+		void*		data()			const { return m_data; }
+		void		set_data(void* data) { m_data = data; }
+
+	protected:
+		struct slot
+		{
+			std::string	data;
+			uint64_t	time;
+		};
+
+		virtual ~uv_seq_reorder();
+
+		void		deliver(uint32_t seq, const char* data, size_t length);
+		void		drain();
+		void		skip(uint32_t count);
+		void		schedule();
+
+		static void on_timer(uv_timer_t* handle);
+		static void on_close(uv_handle_t* handle);
+
+	private:
+		uv_loop_t*			m_loop;
+		uv_timer_t			m_timer;
+		bool				m_timer_init;	//on the first packet held, a reorder that never waits has no handle
+		std::vector<slot>	m_slots;
+		size_t				m_capacity;
+		uint64_t			m_mask;		//bit i set: next + i is held
+		uint32_t			m_next;
+		bool				m_init;
+		unsigned			m_hold;
+		size_t				m_skipped;
+		size_t				m_dropped;
+		deliver_callback	m_deliver_callback;
+		void*				m_data;
+	};
+}
+
+#endif // !UV_SEQ_WINDOW_H_
@@ -0,0 +1,134 @@
+#pragma once
+#ifndef UV_SPSC_RING_H_
+#define UV_SPSC_RING_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+namespace uv
+{
+	//bounded single producer single consumer ring, no locks. exactly one thread pushes and one
+	//thread pops. the producer can stage several items and make them visible with one publish,
+	//head and tail live on their own cache lines and each side keeps a cached copy of the other
+	//side's index, so the shared lines only move when the cached copy runs out
+	template<typename T>
+	class uv_spsc_ring
+	{
+	public:
+		//capacity is rounded up to a power of two
+		explicit uv_spsc_ring(size_t capacity = 1024) :
+			m_tail(0),
+			m_staged(0),
+			m_head_cache(0),
+			m_head(0),
+			m_tail_cache(0),
+			m_mask(0)
+		{
+			size_t size = 2;
+			while (size < capacity)
+			{
+				size <<= 1;
+			}
+			m_items.resize(size);
+			m_mask = size - 1;
+		}
+
+		//producer, false when full
+		bool try_push(const T& item)
+		{
+			if (stage(item) == false)
+			{
+				return false;
+			}
+			publish();
+			return true;
+		}
+
+		//producer, written but not visible to the consumer until publish
+		bool stage(const T& item)
+		{
+			if (m_staged - m_head_cache > m_mask)
+			{
+				m_head_cache = m_head.load(std::memory_order_acquire);
+				if (m_staged - m_head_cache > m_mask)
+				{
+					return false;
+				}
+			}
+			m_items[m_staged & m_mask] = item;
+			++m_staged;
+			return true;
+		}
+
+		//producer, makes every staged item visible, returns how many there were
+		size_t publish()
+		{
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail != m_staged)
+			{
+				m_tail.store(m_staged, std::memory_order_release);
+			}
+			return m_staged - tail;
+		}
+
+		//producer, items staged and not yet published
+		size_t staged() const { return m_staged - m_tail.load(std::memory_order_relaxed); }
+
+		//consumer, false when empty
+		bool try_pop(T& item)
+		{
+			return pop(&item, 1) == 1;
+		}
+
+		//consumer, up to max items with one store of the head
+		size_t pop(T* items, size_t max)
+		{
+			size_t head = m_head.load(std::memory_order_relaxed);
+			if (m_tail_cache - head < max)
+			{
+				m_tail_cache = m_tail.load(std::memory_order_acquire);
+			}
+			size_t count = m_tail_cache - head;
+			if (count > max)
+			{
+				count = max;
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				items[i] = m_items[(head + i) & m_mask];
+			}
+			if (count > 0)
+			{
+				m_head.store(head + count, std::memory_order_release);
+			}
+			return count;
+		}
+
+		//either side, only a snapshot while the other side runs
+		size_t size() const { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+		bool empty() const { return size() == 0; }
+		size_t capacity() const { return m_mask + 1; }
+
+	private:
+		uv_spsc_ring(const uv_spsc_ring&);
+		uv_spsc_ring& operator=(const uv_spsc_ring&);
+
+		enum { CACHE_LINE = 64 };
+
+		//producer line
+		std::atomic<size_t>	m_tail;
+		size_t				m_staged;
+		size_t				m_head_cache;
+		char				m_pad0[CACHE_LINE];
+		//consumer line
+		std::atomic<size_t>	m_head;
+		size_t				m_tail_cache;
+		char				m_pad1[CACHE_LINE];
+		//read only after construction
+		size_t				m_mask;
+		std::vector<T>		m_items;
+	};
+}
+
+#endif // !UV_SPSC_RING_H_
@@ -6,6 +6,12 @@
 #include <string>
 #include <assert.h>
 #include "uv_net.h"
+#include "uv_write_req.h"
+#include "uv_connect_limiter.h"
+#include "uv_buffer_pool.h"
+#include "uv_histogram.h"
+#include "uv_tick.h"
+#include <vector>
 
 namespace uv
 {
@@ -13,31 +19,74 @@ namespace uv
 
 	class uv_tcp_client
 	{
-		typedef void(*connect_callback)(int status);
-		typedef void(*receive_callback)(char* data, size_t length);
+		friend class uv_connect_limiter;
+		typedef void(*connect_callback)(uv_tcp_client* client, int status);
+		typedef void(*receive_callback)(uv_tcp_client* client, char* data, size_t length);
+		typedef void(*receive_view_callback)(uv_tcp_client* client, uv_recv_view& view);
+		typedef void(*close_callback)(uv_tcp_client* client);
 	public:
 		uv_tcp_client(uv_loop_t* loop = uv_default_loop());
 		virtual ~uv_tcp_client();
 
+		//connect and run the loop until it has no more work (blocking)
 		bool start(const char* ip, const unsigned port);
+		//only register the connect with the loop and return, the caller runs the loop.
+		//fails with UV_EBUSY until the handles of the last connection finished closing
+		bool attach(const char* ip, const unsigned port);
 		void close();
 
 		void send(const char* data, const size_t length);
 		void set_connect_callback(connect_callback callback) { m_connect_callback = callback; }
 		void set_receive_callback(receive_callback callback) { m_receive_callback = callback; }
+		//takes precedence over the plain receive callback, the view can be retained without a copy
+		void set_receive_view_callback(receive_view_callback callback) { m_receive_view_callback = callback; }
+		//called when an open client closes, by close() or because the peer went away
+		void set_close_callback(close_callback callback) { m_close_callback = callback; }
+		//read blocks come from this pool, set before start/attach. a private pool is used otherwise
+		void set_buffer_pool(uv_buffer_pool* pool) { m_buffer_pool = pool; }
 		bool set_no_delay(bool enable);
 		bool set_keep_alive(int enable, unsigned int delay);
+		//fail the connect with UV_ETIMEDOUT after timeout ms, 0 waits for the os. a connect
+		//cancelled by the timeout or close() is reported once the handles are closed, so the
+		//connect callback may attach again
+		void set_connect_timeout(unsigned int timeout) { m_connect_timeout = timeout; }
+		//queue the connect behind the limiter's cap of connects in progress
+		void set_connect_limiter(uv_connect_limiter* limiter) { m_connect_limiter = limiter; }
+
+		//time every send, complete_request() records the oldest outstanding one in microseconds
+		void enable_latency(bool enable);
+		void complete_request();
+		const uv_histogram* latency() const { return m_latency; }
+		//sends left untimed because 1024 were already outstanding
+		uint64_t untimed() const { return m_untimed; }
+
+		//for an attached client on a loop the application runs itself, once per tick: flushes the
+		//deferred sends, runs io for at most budget us, flushes again. backlog is in bytes
+		uv_tick_result run_for(uint64_t budget);
+		//send() only queues, the queue goes out as one write at flush() or in run_for
+		void set_defer_send(bool enable);
+		//false if nothing could be written, the queue is kept until the client is connected
+		bool flush();
 
 		uv_buf_t& read_buffer() { return m_read_buffer; }
-		uv_buf_t& write_buffer() { return m_write_buffer; }
+
+		uv_loop_t*	loop()					const { return m_loop; }
+		uv_tcp_t*	handle()						{ return &m_socket; }
+		void*		data()					const { return m_data; }
+		void		set_data(void* data) { m_data = data; }
+		const std::string& error() { return m_error; }
 
 	protected:
 		bool init();
 		bool connect(const char* ip, const unsigned port);
+		int  connect();
+		bool admit();
 		bool run();
+		bool write(const char* data, const size_t length);
 		void error(int status);
 
 		static void on_connect(uv_connect_t* req, int status);
+		static void on_connect_timeout(uv_timer_t* handle);
 		static void on_receive(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf);
 		static void on_send(uv_write_t* req, int statu);
 		static void on_alloc_buffer(uv_handle_t* hanle, size_t suggested_size, uv_buf_t* buf);
@@ -48,15 +97,38 @@ namespace uv
 		uv_loop_t*				m_loop;
 		uv_tcp_t				m_socket;
 		uv_connect_t			m_connect_req;
-		uv_write_t				m_write_req;
+		uv_timer_t				m_connect_timer;
+		struct sockaddr_in		m_addr;
 		uv_buf_t				m_read_buffer;
-		uv_buf_t				m_write_buffer;
 
 		std::string				m_error;
 		connect_callback		m_connect_callback;
 		receive_callback		m_receive_callback;
+		receive_view_callback	m_receive_view_callback;
+		close_callback			m_close_callback;
+		uv_buffer_pool*			m_buffer_pool;
+		uv_buffer_pool*			m_own_buffer_pool;
+		uv_connect_limiter*		m_connect_limiter;
+		unsigned int			m_connect_timeout;
+
+		uv_histogram*			m_latency;
+		std::vector<uint64_t>	m_send_times;
+		size_t					m_send_head;
+		size_t					m_send_tail;
+		size_t					m_send_overflow;	//untimed sends still outstanding, all newer than the timed ones
+		uint64_t				m_untimed;
 
 		bool					m_init;
+		bool					m_queued;
+		bool					m_admitted;
+		bool					m_timed_out;
+		bool					m_connect_pending;	//a connect cancelled by close() waits for the handles
+		int						m_connect_status;
+		int						m_closing;			//close callbacks still outstanding
+		bool					m_attached;
+		bool					m_defer_send;
+		std::vector<char>		m_deferred;
+		void*					m_data;
 
 	};
 
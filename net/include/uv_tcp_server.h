@@ -5,9 +5,15 @@
 #include <map>
 #include <string>
 #include <memory>
+#include <vector>
 #include <assert.h>
 #include "uv.h"
 #include "uv_tcp_session.h"
+#include "uv_buffer_pool.h"
+#include "uv_timer_wheel.h"
+#include "uv_executor.h"
+#include "uv_write_req.h"
+#include "uv_tick.h"
 
 namespace uv
 {
@@ -17,6 +23,8 @@ namespace uv
 	{
 		typedef void(*connect_callback)(uv_tcp_session* session);
 		typedef void(*receive_callback)(uv_tcp_session* session, const char* buf, size_t length);
+		typedef void(*timeout_callback)(uv_tcp_session* session, int reason);
+		typedef void(*heartbeat_callback)(uv_tcp_session* session);
 
 	public:
 		uv_tcp_server(uv_loop_t* loop = uv_default_loop());
@@ -24,6 +32,9 @@ namespace uv
 
 		bool			start_ipv4(const char* ip, const unsigned port);
 		bool			start_ipv6(const char* ip, const unsigned port);
+		//bind and listen without running the loop, for a loop that is already run by someone else
+		bool			attach_ipv4(const char* ip, const unsigned port);
+		bool			attach_ipv6(const char* ip, const unsigned port);
 
 		void			close();
 		virtual void	send(int sessionId, const char* data, const size_t length);
@@ -31,6 +42,33 @@ namespace uv
 		virtual void	set_receive_callback(int sessionId,receive_callback callback);
 		bool			set_no_delay(bool enable);
 		bool			set_keep_alive(int enable, unsigned int delay);
+		//read buffers of new sessions come from pool, set before start/attach
+		void			set_buffer_pool(uv_buffer_pool* pool) { m_buffer_pool = pool; }
+		uv_loop_t*		loop()		const { return m_loop; }
+
+		//ms without a read before a session is closed, 0 keeps sessions forever
+		void			set_idle_timeout(unsigned timeout) { m_idle_timeout = timeout; }
+		//ms a new session has to call set_established(), 0 means sessions start established
+		void			set_handshake_timeout(unsigned timeout) { m_handshake_timeout = timeout; }
+		//called every interval ms for each session, e.g. to send a ping
+		void			set_heartbeat(unsigned interval, heartbeat_callback callback);
+		//called before a session is closed by a timeout, reason is uv_tcp_session::TIMEOUT_*
+		void			set_timeout_callback(timeout_callback callback) { m_timeout_callback = callback; }
+		//share one wheel among the servers of a loop, else each server makes its own
+		void			set_timer_wheel(uv_timer_wheel* wheel) { m_wheel = wheel; }
+		//session defer runs on this executor port of the server's loop instead of the libuv thread pool
+		void			set_executor(uv_executor_port* port) { m_executor = port; }
+		uv_executor_port* executor()	const { return m_executor; }
+		//restart the idle timeout of a session
+		void			touch(uv_tcp_session* session);
+
+		//for an attached server on a loop the application runs itself, once per tick: flushes the
+		//deferred sends, runs io for at most budget us, flushes again. backlog is in bytes
+		uv_tick_result	run_for(uint64_t budget);
+		//send() only queues, each session's queue goes out as one write at flush() or in run_for
+		void			set_defer_send(bool enable);
+		//returns how many sessions were written to
+		size_t			flush();
 		
 		const char*		error() { return m_error.c_str(); }
 
@@ -45,6 +83,8 @@ namespace uv
 		static void on_alloc_buffer(uv_handle_t* hanle, size_t suggested_size, uv_buf_t* buf);
 		static void on_close(uv_handle_t* handle);
 		static void on_client_close(uv_handle_t* handle);
+		static void on_session_timeout(uv_timer_node* node);
+		static void on_session_heartbeat(uv_timer_node* node);
 
 	private:
 		bool init();
@@ -53,9 +93,13 @@ namespace uv
 		bool bind_ipv4(const char* ip, const unsigned port);
 		bool bind_ipv6(const char* ip, const unsigned port);
 		bool listen(int backlog = 1024);
+		bool write(uv_tcp_session* session, const char* data, const size_t length);
 
 		void error(int status) ;
 
+		void arm(uv_tcp_session* session);
+		void disarm(uv_tcp_session* session);
+
 	private:
 		uv_tcp_t						m_server;
 		std::map<int, uv_tcp_session*>	m_sessions;
@@ -63,7 +107,20 @@ namespace uv
 		uv_loop_t*						m_loop;
 		std::string						m_error;
 		connect_callback				m_connect_callback;
+		uv_buffer_pool*					m_buffer_pool;
+		int								m_session_id;
 		bool							m_init;
+		bool							m_attached;
+		uv_timer_wheel*					m_wheel;
+		uv_timer_wheel*					m_own_wheel;
+		unsigned						m_idle_timeout;
+		unsigned						m_handshake_timeout;
+		unsigned						m_heartbeat_interval;
+		heartbeat_callback				m_heartbeat_callback;
+		timeout_callback				m_timeout_callback;
+		uv_executor_port*				m_executor;
+		bool							m_defer_send;
+		std::vector<int>				m_dirty;		//sessions with deferred sends
 	};
 
 }
@@ -2,9 +2,13 @@
 #ifndef UV_TCP_SESSION_H_
 #define UV_TCP_SESSION_H_
 #include <string>
+#include <vector>
 #include "uv.h"
 #include "uv_tcp_server.h"
 #include "uv_net.h"
+#include "uv_buffer_pool.h"
+#include "uv_timer_wheel.h"
+#include "uv_executor.h"
 
 namespace uv {
 
@@ -12,9 +16,20 @@ namespace uv {
 	class uv_tcp_session
 	{
 		typedef void(*receive_callback)(uv_tcp_session* session, const char* buf, size_t length);
+		typedef void(*close_callback)(uv_tcp_session* session);
+		typedef void(*work_callback)(void* arg);
+		typedef void(*completion_callback)(uv_tcp_session* session, void* arg, int status);
+
+		friend class uv_tcp_server;
 
 	public:
-		uv_tcp_session(int id, uv_tcp_server* server);
+		enum
+		{
+			TIMEOUT_HANDSHAKE = 1,
+			TIMEOUT_IDLE,
+		};
+
+		uv_tcp_session(int id, uv_tcp_server* server, uv_buffer_pool* pool = nullptr);
 		virtual ~uv_tcp_session();
 		
 
@@ -23,12 +38,25 @@ namespace uv {
 		uv_tcp_server*	server()						const { return m_server; }
 		void			server(uv_tcp_server* server) { m_server = server; }
 		void			set_receive_callback(receive_callback callback) { m_receive_callback = callback; }
-		uv_buf_t&		write_buffer() { return m_write_buffer; }
+		//called once the session's handle is closed, the session goes away after it
+		void			set_close_callback(close_callback callback) { m_close_callback = callback; }
+		void*			data()							const { return m_data; }
+		void			set_data(void* data) { m_data = data; }
 		uv_buf_t&		read_buffer() { return m_read_buffer; }
-		uv_write_t&     req() { return m_req; }
 
 		void			on_receive(const char* buf, size_t length);
 		void			send(const char* data, const size_t length);
+
+		//run work on the thread pool and completion back on the session's loop. the session stays
+		//alive until completion returned, status is UV_ECANCELED if it was closed meanwhile.
+		//with an executor set on the server the work of one session runs in order on it
+		bool			defer(work_callback work, completion_callback completion, void* arg = nullptr);
+		size_t			pending()						const { return m_pending; }
+		bool			closed()						const { return m_closed; }
+
+		//the handshake is done, the idle timeout takes over from the handshake timeout
+		void			set_established();
+		bool			established()					const { return m_established; }
 		
 
 	private:
@@ -36,9 +64,35 @@ namespace uv {
 		uv_tcp_t*			m_handle;
 		uv_tcp_server*		m_server;
 		uv_buf_t			m_read_buffer;
-		uv_buf_t			m_write_buffer;
-		uv_write_t			m_req;
+		uv_buffer_pool*		m_buffer_pool;
 		receive_callback	m_receive_callback;
+		close_callback		m_close_callback;
+		void*				m_data;
+		size_t				m_pending;
+		bool				m_closed;
+		bool				m_established;
+		uv_timer_node		m_timeout_node;
+		uv_timer_node		m_heartbeat_node;
+		uv_serial_queue*	m_serial;
+		std::vector<char>	m_deferred;		//sends held back until the server flushes
+
+		struct defer_req
+		{
+			uv_work_t			req;
+			uv_tcp_session*		session;
+			work_callback		work;
+			completion_callback	completion;
+			void*				arg;
+		};
+
+		//the handle is closed, delete now unless deferred work still refers to the session
+		void				release();
+
+		static void			on_work(uv_work_t* req);
+		static void			on_after_work(uv_work_t* req, int status);
+		static void			on_executor_work(void* arg);
+		static void			on_executor_done(void* arg, int status);
+		static void			complete(defer_req* d, int status);
 	};
 }
 
@@ -0,0 +1,29 @@
+#pragma once
+#ifndef UV_TICK_H_
+#define UV_TICK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "uv.h"
+#include "uv_net.h"
+
+namespace uv
+{
+	//what one bounded run of a loop did and what it left
+	struct uv_tick_result
+	{
+		uint64_t	elapsed;		//us spent in the loop
+		unsigned	iterations;
+		uint64_t	callbacks;		//io callbacks of the library that ran
+		bool		exhausted;		//the budget ran out while io was still coming in, more is likely ready
+		bool		alive;			//the loop still has active handles or requests
+		size_t		backlog;		//what the sockets didn't take yet: bytes for tcp, datagrams for udp
+	};
+
+	//for an application that owns the main loop, e.g. a fixed rate game tick. runs loop with
+	//UV_RUN_NOWAIT until budget microseconds are spent or an iteration ran no io callback of the
+	//library, so an idle network costs one poll. not from a callback of the same loop
+	uv_tick_result uv_run_for(uv_loop_t* loop, uint64_t budget);
+}
+
+#endif // !UV_TICK_H_
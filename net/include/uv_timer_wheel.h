@@ -0,0 +1,82 @@
+#pragma once
+#ifndef UV_TIMER_WHEEL_H_
+#define UV_TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "uv.h"
+#include "uv_net.h"
+
+namespace uv
+{
+	//a timeout embedded in the object it belongs to, linked into a wheel slot while pending
+	struct uv_timer_node
+	{
+		typedef void(*timeout_callback)(uv_timer_node* node);
+
+		uv_timer_node() : prev(nullptr), next(nullptr), expire(0), callback(nullptr), data(nullptr) {}
+
+		bool				pending() const { return next != nullptr; }
+
+		uv_timer_node*		prev;
+		uv_timer_node*		next;
+		uint64_t			expire;		//in ticks
+		timeout_callback	callback;
+		void*				data;
+	};
+
+	//hierarchical timing wheel driven by one uv timer. 4 levels of 64 slots cover 2^24 ticks,
+	//scheduling and cancelling unlink and link a node, so resetting a timeout on every read is
+	//O(1) however many there are. timeouts fire on the tick after they are due, at most one tick late
+	class uv_timer_wheel
+	{
+	public:
+		enum
+		{
+			LEVELS = 4,
+			SLOT_BITS = 6,
+			SLOTS = 1 << SLOT_BITS,
+		};
+
+		//tick is the resolution in ms
+		uv_timer_wheel(uv_loop_t* loop, unsigned tick = 100);
+		virtual ~uv_timer_wheel();
+
+		//(re)arm node to fire timeout ms from now, the node's callback and data are kept
+		bool		schedule(uv_timer_node* node, uint64_t timeout);
+		void		cancel(uv_timer_node* node);
+		//drop every pending node and close the uv timer, libuv still uses the wheel until the
+		//loop ran its close callbacks
+		void		close();
+		//close, then the wheel frees itself once libuv is done with it. for wheels made with new
+		void		destroy();
+
+		uv_loop_t*	loop()	const { return m_loop; }
+		unsigned	tick()	const { return m_tick; }
+		size_t		size()	const { return m_count; }
+
+	protected:
+		void		add(uv_timer_node* node);
+		void		cascade(unsigned level, unsigned index);
+		void		advance(uint64_t target);
+
+		static void	link(uv_timer_node* head, uv_timer_node* node);
+		static void	unlink(uv_timer_node* node);
+		static void	on_timer(uv_timer_t* handle);
+		static void	on_close(uv_handle_t* handle);
+
+		void		clear();
+
+	private:
+		uv_loop_t*		m_loop;
+		uv_timer_t		m_timer;
+		bool			m_init;
+		bool			m_running;
+		unsigned		m_tick;
+		uint64_t		m_current;		//next tick to process
+		size_t			m_count;
+		uv_timer_node	m_slots[LEVELS][SLOTS];		//list heads
+	};
+}
+
+#endif // !UV_TIMER_WHEEL_H_
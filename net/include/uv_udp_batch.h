@@ -0,0 +1,114 @@
+#pragma once
+#ifndef UV_UDP_BATCH_H_
+#define UV_UDP_BATCH_H_
+
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include "uv.h"
+#include "uv_net.h"
+
+#if defined(__linux__)
+#define UV_UDP_HAVE_MMSG 1
+#endif
+
+namespace uv
+{
+	class uv_udp_client;
+
+	//one datagram of a receive batch, data is only valid inside the callback
+	struct uv_udp_message
+	{
+		char*					data;
+		size_t					length;
+		const struct sockaddr*	addr;
+		unsigned				flags;
+		//gro: data holds back to back segments of this size, the last may be shorter. 0 if not coalesced
+		size_t					segment_size;
+		//destination address of the datagram (port 0) with pktinfo on, e.g. the multicast group. nullptr otherwise
+		const struct sockaddr*	local;
+	};
+
+	//one datagram to send, the data is copied only if it has to wait for the socket
+	struct uv_udp_datagram
+	{
+		const struct sockaddr*	addr;
+		const char*				data;
+		size_t					length;
+	};
+
+	typedef void(*receive_batch_callback)(uv_udp_client* client, uv_udp_message* messages, size_t count);
+
+	//linux batch engine: recvmmsg into a fixed array of slots with one callback per batch,
+	//and sendmmsg for many datagrams per syscall. it polls a dup of the udp socket
+	//so libuv keeps its own watcher for uv_udp_send.
+	class uv_udp_batch
+	{
+	public:
+		enum { MAX_BATCH = 64 };
+
+		static bool supported();
+
+		uv_udp_batch(uv_udp_client* client);
+
+		bool	open(uv_loop_t* loop, uv_os_fd_t fd);
+		bool	start_receive(receive_batch_callback callback, size_t count, size_t slot_size);
+		//returns how many datagrams were sent or queued, the rest failed
+		size_t	send(const uv_udp_datagram* datagrams, size_t count);
+		//gso: one sendmsg per 64 segments, returns the bytes the kernel took. the caller sends the rest
+		size_t	send_segmented(const struct sockaddr* addr, const char* data, size_t length, size_t segment_size);
+		bool	set_gro(bool enable);
+		//report the destination address of every datagram in uv_udp_message::local
+		bool	set_pktinfo(bool enable);
+		//stops reading and drops queued sends, the batch frees itself once libuv is done with it
+		void	close();
+
+		//setup and poll errors
+		int		error()		const { return m_error; }
+		//the last send error, cleared once a send goes through again
+		int		send_error()	const { return m_send_error; }
+		bool	gso()		const { return m_gso; }
+		size_t	queued()	const { return m_backlog.size(); }
+		bool	receiving()	const { return m_receiving; }
+
+	private:
+		struct queued_datagram
+		{
+			struct sockaddr_storage	addr;
+			std::vector<char>		data;
+		};
+
+		~uv_udp_batch();
+
+		void	receive();
+		void	flush();
+		size_t	send_now(const uv_udp_datagram* datagrams, size_t count, size_t& failed);
+		int		update();
+
+		static void on_poll(uv_poll_t* handle, int status, int events);
+		static void on_close(uv_handle_t* handle);
+
+	private:
+		uv_udp_client*			m_client;
+		receive_batch_callback	m_callback;
+		uv_poll_t				m_poll;
+		int						m_fd;
+		size_t					m_count;
+		size_t					m_slot_size;
+		char*					m_slots;
+		void*					m_headers;
+		void*					m_send_headers;
+		uv_udp_message			m_messages[MAX_BATCH];
+		std::deque<queued_datagram> m_backlog;
+		int						m_events;
+		int						m_error;
+		int						m_send_error;
+		bool					m_open;
+		bool					m_receiving;
+		bool					m_gso;
+		bool					m_gro;
+		bool					m_pktinfo;
+	};
+}
+
+#endif // !UV_UDP_BATCH_H_
@@ -2,45 +2,141 @@
 #ifndef UV_UDP_CLIENT_H_
 #define UV_UDP_CLIENT_H_
 #include <string>
+#include <vector>
 #include <assert.h>
 #include "uv.h"
 #include "uv_net.h"
+#include "uv_buffer_pool.h"
+#include "uv_udp_batch.h"
+#include "uv_udp_send_pool.h"
+#include "uv_udp_fragmenter.h"
+#include "uv_udp_pacer.h"
+#include "uv_tick.h"
 
 namespace uv
 {
 	class uv_udp_client
 	{
-		typedef void(*receive_callback)(char* data, size_t length, const struct sockaddr* addr, unsigned flags);
+		typedef void(*receive_callback)(uv_udp_client* client, char* data, size_t length, const struct sockaddr* addr, unsigned flags);
+		typedef void(*receive_view_callback)(uv_udp_client* client, uv_recv_view& view, const struct sockaddr* addr, unsigned flags);
 		typedef void(*start_callback)(uv_udp_client*);
 	public:
 		uv_udp_client(uv_loop_t* loop = uv_default_loop());
 		virtual ~uv_udp_client();
 	
+		//bind and run the loop until it has no more work (blocking)
 		bool start_ipv4(const char* ip, const unsigned port, bool broadcast = false);
 		bool start_ipv6(const char* ip, const unsigned port, bool broadcast = false);
+		//only register with the loop and return, the caller runs the loop
+		bool attach_ipv4(const char* ip, const unsigned port, bool broadcast = false);
+		bool attach_ipv6(const char* ip, const unsigned port, bool broadcast = false);
 		void close();
 
 		void send_ipv4(const char* ip, const unsigned port, const char* data, const size_t length);
 		void send_ipv6(const char* ip, const unsigned port, const char* data, const size_t length);
 		
 		void send(const sockaddr* addr, const char* data, const size_t length);
+		//many datagrams at once, with sendmmsg on linux. whatever the socket can't take yet is
+		//copied and retried when it becomes writable. returns how many were sent or queued
+		size_t send_batch(const uv_udp_datagram* datagrams, size_t count);
+		//split data into segment_size datagrams for one peer, with udp gso on linux
+		bool send_segmented(const sockaddr* addr, const char* data, const size_t length, const size_t segment_size);
 	
 
 		void set_receive_callback(receive_callback callback) { m_receive_callback = callback; }
+		//takes precedence over the plain receive callback, the view can be retained without a copy
+		void set_receive_view_callback(receive_view_callback callback) { m_receive_view_callback = callback; }
+		//read blocks come from this pool, set before start/attach. a private pool is used otherwise
+		void set_buffer_pool(uv_buffer_pool* pool) { m_buffer_pool = pool; }
+		//linux udp gro for the batch receive mode, coalesced datagrams carry their segment_size
+		void set_gro(bool enable) { m_gro = enable; }
+		//deliver datagrams in batches, on linux up to count per recvmmsg into slots of slot_size bytes.
+		//takes precedence over the other receive callbacks, set before start/attach
+		void set_receive_batch_callback(receive_batch_callback callback, size_t count = uv_udp_batch::MAX_BATCH, size_t slot_size = UDP_BUFFER_SIZE)
+		{
+			m_receive_batch_callback = callback;
+			m_batch_count = count;
+			m_batch_slot_size = slot_size;
+		}
 		void set_start_callback(start_callback callback) { m_start_callback = callback; }
+		//send() splits messages over mtu bytes into fragments and the receiver hands complete
+		//messages to the receive or view callback, datagrams without a fragment header pass as they are.
+		//both peers need it, batch sends and the batch receive mode bypass it. set before start/attach, mtu 0 turns it off
+		void set_fragmentation(size_t mtu, unsigned timeout = 3000, size_t max_pending = 256)
+		{
+			m_fragment_mtu = mtu;
+			m_fragment_timeout = timeout;
+			m_fragment_max_pending = max_pending;
+		}
+
+		//bind with SO_REUSEPORT so several sockets, usually on several loops, share one port and
+		//the kernel spreads the flows over them. not available on windows. set before start/attach
+		void set_reuse_port(bool enable) { m_reuse_port = enable; }
+		//index of this socket in a uv_udp_shard_group, 0 otherwise
+		size_t shard() const { return m_shard; }
+		void set_shard(size_t shard) { m_shard = shard; }
+		//port the socket is bound to, after start/attach. resolves a bind to port 0, 0 on error
+		unsigned port();
+
+		//token bucket pacing of send(): rate in bytes per second with bursts of up to burst bytes, for all
+		//peers together and for each peer. datagrams over budget wait for a 1ms timer, queue_limit per peer,
+		//then the new one is dropped or with drop_oldest the oldest queued one. batch sends are not paced.
+		//rates of 0 are unlimited, both 0 turns pacing off. set before start/attach
+		void set_pacing(uint64_t rate, size_t burst, uint64_t peer_rate = 0, size_t peer_burst = 0, size_t queue_limit = 1024, bool drop_oldest = false)
+		{
+			m_pacing_rate = rate;
+			m_pacing_burst = burst;
+			m_pacing_peer_rate = peer_rate;
+			m_pacing_peer_burst = peer_burst;
+			m_pacing_queue_limit = queue_limit;
+			m_pacing_drop_oldest = drop_oldest;
+		}
+
+		//multicast, after start/attach. iface is the local address to use, nullptr lets the system pick.
+		//with a callback, datagrams sent to that group go to it instead of the receive callback.
+		//the destination comes from IP_PKTINFO on linux, elsewhere everything goes to the receive callback.
+		//on linux the reads move to the batch engine then, other datagrams still pass the fragmenter and the view callback.
+		//in the batch receive mode messages carry their group in uv_udp_message::local instead
+		bool join_group(const char* group, const char* iface = nullptr, receive_callback callback = nullptr);
+		bool leave_group(const char* group, const char* iface = nullptr);
+		bool set_multicast_ttl(int ttl);
+		bool set_multicast_loop(bool enable);
+		bool set_multicast_interface(const char* iface);
+
+		//for an attached client on a loop the application runs itself, once per tick: flushes the
+		//deferred sends, runs io for at most budget us, flushes again. backlog is in datagrams
+		uv_tick_result run_for(uint64_t budget);
+		//datagrams leaving the client, after fragmentation and pacing, only queue and go out together
+		//through send_batch at flush() or in run_for
+		void set_defer_send(bool enable);
+		//returns how many datagrams were sent or queued
+		size_t flush();
 
 		uv_buf_t& read_buffer() { return m_read_buffer; }
-		uv_buf_t& write_buffer() { return m_write_buffer; }
+		uv_udp_send_pool& send_pool() { return m_send_pool; }
+		uv_udp_fragmenter* fragmenter() { return m_fragmenter; }
+		uv_udp_pacer* pacer() { return m_pacer; }
 
+		uv_loop_t*	loop()					const { return m_loop; }
+		void*		data()					const { return m_data; }
+		void		set_data(void* data) { m_data = data; }
 		const std::string& error() { return m_error; }
 
 	protected:
 		bool init();
 		bool bind_ipv4(const char* ip, const unsigned port);
 		bool bind_ipv6(const char* ip, const unsigned port);
+		bool bind(const struct sockaddr* addr);
 		bool set_broadcast(bool enable);
 		bool listen();
+		bool listen_batch(receive_batch_callback callback);
+		bool parse_group(const char* group, struct sockaddr_storage& addr);
+		receive_callback group_callback(const struct sockaddr* local) const;
+		bool open_batch(int family);
 		bool run();
+		void send_paced(const sockaddr* addr, const char* data, const size_t length);
+		void send_datagram(const sockaddr* addr, const char* data, const size_t length);
+		void write_datagram(const sockaddr* addr, const char* data, const size_t length);
 
 		void error(int status);
 
@@ -48,18 +144,62 @@ namespace uv
 		static void on_send(uv_udp_send_t* req, int status);
 		static void on_receive(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const struct sockaddr* addr, unsigned flags);
 		static void on_close(uv_handle_t* handle);
+		static void on_pacer_output(uv_udp_pacer* pacer, const struct sockaddr* addr, const char* data, size_t length);
+		static void on_group_batch(uv_udp_client* client, uv_udp_message* messages, size_t count);
+		static void on_fragment_output(uv_udp_fragmenter* fragmenter, const struct sockaddr* addr, const char* data, size_t length);
+		static void on_fragment_message(uv_udp_fragmenter* fragmenter, const char* data, size_t length, const struct sockaddr* addr);
 
 	private:
+		struct group
+		{
+			struct sockaddr_storage	addr;
+			receive_callback		callback;
+		};
+
+		struct deferred_datagram
+		{
+			struct sockaddr_storage	addr;
+			size_t					offset;		//into m_deferred_data
+			size_t					length;
+		};
+
 		uv_loop_t*			m_loop;
 		uv_udp_t			m_handle;
-		uv_udp_send_t		m_req;
-		uv_buf_t			m_write_buffer;
+		uv_udp_send_pool	m_send_pool;
 		uv_buf_t			m_read_buffer;
 		receive_callback	m_receive_callback;
+		receive_view_callback m_receive_view_callback;
+		uv_buffer_pool*		m_buffer_pool;
+		uv_buffer_pool*		m_own_buffer_pool;
+		receive_batch_callback m_receive_batch_callback;
+		uv_udp_batch*		m_batch;
+		size_t				m_batch_count;
+		size_t				m_batch_slot_size;
+		bool				m_gro;
 		start_callback		m_start_callback;
+		uv_udp_fragmenter*	m_fragmenter;
+		size_t				m_fragment_mtu;
+		unsigned			m_fragment_timeout;
+		size_t				m_fragment_max_pending;
+		std::vector<group>	m_groups;
+		uv_udp_pacer*		m_pacer;
+		uint64_t			m_pacing_rate;
+		size_t				m_pacing_burst;
+		uint64_t			m_pacing_peer_rate;
+		size_t				m_pacing_peer_burst;
+		size_t				m_pacing_queue_limit;
+		bool				m_pacing_drop_oldest;
+		bool				m_reuse_port;
+		size_t				m_shard;
+		bool				m_defer_send;
+		std::vector<deferred_datagram> m_deferred;
+		std::vector<char>	m_deferred_data;
+		std::vector<uv_udp_datagram> m_flush_list;
 	
 		std::string			m_error;
 		bool				m_init;
+		bool				m_attached;
+		void*				m_data;
 	};
 
 	
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef UV_UDP_FEC_H_
+#define UV_UDP_FEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "uv.h"
+#include "uv_net.h"
+
+namespace uv
+{
+	class uv_udp_client;
+
+	//forward error correction for a datagram stream to one peer. every k datagrams are followed
+	//by m parity datagrams and any k of the k + m rebuild the group, so up to m losses per group
+	//are repaired without a round trip. m = 1 is plain xor parity, larger m a cauchy reed-solomon
+	//code over GF(2^8). datagrams are delivered as they arrive, repaired ones once the group
+	//allows it, so order is not kept. datagrams from the peer are passed to input()
+	class uv_udp_fec
+	{
+		typedef void(*receive_callback)(uv_udp_fec* fec, const char* data, size_t length);
+
+	public:
+		enum
+		{
+			HEADER_SIZE = 10,
+			MAX_SHARDS = 255,
+			WINDOW = 32,		//groups a receiver keeps for repair
+		};
+
+		uv_udp_fec(uv_udp_client* client, const struct sockaddr* peer, unsigned k = 8, unsigned m = 2);
+
+		//start the timer that closes groups which don't fill up
+		bool	start();
+		//instead of delete, the fec frees itself once libuv is done with its timer
+		void	close();
+
+		bool	send(const char* data, const size_t length);
+		//false if the datagram is not a fec packet
+		bool	input(const char* data, const size_t length);
+		//send parity for the datagrams of the current group now
+		void	flush();
+
+		//ms a partial group may wait for more datagrams before its parity is sent
+		void	set_flush_delay(unsigned delay) { m_flush_delay = delay; }
+		void	set_receive_callback(receive_callback callback) { m_receive_callback = callback; }
+
+		unsigned	k()				const { return m_k; }
+		unsigned	m()				const { return m_m; }
+		//datagrams rebuilt from parity
+		size_t		recovered()		const { return m_recovered; }
+		//groups that lost more than m datagrams
+		size_t		unrecoverable()	const { return m_unrecoverable; }
+		void*		data()			const { return m_data; }
+		void		set_data(void* data) { m_data = data; }
+
+	protected:
+		struct group
+		{
+			uint32_t					id;
+			bool						used;
+			bool						done;
+			unsigned					count;
+			unsigned					parity;
+			std::vector<std::string>	shards;		//data shards carry a 2 byte length in front
+			std::vector<bool>			present;
+			size_t						data_received;
+			size_t						parity_received;
+		};
+
+		virtual ~uv_udp_fec();
+
+		uint8_t		coefficient(unsigned row, unsigned column, unsigned count, unsigned parity) const;
+		void		write_header(char* p, uint32_t id, unsigned index, unsigned count, unsigned parity) const;
+		void		recover(group& g);
+		void		output(const char* data, size_t length);
+
+		static void on_timer(uv_timer_t* handle);
+		static void on_close(uv_handle_t* handle);
+
+	private:
+		uv_udp_client*				m_client;
+		struct sockaddr_storage		m_peer;
+		unsigned					m_k;
+		unsigned					m_m;
+		uv_timer_t					m_timer;
+		bool						m_started;
+		unsigned					m_flush_delay;
+
+		uint32_t					m_send_group;
+		std::vector<std::string>	m_send_shards;
+		std::vector<uint8_t>		m_parity;
+		std::vector<uint8_t>		m_padded;
+		std::vector<char>			m_packet;
+
+		group						m_groups[WINDOW];
+		size_t						m_recovered;
+		size_t						m_unrecoverable;
+
+		receive_callback			m_receive_callback;
+		void*						m_data;
+	};
+}
+
+#endif // !UV_UDP_FEC_H_
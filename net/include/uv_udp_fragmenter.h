@@ -0,0 +1,101 @@
+#pragma once
+#ifndef UV_UDP_FRAGMENTER_H_
+#define UV_UDP_FRAGMENTER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "uv.h"
+#include "uv_net.h"
+
+namespace uv
+{
+	//splits messages into fragments that fit in one mtu and puts them back together on the
+	//other side. every fragment carries a message id, its index and the fragment count.
+	//incomplete messages wait in a bounded table, a coarse timer evicts the ones that timed out
+	//and the oldest is dropped when the table is full. loop thread only.
+	class uv_udp_fragmenter
+	{
+		typedef void(*output_callback)(uv_udp_fragmenter* fragmenter, const struct sockaddr* addr, const char* data, size_t length);
+		typedef void(*message_callback)(uv_udp_fragmenter* fragmenter, const char* data, size_t length, const struct sockaddr* addr);
+
+	public:
+		enum
+		{
+			HEADER_SIZE = 10,
+			MAX_FRAGMENTS = 0xffff,
+		};
+
+		uv_udp_fragmenter(uv_loop_t* loop, size_t mtu = 1400, unsigned timeout = 3000, size_t max_pending = 256, size_t max_message = 1024 * 1024);
+
+		bool	start();
+		//stops the timer and drops what is pending, the fragmenter frees itself once libuv is done with it
+		void	close();
+
+		//every fragment goes to the output callback, false if the message needs too many
+		bool	send(const struct sockaddr* addr, const char* data, size_t length);
+		//false if the datagram has no fragment header, it is not consumed then
+		bool	input(const struct sockaddr* addr, const char* data, size_t length);
+
+		void	set_output_callback(output_callback callback) { m_output_callback = callback; }
+		void	set_message_callback(message_callback callback) { m_message_callback = callback; }
+
+		size_t	mtu()		const { return m_mtu; }
+		size_t	pending()	const { return m_pending.size(); }
+		//incomplete messages given up on, by timeout, because the table was full or because
+		//they announced more fragments than max_message allows
+		size_t	expired()	const { return m_expired; }
+		void*	data()		const { return m_data; }
+		void	set_data(void* data) { m_data = data; }
+
+	private:
+		struct key
+		{
+			uint32_t	id;
+			uint16_t	family;
+			uint16_t	port;
+			uint8_t		addr[16];
+
+			bool operator<(const key& other) const;
+		};
+
+		struct message
+		{
+			uint64_t					created;
+			size_t						received;
+			size_t						bytes;
+			std::vector<std::string>	fragments;
+			std::vector<bool>			present;
+		};
+
+		~uv_udp_fragmenter();
+
+		static bool	make_key(const struct sockaddr* addr, uint32_t id, key& k);
+		void		evict_oldest();
+		void		sweep();
+
+		static void on_timer(uv_timer_t* handle);
+		static void on_close(uv_handle_t* handle);
+
+	private:
+		uv_loop_t*				m_loop;
+		uv_timer_t				m_timer;
+		bool					m_started;
+		size_t					m_mtu;
+		unsigned				m_timeout;
+		size_t					m_max_pending;
+		size_t					m_max_message;
+		uint32_t				m_next_id;
+		std::map<key, message>	m_pending;
+		size_t					m_expired;
+		std::vector<char>		m_fragment;
+		std::string				m_message;
+		output_callback			m_output_callback;
+		message_callback		m_message_callback;
+		void*					m_data;
+	};
+}
+
+#endif // !UV_UDP_FRAGMENTER_H_
@@ -0,0 +1,113 @@
+#pragma once
+#ifndef UV_UDP_PACER_H_
+#define UV_UDP_PACER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "uv.h"
+#include "uv_net.h"
+
+namespace uv
+{
+	//token bucket pacing of udp egress, one bucket for everything and one per peer.
+	//a datagram within both budgets goes out at once, otherwise it is copied into the peer's
+	//queue and released by a 1ms timer, peers with a backlog take turns. loop thread only.
+	class uv_udp_pacer
+	{
+		typedef void(*output_callback)(uv_udp_pacer* pacer, const struct sockaddr* addr, const char* data, size_t length);
+
+	public:
+		uv_udp_pacer(uv_loop_t* loop);
+
+		bool	start();
+		//drops what is queued, the pacer frees itself once libuv is done with it
+		void	close();
+
+		//bytes per second and the largest burst in bytes, rate 0 is unlimited
+		void	set_rate(uint64_t rate, size_t burst);
+		void	set_peer_rate(uint64_t rate, size_t burst);
+		//datagrams queued per peer, then the new one is dropped or with drop_oldest the oldest one
+		void	set_queue_limit(size_t limit, bool drop_oldest);
+		void	set_output_callback(output_callback callback) { m_output_callback = callback; }
+
+		//false if the datagram was dropped
+		bool	send(const struct sockaddr* addr, const char* data, size_t length);
+
+		size_t	queued()	const { return m_queued; }
+		size_t	dropped()	const { return m_dropped; }
+		void*	data()		const { return m_data; }
+		void	set_data(void* data) { m_data = data; }
+
+	private:
+		struct bucket
+		{
+			uint64_t	rate;
+			int64_t		burst;
+			int64_t		tokens;
+			uint64_t	stamp;
+
+			void		refill(uint64_t now);
+			bool		allows(size_t length) const;
+			void		take(size_t length);
+		};
+
+		struct datagram
+		{
+			std::string	data;
+		};
+
+		struct peer
+		{
+			struct sockaddr_storage	addr;
+			bucket					tokens;
+			std::deque<datagram*>	queue;
+			bool					active;
+		};
+
+		struct key
+		{
+			uint16_t	family;
+			uint16_t	port;
+			uint8_t		addr[16];
+
+			bool operator<(const key& other) const;
+		};
+
+		~uv_udp_pacer();
+
+		static void	make_key(const struct sockaddr* addr, key& k);
+		peer*		find_peer(const struct sockaddr* addr);
+		datagram*	acquire(const char* data, size_t length);
+		void		release(datagram* d);
+		void		release_queued();
+		void		sweep(uint64_t now);
+
+		static void on_timer(uv_timer_t* handle);
+		static void on_close(uv_handle_t* handle);
+
+	private:
+		uv_loop_t*				m_loop;
+		uv_timer_t				m_timer;
+		bool					m_started;
+		bool					m_ticking;
+		bucket					m_global;
+		uint64_t				m_peer_rate;
+		size_t					m_peer_burst;
+		size_t					m_queue_limit;
+		bool					m_drop_oldest;
+		std::map<key, peer>		m_peers;
+		std::deque<peer*>		m_active;
+		std::vector<datagram*>	m_free;
+		size_t					m_queued;
+		size_t					m_dropped;
+		uint64_t				m_last_sweep;
+		output_callback			m_output_callback;
+		void*					m_data;
+	};
+}
+
+#endif // !UV_UDP_PACER_H_
@@ -0,0 +1,44 @@
+#pragma once
+#ifndef UV_UDP_SEND_POOL_H_
+#define UV_UDP_SEND_POOL_H_
+
+#include <stddef.h>
+#include "uv.h"
+
+namespace uv
+{
+	//free list of udp send requests, each with its own payload slot right behind it.
+	//payloads larger than the slot get a separate allocation. loop thread only.
+	class uv_udp_send_pool
+	{
+	public:
+		struct node
+		{
+			uv_udp_send_t	req;
+			uv_buf_t		buf;
+			node*			next;
+			char*			heap;
+		};
+
+		uv_udp_send_pool(size_t slot_size = 2048, size_t max_free = 1024);
+		virtual ~uv_udp_send_pool();
+
+		//copies data into a free request, buf points at the copy
+		node*	acquire(const char* data, size_t length);
+		void	release(node* n);
+
+		size_t	slot_size()		const { return m_slot_size; }
+		size_t	outstanding()	const { return m_outstanding; }
+
+		static node* from(uv_udp_send_t* req) { return (node*)req; }
+
+	private:
+		node*		m_free;
+		size_t		m_free_count;
+		size_t		m_slot_size;
+		size_t		m_max_free;
+		size_t		m_outstanding;
+	};
+}
+
+#endif // !UV_UDP_SEND_POOL_H_
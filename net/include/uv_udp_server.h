@@ -0,0 +1,97 @@
+#pragma once
+#ifndef UV_UDP_SERVER_H_
+#define UV_UDP_SERVER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "uv.h"
+#include "uv_net.h"
+#include "uv_udp_client.h"
+#include "uv_udp_session.h"
+
+namespace uv
+{
+	//session oriented udp: every peer address gets a uv_udp_session on its first datagram.
+	//sessions live in an open addressing table hashed on the address, one coarse timer
+	//drops the ones that were idle longer than the timeout.
+	class uv_udp_server
+	{
+		typedef void(*connect_callback)(uv_udp_session* session);
+		typedef void(*disconnect_callback)(uv_udp_session* session);
+		typedef void(*receive_callback)(uv_udp_session* session, const char* data, size_t length);
+
+	public:
+		uv_udp_server(uv_loop_t* loop = uv_default_loop());
+		virtual ~uv_udp_server();
+
+		//bind and run the loop until it has no more work (blocking)
+		bool			start_ipv4(const char* ip, const unsigned port);
+		bool			start_ipv6(const char* ip, const unsigned port);
+		//only register with the loop and return, the caller runs the loop
+		bool			attach_ipv4(const char* ip, const unsigned port);
+		bool			attach_ipv6(const char* ip, const unsigned port);
+		//disconnects every session and closes the socket
+		void			close();
+
+		void			send(uv_udp_session* session, const char* data, const size_t length);
+		//the disconnect callback runs, then the session is deleted
+		void			disconnect(uv_udp_session* session);
+		uv_udp_session*	find(const struct sockaddr* addr) const;
+
+		//for an attached server on a loop the application runs itself, see uv_udp_client::run_for
+		uv_tick_result	run_for(uint64_t budget) { return m_client.run_for(budget); }
+		//sends to all sessions leave together through send_batch at flush() or in run_for
+		void			set_defer_send(bool enable) { m_client.set_defer_send(enable); }
+		size_t			flush() { return m_client.flush(); }
+
+		//ms without a datagram before a session is dropped, 0 keeps sessions forever. set before start/attach
+		void			set_idle_timeout(unsigned timeout) { m_idle_timeout = timeout; }
+		//datagrams from new peers are ignored once this many sessions exist
+		void			set_max_sessions(size_t count) { m_max_sessions = count; }
+		void			set_connect_callback(connect_callback callback) { m_connect_callback = callback; }
+		void			set_disconnect_callback(disconnect_callback callback) { m_disconnect_callback = callback; }
+		void			set_receive_callback(receive_callback callback) { m_receive_callback = callback; }
+
+		size_t			sessions()	const { return m_count; }
+		uv_udp_client&	client() { return m_client; }
+		uv_loop_t*		loop()		const { return m_loop; }
+		const std::string& error() { return m_error; }
+
+	protected:
+		struct slot
+		{
+			uint32_t		hash;
+			uv_udp_session*	session;
+		};
+
+		bool			init();
+		static uint32_t	hash(const struct sockaddr* addr);
+		static bool		same(const struct sockaddr* a, const struct sockaddr* b);
+		size_t			locate(const struct sockaddr* addr, uint32_t h) const;
+		uv_udp_session*	insert(const struct sockaddr* addr);
+		void			erase(size_t index);
+		void			grow();
+		void			sweep();
+
+		static void on_receive(uv_udp_client* client, char* data, size_t length, const struct sockaddr* addr, unsigned flags);
+		static void on_timer(uv_timer_t* handle);
+
+	private:
+		uv_loop_t*			m_loop;
+		uv_udp_client		m_client;
+		uv_timer_t			m_timer;
+		bool				m_timer_init;
+		std::vector<slot>	m_table;
+		size_t				m_count;
+		size_t				m_max_sessions;
+		int					m_next_id;
+		unsigned			m_idle_timeout;
+		connect_callback	m_connect_callback;
+		disconnect_callback	m_disconnect_callback;
+		receive_callback	m_receive_callback;
+		std::string			m_error;
+	};
+}
+
+#endif // !UV_UDP_SERVER_H_
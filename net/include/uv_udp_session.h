@@ -0,0 +1,46 @@
+#pragma once
+#ifndef UV_UDP_SESSION_H_
+#define UV_UDP_SESSION_H_
+
+#include <stdint.h>
+#include "uv.h"
+#include "uv_net.h"
+#include "uv_seq_window.h"
+
+namespace uv
+{
+	class uv_udp_server;
+
+	//one peer address of a udp server, created by its first datagram and
+	//dropped after the idle timeout or a disconnect
+	class uv_udp_session
+	{
+	public:
+		uv_udp_session(int id, uv_udp_server* server, const struct sockaddr* addr);
+		virtual ~uv_udp_session();
+
+		int						id()			const { return m_id; }
+		uv_udp_server*			server()		const { return m_server; }
+		const struct sockaddr*	addr()			const { return (const struct sockaddr*)&m_addr; }
+		uint64_t				last_active()	const { return m_last_active; }
+		void					touch(uint64_t now) { m_last_active = now; }
+
+		void					send(const char* data, const size_t length);
+
+		//duplicate and stale filter for sequenced datagrams from this peer
+		uv_seq_window&			window() { return m_window; }
+
+		void*					data()			const { return m_data; }
+		void					set_data(void* data) { m_data = data; }
+
+	private:
+		int						m_id;
+		uv_udp_server*			m_server;
+		struct sockaddr_storage	m_addr;
+		uint64_t				m_last_active;
+		uv_seq_window			m_window;
+		void*					m_data;
+	};
+}
+
+#endif // !UV_UDP_SESSION_H_
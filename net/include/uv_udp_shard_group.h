@@ -0,0 +1,78 @@
+#pragma once
+#ifndef UV_UDP_SHARD_GROUP_H_
+#define UV_UDP_SHARD_GROUP_H_
+
+#include <stddef.h>
+#include <vector>
+#include <string>
+#include "uv.h"
+#include "uv_net.h"
+#include "uv_udp_client.h"
+
+namespace uv
+{
+	//several udp sockets bound to one port with SO_REUSEPORT, each with its own loop and thread.
+	//the kernel hashes flows over the sockets, so one peer always reaches the same shard.
+	//callbacks run on the shard's thread, client->shard() tells which one
+	class uv_udp_shard_group
+	{
+		typedef void(*receive_callback)(uv_udp_client* client, char* data, size_t length, const struct sockaddr* addr, unsigned flags);
+		typedef void(*start_callback)(uv_udp_client* client);
+
+	public:
+		uv_udp_shard_group(size_t shards);
+		virtual ~uv_udp_shard_group();
+
+		//returns once every shard is bound, false if one of them failed. with port 0 the first
+		//shard picks an ephemeral port and the others bind to it, port() tells which
+		bool	start_ipv4(const char* ip, const unsigned port);
+		bool	start_ipv6(const char* ip, const unsigned port);
+		//close every shard from any thread and wait for the threads
+		void	stop();
+		//wait until the shards stopped by themselves or through stop()
+		void	join();
+
+		//set before start, they apply to every shard
+		void	set_receive_callback(receive_callback callback) { m_receive_callback = callback; }
+		//runs on the shard thread once its socket is bound, e.g. to set per shard data
+		void	set_start_callback(start_callback callback) { m_start_callback = callback; }
+
+		size_t				shards()		const { return m_shards.size(); }
+		unsigned			port()			const { return m_port; }
+		//only touch a client from its own thread
+		uv_udp_client*		client(size_t shard) const;
+		const std::string&	error()			const { return m_error; }
+
+	private:
+		struct shard
+		{
+			uv_udp_shard_group*	group;
+			size_t				index;
+			uv_thread_t			thread;
+			uv_loop_t			loop;
+			uv_async_t			stop;
+			uv_udp_client*		client;
+			bool				running;
+			bool				ok;
+			std::string			error;
+		};
+
+		bool	start(const char* ip, const unsigned port, bool ipv6);
+
+		static void run_shard(void* arg);
+		static void on_stop(uv_async_t* handle);
+
+	private:
+		std::vector<shard*>	m_shards;
+		std::string			m_ip;
+		unsigned			m_port;
+		bool				m_ipv6;
+		uv_sem_t			m_ready;
+		bool				m_started;
+		receive_callback	m_receive_callback;
+		start_callback		m_start_callback;
+		std::string			m_error;
+	};
+}
+
+#endif // !UV_UDP_SHARD_GROUP_H_
@@ -0,0 +1,39 @@
+#pragma once
+#ifndef UV_WRITE_REQ_H_
+#define UV_WRITE_REQ_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "uv.h"
+
+namespace uv
+{
+	//one write request per send, the payload is stored right behind the request
+	//so several writes can be in flight on the same stream
+	struct uv_write_req
+	{
+		uv_write_t		req;
+		uv_buf_t		buf;
+
+		static uv_write_req* create(const char* data, const size_t length, void* owner)
+		{
+			uv_write_req* w = (uv_write_req*)malloc(sizeof(uv_write_req) + length);
+			if (w == nullptr)
+			{
+				return nullptr;
+			}
+			char* payload = (char*)(w + 1);
+			memcpy(payload, data, length);
+			w->buf = uv_buf_init(payload, (unsigned int)length);
+			w->req.data = owner;
+			return w;
+		}
+
+		static void destroy(uv_write_t* req)
+		{
+			free((uv_write_req*)req);
+		}
+	};
+}
+
+#endif // !UV_WRITE_REQ_H_
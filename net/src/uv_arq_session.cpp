@@ -0,0 +1,770 @@
+#include "uv_arq_session.h"
+#include "uv_udp_client.h"
+#include <string.h>
+
+namespace uv
+{
+	namespace
+	{
+		enum
+		{
+			CMD_PUSH = 81,		//data
+			CMD_ACK = 82,		//ack of one sn
+			CMD_WASK = 83,		//ask the peer for its window
+			CMD_WINS = 84,		//tell the peer our window
+		};
+
+		enum
+		{
+			ASK_SEND = 1,
+			ASK_TELL = 2,
+		};
+
+		const unsigned RTO_NODELAY = 30;
+		const unsigned RTO_MIN = 100;
+		const unsigned RTO_DEFAULT = 200;
+		const unsigned RTO_MAX = 60000;
+		const unsigned WINDOW_SEND = 32;
+		const unsigned WINDOW_RECEIVE = 128;
+		const unsigned MTU_DEFAULT = 1400;
+		const unsigned INTERVAL_DEFAULT = 100;
+		const unsigned DEAD_LINK = 20;
+		const unsigned FASTACK_LIMIT = 5;		//fast retransmits of one segment, then only rto
+		const unsigned THRESH_INIT = 2;
+		const unsigned THRESH_MIN = 2;
+		const unsigned PROBE_INIT = 7000;
+		const unsigned PROBE_LIMIT = 120000;
+
+		//sequence numbers and timestamps wrap, compare them by difference
+		inline int32_t diff(uint32_t later, uint32_t earlier)
+		{
+			return (int32_t)(later - earlier);
+		}
+
+		inline char* encode8(char* p, uint8_t v)
+		{
+			*p++ = (char)v;
+			return p;
+		}
+
+		inline char* encode16(char* p, uint16_t v)
+		{
+			p[0] = (char)(v & 0xff);
+			p[1] = (char)(v >> 8);
+			return p + 2;
+		}
+
+		inline char* encode32(char* p, uint32_t v)
+		{
+			p[0] = (char)(v & 0xff);
+			p[1] = (char)((v >> 8) & 0xff);
+			p[2] = (char)((v >> 16) & 0xff);
+			p[3] = (char)(v >> 24);
+			return p + 4;
+		}
+
+		inline const char* decode8(const char* p, uint8_t& v)
+		{
+			v = (uint8_t)*p++;
+			return p;
+		}
+
+		inline const char* decode16(const char* p, uint16_t& v)
+		{
+			const unsigned char* u = (const unsigned char*)p;
+			v = (uint16_t)(u[0] | (u[1] << 8));
+			return p + 2;
+		}
+
+		inline const char* decode32(const char* p, uint32_t& v)
+		{
+			const unsigned char* u = (const unsigned char*)p;
+			v = (uint32_t)u[0] | ((uint32_t)u[1] << 8) | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+			return p + 4;
+		}
+	}
+
+	uv_arq_session::uv_arq_session(uint32_t conv, uv_udp_client* client, const sockaddr* peer) :
+		m_conv(conv),
+		m_client(client),
+		m_started(false),
+		m_mtu(MTU_DEFAULT),
+		m_mss(MTU_DEFAULT - HEADER_SIZE),
+		m_snd_una(0),
+		m_snd_nxt(0),
+		m_rcv_nxt(0),
+		m_snd_wnd(WINDOW_SEND),
+		m_rcv_wnd(WINDOW_RECEIVE),
+		m_rmt_wnd(WINDOW_RECEIVE),
+		m_cwnd(1),
+		m_ssthresh(THRESH_INIT),
+		m_incr(0),
+		m_probe(0),
+		m_ts_probe(0),
+		m_probe_wait(0),
+		m_srtt(0),
+		m_rttval(0),
+		m_rto(RTO_DEFAULT),
+		m_min_rto(RTO_MIN),
+		m_interval(INTERVAL_DEFAULT),
+		m_nodelay(false),
+		m_fastresend(0),
+		m_congestion(true),
+		m_dead_link(DEAD_LINK),
+		m_dead(false),
+		m_output(MTU_DEFAULT),
+		m_output_length(0),
+		m_receive_callback(nullptr),
+		m_data(nullptr)
+	{
+		memset(&m_peer, 0, sizeof(m_peer));
+		if (peer != nullptr)
+		{
+			memcpy(&m_peer, peer, peer->sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+		}
+	}
+
+	uv_arq_session::~uv_arq_session()
+	{
+	}
+
+	bool uv_arq_session::start()
+	{
+		if (m_started)
+		{
+			return true;
+		}
+
+		int r = uv_timer_init(m_client->loop(), &m_timer);
+		if (r != 0)
+		{
+			fprintf(stderr, "arq session timer: %s\n", uv_strerror(r));
+			return false;
+		}
+		m_timer.data = this;
+
+		uv_timer_start(&m_timer, on_timer, m_interval, m_interval);
+		m_started = true;
+		return true;
+	}
+
+	void uv_arq_session::close()
+	{
+		m_receive_callback = nullptr;
+		if (m_started)
+		{
+			uv_timer_stop(&m_timer);
+			uv_close((uv_handle_t*)&m_timer, on_close);
+			m_started = false;
+		}
+		else
+		{
+			delete this;
+		}
+	}
+
+	bool uv_arq_session::send(const char* data, const size_t length)
+	{
+		size_t count = length <= m_mss ? 1 : (length + m_mss - 1) / m_mss;
+		if (count > MAX_FRAGMENTS || count >= m_rcv_wnd)
+		{
+			return false;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			size_t size = length - i * m_mss;
+			if (size > m_mss)
+			{
+				size = m_mss;
+			}
+
+			m_send_queue.push_back(segment());
+			segment& seg = m_send_queue.back();
+			seg.data.assign(data + i * m_mss, size);
+			seg.frg = (uint8_t)(count - i - 1);
+		}
+
+		if (m_nodelay)
+		{
+			flush();
+		}
+		return true;
+	}
+
+	bool uv_arq_session::input(const char* data, const size_t length)
+	{
+		if (data == nullptr || length < HEADER_SIZE)
+		{
+			return false;
+		}
+
+		uint32_t prev_una = m_snd_una;
+		uint32_t current = now();
+		uint32_t maxack = 0;
+		uint32_t latest_ts = 0;
+		bool acked = false;
+
+		const char* p = data;
+		size_t remain = length;
+		while (remain >= HEADER_SIZE)
+		{
+			segment seg;
+			uint32_t len = 0;
+			p = decode32(p, seg.conv);
+			p = decode8(p, seg.cmd);
+			p = decode8(p, seg.frg);
+			p = decode16(p, seg.wnd);
+			p = decode32(p, seg.ts);
+			p = decode32(p, seg.sn);
+			p = decode32(p, seg.una);
+			p = decode32(p, len);
+			remain -= HEADER_SIZE;
+
+			if (seg.conv != m_conv || len > remain)
+			{
+				return false;
+			}
+			if (seg.cmd != CMD_PUSH && seg.cmd != CMD_ACK && seg.cmd != CMD_WASK && seg.cmd != CMD_WINS)
+			{
+				return false;
+			}
+
+			m_rmt_wnd = seg.wnd;
+			parse_una(seg.una);
+			shrink_buffer();
+
+			if (seg.cmd == CMD_ACK)
+			{
+				if (diff(current, seg.ts) >= 0)
+				{
+					update_rtt(diff(current, seg.ts));
+				}
+				parse_ack(seg.sn);
+				shrink_buffer();
+
+				if (acked == false)
+				{
+					acked = true;
+					maxack = seg.sn;
+					latest_ts = seg.ts;
+				}
+				else if (diff(seg.sn, maxack) > 0)
+				{
+					maxack = seg.sn;
+					latest_ts = seg.ts;
+				}
+			}
+			else if (seg.cmd == CMD_PUSH)
+			{
+				if (diff(seg.sn, m_rcv_nxt + m_rcv_wnd) < 0)
+				{
+					//ack it even if it is a duplicate, the first ack may have been lost
+					m_acks.push_back(seg.sn);
+					m_acks.push_back(seg.ts);
+					if (diff(seg.sn, m_rcv_nxt) >= 0)
+					{
+						seg.data.assign(p, len);
+						parse_data(seg);
+					}
+				}
+			}
+			else if (seg.cmd == CMD_WASK)
+			{
+				m_probe |= ASK_TELL;
+			}
+
+			p += len;
+			remain -= len;
+		}
+
+		if (acked)
+		{
+			parse_fastack(maxack, latest_ts);
+		}
+
+		//the window opened up, grow cwnd: slow start below ssthresh, then congestion avoidance
+		if (diff(m_snd_una, prev_una) > 0 && m_cwnd < m_rmt_wnd)
+		{
+			if (m_cwnd < m_ssthresh)
+			{
+				m_cwnd++;
+				m_incr += m_mss;
+			}
+			else
+			{
+				if (m_incr < m_mss)
+				{
+					m_incr = m_mss;
+				}
+				m_incr += (m_mss * m_mss) / m_incr + (m_mss / 16);
+				if ((m_cwnd + 1) * m_mss <= m_incr)
+				{
+					m_cwnd = (m_incr + m_mss - 1) / m_mss;
+				}
+			}
+			if (m_cwnd > m_rmt_wnd)
+			{
+				m_cwnd = m_rmt_wnd;
+				m_incr = m_rmt_wnd * m_mss;
+			}
+		}
+
+		deliver();
+
+		if (m_nodelay)
+		{
+			flush();
+		}
+		return true;
+	}
+
+	void uv_arq_session::flush()
+	{
+		uint32_t current = now();
+
+		segment seg;
+		seg.conv = m_conv;
+		seg.cmd = CMD_ACK;
+		seg.frg = 0;
+		seg.wnd = window_unused();
+		seg.una = m_rcv_nxt;
+		seg.sn = 0;
+		seg.ts = 0;
+
+		for (size_t i = 0; i + 1 < m_acks.size(); i += 2)
+		{
+			seg.sn = m_acks[i];
+			seg.ts = m_acks[i + 1];
+			write_segment(seg);
+		}
+		m_acks.clear();
+
+		//the peer window is closed, probe it now and then
+		if (m_rmt_wnd == 0)
+		{
+			if (m_probe_wait == 0)
+			{
+				m_probe_wait = PROBE_INIT;
+				m_ts_probe = current + m_probe_wait;
+			}
+			else if (diff(current, m_ts_probe) >= 0)
+			{
+				if (m_probe_wait < PROBE_INIT)
+				{
+					m_probe_wait = PROBE_INIT;
+				}
+				m_probe_wait += m_probe_wait / 2;
+				if (m_probe_wait > PROBE_LIMIT)
+				{
+					m_probe_wait = PROBE_LIMIT;
+				}
+				m_ts_probe = current + m_probe_wait;
+				m_probe |= ASK_SEND;
+			}
+		}
+		else
+		{
+			m_ts_probe = 0;
+			m_probe_wait = 0;
+		}
+
+		seg.sn = 0;
+		seg.ts = 0;
+		if (m_probe & ASK_SEND)
+		{
+			seg.cmd = CMD_WASK;
+			write_segment(seg);
+		}
+		if (m_probe & ASK_TELL)
+		{
+			seg.cmd = CMD_WINS;
+			write_segment(seg);
+		}
+		m_probe = 0;
+
+		unsigned cwnd = m_snd_wnd < m_rmt_wnd ? m_snd_wnd : m_rmt_wnd;
+		if (m_congestion && m_cwnd < cwnd)
+		{
+			cwnd = m_cwnd;
+		}
+
+		//move what the window allows from the queue into flight
+		while (diff(m_snd_nxt, m_snd_una + cwnd) < 0 && m_send_queue.empty() == false)
+		{
+			m_send_buffer.push_back(std::move(m_send_queue.front()));
+			m_send_queue.pop_front();
+
+			segment& s = m_send_buffer.back();
+			s.conv = m_conv;
+			s.cmd = CMD_PUSH;
+			s.wnd = seg.wnd;
+			s.ts = current;
+			s.sn = m_snd_nxt++;
+			s.una = m_rcv_nxt;
+			s.resendts = current;
+			s.rto = m_rto;
+			s.fastack = 0;
+			s.xmit = 0;
+		}
+
+		unsigned resent = m_fastresend > 0 ? m_fastresend : 0xffffffff;
+		unsigned rtomin = m_nodelay ? 0 : (m_rto >> 3);
+		bool fast = false;
+		bool lost = false;
+
+		for (auto it = m_send_buffer.begin(); it != m_send_buffer.end(); ++it)
+		{
+			segment& s = *it;
+			bool needsend = false;
+			if (s.xmit == 0)
+			{
+				needsend = true;
+				s.xmit++;
+				s.rto = m_rto;
+				s.resendts = current + s.rto + rtomin;
+			}
+			else if (diff(current, s.resendts) >= 0)
+			{
+				//timed out, back off harder without nodelay
+				needsend = true;
+				s.xmit++;
+				s.rto += m_nodelay ? s.rto / 2 : (s.rto > m_rto ? s.rto : m_rto);
+				s.resendts = current + s.rto;
+				lost = true;
+			}
+			else if (s.fastack >= resent && s.xmit <= FASTACK_LIMIT)
+			{
+				needsend = true;
+				s.xmit++;
+				s.fastack = 0;
+				s.resendts = current + s.rto;
+				fast = true;
+			}
+
+			if (needsend)
+			{
+				s.ts = current;
+				s.wnd = seg.wnd;
+				s.una = m_rcv_nxt;
+				write_segment(s);
+
+				if (s.xmit >= m_dead_link)
+				{
+					m_dead = true;
+				}
+			}
+		}
+
+		output();
+
+		if (fast)
+		{
+			unsigned inflight = m_snd_nxt - m_snd_una;
+			m_ssthresh = inflight / 2;
+			if (m_ssthresh < THRESH_MIN)
+			{
+				m_ssthresh = THRESH_MIN;
+			}
+			m_cwnd = m_ssthresh + resent;
+			m_incr = m_cwnd * m_mss;
+		}
+
+		if (lost)
+		{
+			m_ssthresh = m_cwnd / 2;
+			if (m_ssthresh < THRESH_MIN)
+			{
+				m_ssthresh = THRESH_MIN;
+			}
+			m_cwnd = 1;
+			m_incr = m_mss;
+		}
+
+		if (m_cwnd < 1)
+		{
+			m_cwnd = 1;
+			m_incr = m_mss;
+		}
+	}
+
+	void uv_arq_session::set_nodelay(bool nodelay, unsigned interval, unsigned resend, bool congestion)
+	{
+		m_nodelay = nodelay;
+		m_min_rto = nodelay ? RTO_NODELAY : RTO_MIN;
+		if (interval < 1)
+		{
+			interval = 1;
+		}
+		else if (interval > 5000)
+		{
+			interval = 5000;
+		}
+		m_interval = interval;
+		m_fastresend = resend;
+		m_congestion = congestion;
+
+		if (m_started)
+		{
+			uv_timer_start(&m_timer, on_timer, m_interval, m_interval);
+		}
+	}
+
+	void uv_arq_session::set_window(unsigned send_window, unsigned receive_window)
+	{
+		if (send_window > 0)
+		{
+			m_snd_wnd = send_window;
+		}
+		//must hold the largest message
+		if (receive_window > 0)
+		{
+			m_rcv_wnd = receive_window < WINDOW_RECEIVE ? WINDOW_RECEIVE : receive_window;
+		}
+	}
+
+	bool uv_arq_session::set_mtu(unsigned mtu)
+	{
+		if (mtu < 50 || mtu < HEADER_SIZE)
+		{
+			return false;
+		}
+		m_mtu = mtu;
+		m_mss = mtu - HEADER_SIZE;
+		m_output.resize(mtu);
+		return true;
+	}
+
+	bool uv_arq_session::read_conv(const char* data, const size_t length, uint32_t& conv)
+	{
+		if (data == nullptr || length < HEADER_SIZE)
+		{
+			return false;
+		}
+		decode32(data, conv);
+		return true;
+	}
+
+	uint32_t uv_arq_session::now() const
+	{
+		return (uint32_t)uv_now(m_client->loop());
+	}
+
+	uint16_t uv_arq_session::window_unused() const
+	{
+		if (m_receive_queue.size() < m_rcv_wnd)
+		{
+			size_t unused = m_rcv_wnd - m_receive_queue.size();
+			return (uint16_t)(unused > 0xffff ? 0xffff : unused);
+		}
+		return 0;
+	}
+
+	void uv_arq_session::update_rtt(int32_t rtt)
+	{
+		if (m_srtt == 0)
+		{
+			m_srtt = rtt;
+			m_rttval = rtt / 2;
+		}
+		else
+		{
+			int32_t delta = rtt - (int32_t)m_srtt;
+			if (delta < 0)
+			{
+				delta = -delta;
+			}
+			m_rttval = (3 * m_rttval + delta) / 4;
+			m_srtt = (7 * m_srtt + rtt) / 8;
+			if (m_srtt < 1)
+			{
+				m_srtt = 1;
+			}
+		}
+
+		unsigned rto = m_srtt + (m_interval > 4 * m_rttval ? m_interval : 4 * m_rttval);
+		if (rto < m_min_rto)
+		{
+			rto = m_min_rto;
+		}
+		else if (rto > RTO_MAX)
+		{
+			rto = RTO_MAX;
+		}
+		m_rto = rto;
+	}
+
+	void uv_arq_session::shrink_buffer()
+	{
+		m_snd_una = m_send_buffer.empty() ? m_snd_nxt : m_send_buffer.front().sn;
+	}
+
+	void uv_arq_session::parse_ack(uint32_t sn)
+	{
+		if (diff(sn, m_snd_una) < 0 || diff(sn, m_snd_nxt) >= 0)
+		{
+			return;
+		}
+
+		for (auto it = m_send_buffer.begin(); it != m_send_buffer.end(); ++it)
+		{
+			if (it->sn == sn)
+			{
+				m_send_buffer.erase(it);
+				break;
+			}
+			if (diff(sn, it->sn) < 0)
+			{
+				break;
+			}
+		}
+	}
+
+	void uv_arq_session::parse_una(uint32_t una)
+	{
+		while (m_send_buffer.empty() == false && diff(m_send_buffer.front().sn, una) < 0)
+		{
+			m_send_buffer.pop_front();
+		}
+	}
+
+	void uv_arq_session::parse_fastack(uint32_t sn, uint32_t ts)
+	{
+		if (diff(sn, m_snd_una) < 0 || diff(sn, m_snd_nxt) >= 0)
+		{
+			return;
+		}
+
+		//every older segment sent no later than the acked one was skipped over once more
+		for (auto it = m_send_buffer.begin(); it != m_send_buffer.end(); ++it)
+		{
+			if (diff(sn, it->sn) <= 0)
+			{
+				break;
+			}
+			if (diff(ts, it->ts) >= 0)
+			{
+				it->fastack++;
+			}
+		}
+	}
+
+	void uv_arq_session::parse_data(segment& seg)
+	{
+		if (diff(seg.sn, m_rcv_nxt + m_rcv_wnd) >= 0 || diff(seg.sn, m_rcv_nxt) < 0)
+		{
+			return;
+		}
+
+		//keep the receive buffer ordered by sn, drop duplicates
+		auto it = m_receive_buffer.end();
+		while (it != m_receive_buffer.begin())
+		{
+			auto prev = it - 1;
+			if (prev->sn == seg.sn)
+			{
+				return;
+			}
+			if (diff(seg.sn, prev->sn) > 0)
+			{
+				break;
+			}
+			it = prev;
+		}
+		m_receive_buffer.insert(it, std::move(seg));
+
+		//whatever is now contiguous moves on to the receive queue
+		while (m_receive_buffer.empty() == false && m_receive_buffer.front().sn == m_rcv_nxt && m_receive_queue.size() < m_rcv_wnd)
+		{
+			m_receive_queue.push_back(std::move(m_receive_buffer.front()));
+			m_receive_buffer.pop_front();
+			m_rcv_nxt++;
+		}
+	}
+
+	void uv_arq_session::deliver()
+	{
+		while (m_receive_queue.empty() == false)
+		{
+			//a message is complete once its last fragment (frg 0) is queued
+			size_t count = 0;
+			for (auto it = m_receive_queue.begin(); it != m_receive_queue.end(); ++it)
+			{
+				++count;
+				if (it->frg == 0)
+				{
+					break;
+				}
+			}
+			if (m_receive_queue[count - 1].frg != 0)
+			{
+				break;
+			}
+
+			m_message.clear();
+			for (size_t i = 0; i < count; ++i)
+			{
+				m_message.append(m_receive_queue.front().data);
+				m_receive_queue.pop_front();
+			}
+
+			//the queue has room again
+			while (m_receive_buffer.empty() == false && m_receive_buffer.front().sn == m_rcv_nxt && m_receive_queue.size() < m_rcv_wnd)
+			{
+				m_receive_queue.push_back(std::move(m_receive_buffer.front()));
+				m_receive_buffer.pop_front();
+				m_rcv_nxt++;
+			}
+
+			if (m_receive_callback != nullptr)
+			{
+				m_receive_callback(this, m_message.data(), m_message.size());
+			}
+		}
+	}
+
+	void uv_arq_session::write_segment(const segment& seg)
+	{
+		size_t size = HEADER_SIZE + seg.data.size();
+		if (m_output_length + size > m_mtu)
+		{
+			output();
+		}
+
+		char* p = m_output.data() + m_output_length;
+		p = encode32(p, seg.conv);
+		p = encode8(p, seg.cmd);
+		p = encode8(p, seg.frg);
+		p = encode16(p, seg.wnd);
+		p = encode32(p, seg.ts);
+		p = encode32(p, seg.sn);
+		p = encode32(p, seg.una);
+		p = encode32(p, (uint32_t)seg.data.size());
+		if (seg.data.empty() == false)
+		{
+			memcpy(p, seg.data.data(), seg.data.size());
+		}
+		m_output_length += size;
+	}
+
+	void uv_arq_session::output()
+	{
+		if (m_output_length > 0)
+		{
+			m_client->send(peer(), m_output.data(), m_output_length);
+			m_output_length = 0;
+		}
+	}
+
+	void uv_arq_session::on_timer(uv_timer_t* handle)
+	{
+		uv_arq_session* session = (uv_arq_session*)handle->data;
+		session->flush();
+	}
+
+	void uv_arq_session::on_close(uv_handle_t* handle)
+	{
+		uv_arq_session* session = (uv_arq_session*)handle->data;
+		delete session;
+	}
+}
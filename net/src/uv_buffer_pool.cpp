@@ -0,0 +1,180 @@
+#include "uv_buffer_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace uv
+{
+	uv_buffer_pool::uv_buffer_pool(size_t block_size /*= READ_BLOCK_SIZE*/, size_t max_free /*= 64*/) :
+		m_refs(1),
+		m_block_size(block_size),
+		m_max_free(max_free)
+	{
+		uv_mutex_init(&m_mutex);
+		m_free.reserve(max_free);
+	}
+
+	uv_buffer_pool::~uv_buffer_pool()
+	{
+		for (auto block : m_free)
+		{
+			free(block);
+		}
+		m_free.clear();
+		uv_mutex_destroy(&m_mutex);
+	}
+
+	void uv_buffer_pool::add_ref()
+	{
+		m_refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void uv_buffer_pool::unref()
+	{
+		if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			delete this;
+		}
+	}
+
+	char* uv_buffer_pool::acquire()
+	{
+		char* block = nullptr;
+
+		uv_mutex_lock(&m_mutex);
+		if (m_free.empty() == false)
+		{
+			block = m_free.back();
+			m_free.pop_back();
+		}
+		uv_mutex_unlock(&m_mutex);
+
+		if (block == nullptr)
+		{
+			block = (char*)malloc(m_block_size);
+		}
+		return block;
+	}
+
+	void uv_buffer_pool::release(char* block)
+	{
+		if (block == nullptr)
+		{
+			return;
+		}
+
+		uv_mutex_lock(&m_mutex);
+		if (m_free.size() < m_max_free)
+		{
+			m_free.push_back(block);
+			block = nullptr;
+		}
+		uv_mutex_unlock(&m_mutex);
+
+		free(block);
+	}
+
+	void uv_buffer_pool::prefill(size_t count)
+	{
+		uv_mutex_lock(&m_mutex);
+		while (count > 0 && m_free.size() < m_max_free)
+		{
+			char* block = (char*)malloc(m_block_size);
+			if (block == nullptr)
+			{
+				break;
+			}
+			//first touch decides where the pages live
+			memset(block, 0, m_block_size);
+			m_free.push_back(block);
+			--count;
+		}
+		uv_mutex_unlock(&m_mutex);
+	}
+
+	uv_buffer::uv_buffer() :
+		m_pool(nullptr),
+		m_block(nullptr),
+		m_length(0)
+	{
+	}
+
+	uv_buffer::uv_buffer(uv_buffer_pool* pool, char* block, size_t length) :
+		m_pool(pool),
+		m_block(block),
+		m_length(length)
+	{
+		if (m_block != nullptr && m_pool != nullptr)
+		{
+			m_pool->add_ref();
+		}
+	}
+
+	uv_buffer::uv_buffer(uv_buffer&& other) :
+		m_pool(other.m_pool),
+		m_block(other.m_block),
+		m_length(other.m_length)
+	{
+		other.m_block = nullptr;
+		other.m_length = 0;
+	}
+
+	uv_buffer& uv_buffer::operator=(uv_buffer&& other)
+	{
+		if (this != &other)
+		{
+			release();
+			m_pool = other.m_pool;
+			m_block = other.m_block;
+			m_length = other.m_length;
+			other.m_block = nullptr;
+			other.m_length = 0;
+		}
+		return *this;
+	}
+
+	uv_buffer::~uv_buffer()
+	{
+		release();
+	}
+
+	void uv_buffer::release()
+	{
+		if (m_block != nullptr && m_pool != nullptr)
+		{
+			m_pool->release(m_block);
+			m_pool->unref();
+		}
+		else if (m_block != nullptr)
+		{
+			free(m_block);
+		}
+		m_block = nullptr;
+		m_length = 0;
+	}
+
+	uv_buffer uv_recv_view::retain()
+	{
+		if (m_pool == nullptr)
+		{
+			char* block = (char*)malloc(m_length > 0 ? m_length : 1);
+			if (block == nullptr)
+			{
+				return uv_buffer();
+			}
+			memcpy(block, m_data, m_length);
+			return uv_buffer(nullptr, block, m_length);
+		}
+
+		//already retained, or the reader was closed inside the callback
+		if (m_owner == nullptr || m_owner->base != m_data)
+		{
+			return uv_buffer();
+		}
+
+		m_owner->base = nullptr;
+		m_owner->len = 0;
+		m_owner = nullptr;
+
+		return uv_buffer(m_pool, m_data, m_length);
+	}
+}
@@ -0,0 +1,61 @@
+#include "uv_connect_limiter.h"
+#include "uv_tcp_client.h"
+
+namespace uv
+{
+	uv_connect_limiter::uv_connect_limiter(size_t max_pending /*= 256*/) :
+		m_max_pending(max_pending > 0 ? max_pending : 1),
+		m_pending(0)
+	{
+	}
+
+	uv_connect_limiter::~uv_connect_limiter()
+	{
+		m_queue.clear();
+	}
+
+	bool uv_connect_limiter::acquire(uv_tcp_client* client)
+	{
+		if (m_pending < m_max_pending)
+		{
+			++m_pending;
+			return true;
+		}
+		m_queue.push_back(client);
+		return false;
+	}
+
+	void uv_connect_limiter::release()
+	{
+		assert(m_pending > 0);
+		--m_pending;
+		drain();
+	}
+
+	void uv_connect_limiter::cancel(uv_tcp_client* client)
+	{
+		for (auto it = m_queue.begin(); it != m_queue.end(); ++it)
+		{
+			if (*it == client)
+			{
+				m_queue.erase(it);
+				return;
+			}
+		}
+	}
+
+	void uv_connect_limiter::drain()
+	{
+		while (m_pending < m_max_pending && m_queue.empty() == false)
+		{
+			uv_tcp_client* client = m_queue.front();
+			m_queue.pop_front();
+
+			++m_pending;
+			if (client->admit() == false)
+			{
+				--m_pending;
+			}
+		}
+	}
+}
@@ -0,0 +1,405 @@
+#include "uv_coroutine.h"
+
+#ifdef UV_HAVE_COROUTINES
+
+#include <string.h>
+
+namespace uv
+{
+	namespace
+	{
+		struct frame_lists
+		{
+			std::vector<void*>	free[uv_co_frame_pool::MAX_BLOCK / uv_co_frame_pool::GRANULE];
+
+			~frame_lists()
+			{
+				for (size_t i = 0; i < sizeof(free) / sizeof(free[0]); ++i)
+				{
+					for (size_t j = 0; j < free[i].size(); ++j)
+					{
+						::operator delete(free[i][j]);
+					}
+				}
+			}
+		};
+
+		thread_local frame_lists lists;
+
+		struct sleeper
+		{
+			uv_timer_t				timer;
+			std::coroutine_handle<>	handle;
+		};
+
+		void on_sleep_close(uv_handle_t* handle)
+		{
+			uv_co_frame_pool::release(handle->data, sizeof(sleeper));
+		}
+
+		void on_sleep_timer(uv_timer_t* handle)
+		{
+			sleeper* s = (sleeper*)handle->data;
+			std::coroutine_handle<> resume = s->handle;
+			uv_close((uv_handle_t*)&s->timer, on_sleep_close);
+			resume.resume();
+		}
+
+		inline uint32_t read32(const char* p)
+		{
+			const unsigned char* u = (const unsigned char*)p;
+			return (uint32_t)u[0] | ((uint32_t)u[1] << 8) | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+		}
+	}
+
+	void* uv_co_frame_pool::allocate(size_t size)
+	{
+		if (size == 0 || size > MAX_BLOCK)
+		{
+			return ::operator new(size);
+		}
+
+		size_t index = (size + GRANULE - 1) / GRANULE - 1;
+		std::vector<void*>& list = lists.free[index];
+		if (list.empty() == false)
+		{
+			void* block = list.back();
+			list.pop_back();
+			return block;
+		}
+		return ::operator new((index + 1) * GRANULE);
+	}
+
+	void uv_co_frame_pool::release(void* block, size_t size)
+	{
+		if (block == nullptr)
+		{
+			return;
+		}
+		if (size == 0 || size > MAX_BLOCK)
+		{
+			::operator delete(block);
+			return;
+		}
+
+		size_t index = (size + GRANULE - 1) / GRANULE - 1;
+		std::vector<void*>& list = lists.free[index];
+		if (list.size() < MAX_FREE)
+		{
+			list.push_back(block);
+			return;
+		}
+		::operator delete(block);
+	}
+
+	void uv_co_sleep::await_suspend(std::coroutine_handle<> handle)
+	{
+		//the timer handle outlives the frame until its close callback, so it isn't kept in the awaiter
+		sleeper* s = (sleeper*)uv_co_frame_pool::allocate(sizeof(sleeper));
+		s->handle = handle;
+		s->timer.data = s;
+		uv_timer_init(m_loop, &s->timer);
+		uv_timer_start(&s->timer, on_sleep_timer, m_timeout, 0);
+	}
+
+	uv_co_stream::uv_co_stream(uv_tcp_session* session) :
+		m_session(session),
+		m_client(nullptr),
+		m_stream((uv_stream_t*)session->handle()),
+		m_head(0),
+		m_consume(0),
+		m_max_message(BUFFER_SIZE),
+		m_closed(false),
+		m_status(0),
+		m_reader(nullptr),
+		m_connector(nullptr)
+	{
+		session->set_data(this);
+		session->set_receive_callback(on_session_receive);
+		session->set_close_callback(on_session_close);
+	}
+
+	uv_co_stream::uv_co_stream(uv_tcp_client* client) :
+		m_session(nullptr),
+		m_client(client),
+		m_stream((uv_stream_t*)client->handle()),
+		m_head(0),
+		m_consume(0),
+		m_max_message(BUFFER_SIZE),
+		m_closed(false),
+		m_status(0),
+		m_reader(nullptr),
+		m_connector(nullptr)
+	{
+		client->set_data(this);
+		client->set_receive_callback(on_client_receive);
+		client->set_connect_callback(on_client_connect);
+		client->set_close_callback(on_client_close);
+	}
+
+	uv_co_stream::~uv_co_stream()
+	{
+		if (m_session != nullptr)
+		{
+			m_session->set_receive_callback(nullptr);
+			m_session->set_close_callback(nullptr);
+			m_session->set_data(nullptr);
+		}
+		if (m_client != nullptr)
+		{
+			m_client->set_receive_callback(nullptr);
+			m_client->set_connect_callback(nullptr);
+			m_client->set_close_callback(nullptr);
+			m_client->set_data(nullptr);
+		}
+	}
+
+	bool uv_co_stream::try_read(int mode, size_t length, uv_co_result& result)
+	{
+		//whatever the last read handed out is gone once the reader comes back, only now the
+		//buffer may move
+		m_head += m_consume;
+		m_consume = 0;
+		if (m_head == m_buffer.size())
+		{
+			m_buffer.clear();
+			m_head = 0;
+		}
+		if (m_staging.empty() == false)
+		{
+			if (m_buffer.empty())
+			{
+				m_buffer.swap(m_staging);
+			}
+			else
+			{
+				if (m_head > 0 && m_head * 2 >= m_buffer.size())
+				{
+					m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_head);
+					m_head = 0;
+				}
+				m_buffer.insert(m_buffer.end(), m_staging.begin(), m_staging.end());
+				m_staging.clear();
+			}
+		}
+
+		const char* data = m_buffer.data() + m_head;
+		size_t available = m_buffer.size() - m_head;
+		size_t offset = 0;
+		size_t consume = 0;
+
+		if (mode == READ_SOME)
+		{
+			length = available;
+			consume = available;
+		}
+		else if (mode == READ_EXACT)
+		{
+			consume = available >= length ? length : 0;
+		}
+		else if (available >= 4)
+		{
+			length = read32(data);
+			if (length > m_max_message)
+			{
+				result.status = UV_E2BIG;
+				result.data = nullptr;
+				result.length = 0;
+				return true;
+			}
+			offset = 4;
+			consume = available >= 4 + length ? 4 + length : 0;
+		}
+
+		if (consume == 0 && (mode != READ_EXACT || length > 0))
+		{
+			if (m_closed == false)
+			{
+				return false;
+			}
+			result.status = m_status;
+			result.data = nullptr;
+			result.length = 0;
+			return true;
+		}
+
+		result.status = 0;
+		result.data = data + offset;
+		result.length = length;
+		m_consume = consume;
+		return true;
+	}
+
+	void uv_co_stream::wait_read(read_awaiter* awaiter, std::coroutine_handle<> handle)
+	{
+		m_reader = awaiter;
+		m_read_handle = handle;
+	}
+
+	void uv_co_stream::feed(const char* data, size_t length)
+	{
+		//the coroutine may still use what the last read returned while it waits on something
+		//else, so new data is staged and try_read merges it on the next read
+		m_staging.insert(m_staging.end(), data, data + length);
+
+		read_awaiter* reader = m_reader;
+		if (reader != nullptr && try_read(reader->m_mode, reader->m_length, reader->m_result))
+		{
+			m_reader = nullptr;
+			//may destroy the stream, nothing touches it after this
+			m_read_handle.resume();
+		}
+	}
+
+	void uv_co_stream::shutdown(int status)
+	{
+		m_closed = true;
+		m_status = status;
+
+		read_awaiter* reader = m_reader;
+		if (reader != nullptr && try_read(reader->m_mode, reader->m_length, reader->m_result))
+		{
+			m_reader = nullptr;
+			m_read_handle.resume();
+		}
+	}
+
+	uv_co_stream::send_awaiter::send_awaiter(uv_co_stream* stream, const char* data, size_t length, bool message) :
+		m_stream(stream),
+		m_count(0),
+		m_status(0)
+	{
+		if (message)
+		{
+			m_header[0] = (char)(length & 0xff);
+			m_header[1] = (char)((length >> 8) & 0xff);
+			m_header[2] = (char)((length >> 16) & 0xff);
+			m_header[3] = (char)((length >> 24) & 0xff);
+			m_bufs[m_count++] = uv_buf_init(m_header, 4);
+		}
+		m_bufs[m_count++] = uv_buf_init((char*)data, (unsigned int)length);
+	}
+
+	bool uv_co_stream::send_awaiter::await_suspend(std::coroutine_handle<> handle)
+	{
+		if (m_stream->m_closed || m_stream->m_stream == nullptr)
+		{
+			m_status = UV_EPIPE;
+			return false;
+		}
+
+		m_handle = handle;
+		m_req.data = this;
+		int r = uv_write(&m_req, m_stream->m_stream, m_bufs, m_count, on_write);
+		if (r != 0)
+		{
+			m_status = r;
+			return false;
+		}
+		return true;
+	}
+
+	void uv_co_stream::send_awaiter::on_write(uv_write_t* req, int status)
+	{
+		send_awaiter* awaiter = (send_awaiter*)req->data;
+		awaiter->m_status = status;
+		awaiter->m_handle.resume();
+	}
+
+	bool uv_co_stream::connect_awaiter::await_suspend(std::coroutine_handle<> handle)
+	{
+		if (m_stream->m_client == nullptr)
+		{
+			m_status = UV_EINVAL;
+			return false;
+		}
+
+		m_stream->m_connector = this;
+		if (m_stream->m_client->attach(m_ip, m_port) == false)
+		{
+			//failed before a callback could come
+			if (m_stream->m_connector == this)
+			{
+				m_stream->m_connector = nullptr;
+				m_status = UV_EINVAL;
+			}
+			return false;
+		}
+		if (m_stream->m_connector != this)
+		{
+			//the limiter already reported the result
+			return false;
+		}
+		m_handle = handle;
+		return true;
+	}
+
+	void uv_co_stream::on_session_receive(uv_tcp_session* session, const char* data, size_t length)
+	{
+		uv_co_stream* stream = (uv_co_stream*)session->data();
+		if (stream != nullptr)
+		{
+			stream->feed(data, length);
+		}
+	}
+
+	void uv_co_stream::on_session_close(uv_tcp_session* session)
+	{
+		uv_co_stream* stream = (uv_co_stream*)session->data();
+		if (stream == nullptr)
+		{
+			return;
+		}
+		session->set_data(nullptr);
+		stream->m_session = nullptr;
+		stream->m_stream = nullptr;
+		stream->shutdown(UV_EOF);
+	}
+
+	void uv_co_stream::on_client_receive(uv_tcp_client* client, char* data, size_t length)
+	{
+		uv_co_stream* stream = (uv_co_stream*)client->data();
+		if (stream != nullptr)
+		{
+			stream->feed(data, length);
+		}
+	}
+
+	void uv_co_stream::on_client_connect(uv_tcp_client* client, int status)
+	{
+		uv_co_stream* stream = (uv_co_stream*)client->data();
+		if (stream == nullptr || stream->m_connector == nullptr)
+		{
+			return;
+		}
+
+		connect_awaiter* connector = stream->m_connector;
+		stream->m_connector = nullptr;
+		connector->m_status = status;
+		if (status == 0)
+		{
+			stream->m_closed = false;
+			stream->m_status = 0;
+			stream->m_buffer.clear();
+			stream->m_staging.clear();
+			stream->m_head = 0;
+			stream->m_consume = 0;
+		}
+		//still inside await_suspend when the limiter answers right away
+		if (connector->m_handle)
+		{
+			connector->m_handle.resume();
+		}
+	}
+
+	void uv_co_stream::on_client_close(uv_tcp_client* client)
+	{
+		uv_co_stream* stream = (uv_co_stream*)client->data();
+		if (stream != nullptr)
+		{
+			stream->shutdown(UV_EOF);
+		}
+	}
+}
+
+#endif // UV_HAVE_COROUTINES
@@ -0,0 +1,478 @@
+#include "uv_executor.h"
+#include "uv_loop_monitor.h"
+
+namespace uv
+{
+	namespace
+	{
+#if defined(_MSC_VER)
+		__declspec(thread) void* current_worker = nullptr;
+#else
+		__thread void* current_worker = nullptr;
+#endif
+	}
+
+	uv_executor::uv_executor(size_t workers /*= 0*/) :
+		m_queued(0),
+		m_sleepers(0),
+		m_accepting(false),
+		m_running(false),
+		m_stopping(false),
+		m_cancel(false)
+	{
+		if (workers == 0)
+		{
+			uv_cpu_info_t* info = nullptr;
+			int count = 0;
+			if (uv_cpu_info(&info, &count) == 0)
+			{
+				uv_free_cpu_info(info, count);
+			}
+			workers = count > 0 ? (size_t)count : 1;
+		}
+
+		for (size_t i = 0; i < workers; ++i)
+		{
+			worker* w = new worker();
+			w->executor = this;
+			w->index = i;
+			w->ticks = 0;
+			uv_mutex_init(&w->mutex);
+			m_workers.push_back(w);
+		}
+		uv_mutex_init(&m_mutex);
+		uv_mutex_init(&m_inject_mutex);
+		uv_cond_init(&m_cond);
+	}
+
+	uv_executor::~uv_executor()
+	{
+		stop();
+		for (size_t i = 0; i < m_workers.size(); ++i)
+		{
+			uv_mutex_destroy(&m_workers[i]->mutex);
+			delete m_workers[i];
+		}
+		m_workers.clear();
+		uv_cond_destroy(&m_cond);
+		uv_mutex_destroy(&m_inject_mutex);
+		uv_mutex_destroy(&m_mutex);
+	}
+
+	bool uv_executor::start()
+	{
+		if (m_running)
+		{
+			return true;
+		}
+
+		m_stopping = false;
+		m_cancel = false;
+		m_accepting = true;
+		for (size_t i = 0; i < m_workers.size(); ++i)
+		{
+			int r = uv_thread_create(&m_workers[i]->thread, run_worker, m_workers[i]);
+			if (r != 0)
+			{
+				fprintf(stderr, "executor worker %d: %s\n", (int)i, uv_strerror(r));
+				//join the ones already running
+				for (size_t j = i; j < m_workers.size(); ++j)
+				{
+					m_workers[j]->executor = nullptr;
+				}
+				m_running = true;
+				stop(false);
+				return false;
+			}
+		}
+		m_running = true;
+		return true;
+	}
+
+	void uv_executor::stop(bool drain /*= true*/)
+	{
+		if (m_running == false)
+		{
+			return;
+		}
+
+		m_accepting = false;
+		uv_mutex_lock(&m_mutex);
+		m_stopping = true;
+		m_cancel = !drain;
+		uv_cond_broadcast(&m_cond);
+		uv_mutex_unlock(&m_mutex);
+
+		for (size_t i = 0; i < m_workers.size(); ++i)
+		{
+			worker* w = m_workers[i];
+			if (w->executor != nullptr)
+			{
+				uv_thread_join(&w->thread);
+			}
+			w->executor = this;
+		}
+		m_running = false;
+	}
+
+	void uv_executor::push(uv_executor_task* task)
+	{
+		worker* w = (worker*)current_worker;
+		if (w != nullptr && w->executor == this)
+		{
+			uv_mutex_lock(&w->mutex);
+			w->tasks.push_back(task);
+			uv_mutex_unlock(&w->mutex);
+		}
+		else
+		{
+			//a worker's own deque runs newest first, an outside task there could wait behind every later one
+			uv_mutex_lock(&m_inject_mutex);
+			m_injected.push_back(task);
+			uv_mutex_unlock(&m_inject_mutex);
+		}
+
+		//a worker checks m_queued after announcing itself as sleeper, so one of the two sides sees the other
+		m_queued.fetch_add(1);
+		if (m_sleepers.load() > 0)
+		{
+			uv_mutex_lock(&m_mutex);
+			uv_cond_signal(&m_cond);
+			uv_mutex_unlock(&m_mutex);
+		}
+	}
+
+	uv_executor_task* uv_executor::pop(worker* w)
+	{
+		uv_executor_task* task = nullptr;
+		uv_mutex_lock(&w->mutex);
+		if (w->tasks.empty() == false)
+		{
+			//newest first, its data is likely still in cache
+			task = w->tasks.back();
+			w->tasks.pop_back();
+		}
+		uv_mutex_unlock(&w->mutex);
+		return task;
+	}
+
+	uv_executor_task* uv_executor::pop_injected()
+	{
+		uv_executor_task* task = nullptr;
+		uv_mutex_lock(&m_inject_mutex);
+		if (m_injected.empty() == false)
+		{
+			task = m_injected.front();
+			m_injected.pop_front();
+		}
+		uv_mutex_unlock(&m_inject_mutex);
+		return task;
+	}
+
+	uv_executor_task* uv_executor::steal(worker* w)
+	{
+		size_t count = m_workers.size();
+		for (size_t i = 1; i < count; ++i)
+		{
+			worker* victim = m_workers[(w->index + i) % count];
+			uv_executor_task* task = nullptr;
+			uv_mutex_lock(&victim->mutex);
+			if (victim->tasks.empty() == false)
+			{
+				task = victim->tasks.front();
+				victim->tasks.pop_front();
+			}
+			uv_mutex_unlock(&victim->mutex);
+			if (task != nullptr)
+			{
+				return task;
+			}
+		}
+		return nullptr;
+	}
+
+	void uv_executor::finish(uv_executor_task* task)
+	{
+		if (task->serial != nullptr)
+		{
+			task->serial->finish(task);
+		}
+		else
+		{
+			task->port->complete(task);
+		}
+	}
+
+	void uv_executor::run_worker(void* arg)
+	{
+		worker* w = (worker*)arg;
+		uv_executor* executor = w->executor;
+		current_worker = w;
+
+		for (;;)
+		{
+			uv_executor_task* task = nullptr;
+			//now and then the injected tasks go first, a worker busy with its own can't hold them back
+			if (++w->ticks % INJECT_INTERVAL == 0)
+			{
+				task = executor->pop_injected();
+			}
+			if (task == nullptr)
+			{
+				task = executor->pop(w);
+			}
+			if (task == nullptr)
+			{
+				task = executor->pop_injected();
+			}
+			if (task == nullptr)
+			{
+				task = executor->steal(w);
+			}
+
+			if (task != nullptr)
+			{
+				executor->m_queued.fetch_sub(1);
+				if (executor->m_cancel.load())
+				{
+					task->status = UV_ECANCELED;
+				}
+				else
+				{
+					task->work(task->arg);
+				}
+				executor->finish(task);
+				continue;
+			}
+
+			uv_mutex_lock(&executor->m_mutex);
+			executor->m_sleepers.fetch_add(1);
+			bool done = false;
+			while (executor->m_queued.load() == 0)
+			{
+				if (executor->m_stopping)
+				{
+					done = true;
+					break;
+				}
+				uv_cond_wait(&executor->m_cond, &executor->m_mutex);
+			}
+			executor->m_sleepers.fetch_sub(1);
+			uv_mutex_unlock(&executor->m_mutex);
+
+			if (done)
+			{
+				break;
+			}
+		}
+		current_worker = nullptr;
+	}
+
+	uv_executor_port::uv_executor_port(uv_executor* executor, uv_loop_t* loop) :
+		m_executor(executor),
+		m_loop(loop),
+		m_pending(0),
+		m_open(false),
+		m_closing(false)
+	{
+		uv_mutex_init(&m_mutex);
+	}
+
+	uv_executor_port::~uv_executor_port()
+	{
+		uv_mutex_destroy(&m_mutex);
+	}
+
+	bool uv_executor_port::open()
+	{
+		if (m_open)
+		{
+			return true;
+		}
+
+		int r = uv_async_init(m_loop, &m_async, on_async);
+		if (r != 0)
+		{
+			fprintf(stderr, "executor port: %s\n", uv_strerror(r));
+			return false;
+		}
+		m_async.data = this;
+		//only tasks in flight keep the loop alive
+		uv_unref((uv_handle_t*)&m_async);
+		m_open = true;
+		return true;
+	}
+
+	bool uv_executor_port::submit(executor_work_callback work, executor_done_callback done, void* arg)
+	{
+		uv_executor_task* task = create(work, done, arg);
+		if (task == nullptr)
+		{
+			return false;
+		}
+		m_executor->push(task);
+		return true;
+	}
+
+	void uv_executor_port::close()
+	{
+		if (m_closing)
+		{
+			return;
+		}
+		m_closing = true;
+
+		if (m_open == false)
+		{
+			delete this;
+		}
+		else if (m_pending == 0)
+		{
+			uv_close((uv_handle_t*)&m_async, on_close);
+		}
+	}
+
+	uv_executor_task* uv_executor_port::create(executor_work_callback work, executor_done_callback done, void* arg)
+	{
+		if (work == nullptr || m_closing || m_executor->m_accepting.load() == false)
+		{
+			return nullptr;
+		}
+		if (open() == false)
+		{
+			return nullptr;
+		}
+
+		uv_executor_task* task = new uv_executor_task();
+		task->work = work;
+		task->done = done;
+		task->arg = arg;
+		task->port = this;
+		task->serial = nullptr;
+		task->status = 0;
+
+		if (m_pending++ == 0)
+		{
+			uv_ref((uv_handle_t*)&m_async);
+		}
+		return task;
+	}
+
+	void uv_executor_port::complete(uv_executor_task* task)
+	{
+		uv_mutex_lock(&m_mutex);
+		m_completed.push_back(task);
+		uv_mutex_unlock(&m_mutex);
+
+		//coalesced, one callback for all completions that arrive before the loop wakes
+		uv_async_send(&m_async);
+	}
+
+	void uv_executor_port::on_async(uv_async_t* handle)
+	{
+		uv_loop_monitor::mark();
+
+		uv_executor_port* port = (uv_executor_port*)handle->data;
+
+		std::vector<uv_executor_task*> completed;
+		uv_mutex_lock(&port->m_mutex);
+		completed.swap(port->m_completed);
+		uv_mutex_unlock(&port->m_mutex);
+
+		for (size_t i = 0; i < completed.size(); ++i)
+		{
+			uv_executor_task* task = completed[i];
+			if (task->done != nullptr)
+			{
+				task->done(task->arg, task->status);
+			}
+			delete task;
+		}
+
+		port->m_pending -= completed.size();
+		if (port->m_pending == 0)
+		{
+			if (port->m_closing)
+			{
+				uv_close((uv_handle_t*)&port->m_async, on_close);
+			}
+			else
+			{
+				uv_unref((uv_handle_t*)&port->m_async);
+			}
+		}
+	}
+
+	void uv_executor_port::on_close(uv_handle_t* handle)
+	{
+		uv_executor_port* port = (uv_executor_port*)handle->data;
+		delete port;
+	}
+
+	uv_serial_queue::uv_serial_queue(uv_executor_port* port) :
+		m_port(port),
+		m_running(false)
+	{
+		uv_mutex_init(&m_mutex);
+	}
+
+	uv_serial_queue::~uv_serial_queue()
+	{
+		//the worker that completed the last task may still be leaving finish()
+		uv_mutex_lock(&m_mutex);
+		uv_mutex_unlock(&m_mutex);
+		uv_mutex_destroy(&m_mutex);
+	}
+
+	bool uv_serial_queue::submit(executor_work_callback work, executor_done_callback done, void* arg)
+	{
+		uv_executor_task* task = m_port->create(work, done, arg);
+		if (task == nullptr)
+		{
+			return false;
+		}
+		task->serial = this;
+
+		uv_mutex_lock(&m_mutex);
+		bool idle = m_running == false;
+		if (idle)
+		{
+			m_running = true;
+		}
+		else
+		{
+			m_tasks.push_back(task);
+		}
+		uv_mutex_unlock(&m_mutex);
+
+		if (idle)
+		{
+			m_port->executor()->push(task);
+		}
+		return true;
+	}
+
+	void uv_serial_queue::finish(uv_executor_task* task)
+	{
+		uv_executor_task* next = nullptr;
+
+		//the completion is queued before the next task can run, so completions keep the order
+		uv_mutex_lock(&m_mutex);
+		task->port->complete(task);
+		if (m_tasks.empty())
+		{
+			m_running = false;
+		}
+		else
+		{
+			next = m_tasks.front();
+			m_tasks.pop_front();
+		}
+		uv_mutex_unlock(&m_mutex);
+
+		if (next != nullptr)
+		{
+			next->port->executor()->push(next);
+		}
+	}
+}
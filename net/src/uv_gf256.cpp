@@ -0,0 +1,232 @@
+#include "uv_gf256.h"
+#include <string.h>
+#include <vector>
+
+#ifdef UV_GF256_SSSE3
+#include <tmmintrin.h>
+#endif
+
+namespace uv
+{
+	namespace
+	{
+		struct gf_tables
+		{
+			uint8_t		exp[512];
+			uint8_t		log[256];
+			uint8_t		mul[256][256];
+
+			gf_tables()
+			{
+				unsigned x = 1;
+				for (unsigned i = 0; i < 255; ++i)
+				{
+					exp[i] = (uint8_t)x;
+					log[x] = (uint8_t)i;
+					x <<= 1;
+					if (x & 0x100)
+					{
+						x ^= 0x11d;
+					}
+				}
+				//doubled so exp[log a + log b] needs no modulo
+				for (unsigned i = 255; i < 512; ++i)
+				{
+					exp[i] = exp[i - 255];
+				}
+				log[0] = 0;
+
+				for (unsigned a = 0; a < 256; ++a)
+				{
+					for (unsigned b = 0; b < 256; ++b)
+					{
+						mul[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+					}
+				}
+			}
+		};
+
+		const gf_tables& tables()
+		{
+			static const gf_tables t;
+			return t;
+		}
+	}
+
+	uint8_t uv_gf256::mul(uint8_t a, uint8_t b)
+	{
+		return tables().mul[a][b];
+	}
+
+	uint8_t uv_gf256::div(uint8_t a, uint8_t b)
+	{
+		if (a == 0 || b == 0)
+		{
+			return 0;
+		}
+		const gf_tables& t = tables();
+		return t.exp[t.log[a] + 255 - t.log[b]];
+	}
+
+	uint8_t uv_gf256::inv(uint8_t a)
+	{
+		return div(1, a);
+	}
+
+	void uv_gf256::add_region(uint8_t* dst, const uint8_t* src, size_t length)
+	{
+		size_t i = 0;
+#ifdef UV_GF256_SSSE3
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, s));
+		}
+#endif
+		for (; i < length; ++i)
+		{
+			dst[i] ^= src[i];
+		}
+	}
+
+	void uv_gf256::mul_add_region(uint8_t* dst, const uint8_t* src, uint8_t c, size_t length)
+	{
+		if (c == 0)
+		{
+			return;
+		}
+		if (c == 1)
+		{
+			add_region(dst, src, length);
+			return;
+		}
+
+		const uint8_t* row = tables().mul[c];
+		size_t i = 0;
+#ifdef UV_GF256_SSSE3
+		//c * x = c * (x & 0x0f) ^ c * (x & 0xf0), each half is a 16 entry pshufb lookup
+		uint8_t lo[16];
+		uint8_t hi[16];
+		for (unsigned n = 0; n < 16; ++n)
+		{
+			lo[n] = row[n];
+			hi[n] = row[n << 4];
+		}
+		__m128i table_lo = _mm_loadu_si128((const __m128i*)lo);
+		__m128i table_hi = _mm_loadu_si128((const __m128i*)hi);
+		__m128i mask = _mm_set1_epi8(0x0f);
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i l = _mm_shuffle_epi8(table_lo, _mm_and_si128(s, mask));
+			__m128i h = _mm_shuffle_epi8(table_hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+		}
+#endif
+		for (; i < length; ++i)
+		{
+			dst[i] ^= row[src[i]];
+		}
+	}
+
+	void uv_gf256::mul_region(uint8_t* dst, uint8_t c, size_t length)
+	{
+		if (c == 1)
+		{
+			return;
+		}
+		if (c == 0)
+		{
+			memset(dst, 0, length);
+			return;
+		}
+
+		const uint8_t* row = tables().mul[c];
+		size_t i = 0;
+#ifdef UV_GF256_SSSE3
+		uint8_t lo[16];
+		uint8_t hi[16];
+		for (unsigned n = 0; n < 16; ++n)
+		{
+			lo[n] = row[n];
+			hi[n] = row[n << 4];
+		}
+		__m128i table_lo = _mm_loadu_si128((const __m128i*)lo);
+		__m128i table_hi = _mm_loadu_si128((const __m128i*)hi);
+		__m128i mask = _mm_set1_epi8(0x0f);
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i*)(dst + i));
+			__m128i l = _mm_shuffle_epi8(table_lo, _mm_and_si128(s, mask));
+			__m128i h = _mm_shuffle_epi8(table_hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(l, h));
+		}
+#endif
+		for (; i < length; ++i)
+		{
+			dst[i] = row[dst[i]];
+		}
+	}
+
+	bool uv_gf256::invert_matrix(uint8_t* matrix, size_t n)
+	{
+		//gauss-jordan on [matrix | identity]
+		std::vector<uint8_t> work(n * 2 * n, 0);
+		for (size_t r = 0; r < n; ++r)
+		{
+			memcpy(&work[r * 2 * n], matrix + r * n, n);
+			work[r * 2 * n + n + r] = 1;
+		}
+
+		size_t width = 2 * n;
+		for (size_t col = 0; col < n; ++col)
+		{
+			size_t pivot = col;
+			while (pivot < n && work[pivot * width + col] == 0)
+			{
+				++pivot;
+			}
+			if (pivot == n)
+			{
+				return false;
+			}
+			if (pivot != col)
+			{
+				for (size_t k = 0; k < width; ++k)
+				{
+					uint8_t t = work[pivot * width + k];
+					work[pivot * width + k] = work[col * width + k];
+					work[col * width + k] = t;
+				}
+			}
+
+			uint8_t* row = &work[col * width];
+			mul_region(row, inv(row[col]), width);
+
+			for (size_t r = 0; r < n; ++r)
+			{
+				if (r != col && work[r * width + col] != 0)
+				{
+					mul_add_region(&work[r * width], row, work[r * width + col], width);
+				}
+			}
+		}
+
+		for (size_t r = 0; r < n; ++r)
+		{
+			memcpy(matrix + r * n, &work[r * width + n], n);
+		}
+		return true;
+	}
+
+	bool uv_gf256::simd()
+	{
+#ifdef UV_GF256_SSSE3
+		return true;
+#else
+		return false;
+#endif
+	}
+}
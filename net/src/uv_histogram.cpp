@@ -0,0 +1,174 @@
+#include "uv_histogram.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+
+namespace uv
+{
+	static inline int highest_bit(uint64_t value)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return 63 - __builtin_clzll(value);
+#elif defined(_MSC_VER) && defined(_WIN64)
+		unsigned long bit;
+		_BitScanReverse64(&bit, value);
+		return (int)bit;
+#else
+		int bit = 0;
+		while (value >>= 1)
+		{
+			++bit;
+		}
+		return bit;
+#endif
+	}
+
+	uv_histogram::uv_histogram()
+	{
+		reset();
+	}
+
+	uv_histogram::uv_histogram(const uv_histogram& other)
+	{
+		reset();
+		merge(other);
+	}
+
+	uv_histogram& uv_histogram::operator=(const uv_histogram& other)
+	{
+		if (this != &other)
+		{
+			reset();
+			merge(other);
+		}
+		return *this;
+	}
+
+	size_t uv_histogram::index(uint64_t value)
+	{
+		if (value < SUB_BUCKETS)
+		{
+			return (size_t)value;
+		}
+		if (value >= ((uint64_t)1 << MAX_VALUE_BITS))
+		{
+			value = ((uint64_t)1 << MAX_VALUE_BITS) - 1;
+		}
+
+		//bucket by magnitude, then linearly by the next SUB_BUCKET_BITS bits
+		int shift = highest_bit(value) - SUB_BUCKET_BITS;
+		uint64_t mantissa = (value >> shift) - SUB_BUCKETS;
+		return (size_t)((shift + 1) * SUB_BUCKETS + mantissa);
+	}
+
+	uint64_t uv_histogram::highest(size_t index)
+	{
+		if (index < SUB_BUCKETS)
+		{
+			return index;
+		}
+		int shift = (int)(index / SUB_BUCKETS) - 1;
+		uint64_t mantissa = index % SUB_BUCKETS + SUB_BUCKETS;
+		return ((mantissa + 1) << shift) - 1;
+	}
+
+	void uv_histogram::record(uint64_t value)
+	{
+		add(m_counts[index(value)], 1);
+		add(m_count, 1);
+		add(m_sum, value);
+
+		if (value < m_min.load(std::memory_order_relaxed))
+		{
+			m_min.store(value, std::memory_order_relaxed);
+		}
+		if (value > m_max.load(std::memory_order_relaxed))
+		{
+			m_max.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	void uv_histogram::merge(const uv_histogram& other)
+	{
+		for (size_t i = 0; i < BUCKETS; ++i)
+		{
+			uint64_t n = other.m_counts[i].load(std::memory_order_relaxed);
+			if (n > 0)
+			{
+				add(m_counts[i], n);
+			}
+		}
+		add(m_count, other.m_count.load(std::memory_order_relaxed));
+		add(m_sum, other.m_sum.load(std::memory_order_relaxed));
+
+		uint64_t other_min = other.m_min.load(std::memory_order_relaxed);
+		uint64_t other_max = other.m_max.load(std::memory_order_relaxed);
+		if (other_min < m_min.load(std::memory_order_relaxed))
+		{
+			m_min.store(other_min, std::memory_order_relaxed);
+		}
+		if (other_max > m_max.load(std::memory_order_relaxed))
+		{
+			m_max.store(other_max, std::memory_order_relaxed);
+		}
+	}
+
+	void uv_histogram::reset()
+	{
+		for (size_t i = 0; i < BUCKETS; ++i)
+		{
+			m_counts[i].store(0, std::memory_order_relaxed);
+		}
+		m_count.store(0, std::memory_order_relaxed);
+		m_sum.store(0, std::memory_order_relaxed);
+		m_min.store(UINT64_MAX, std::memory_order_relaxed);
+		m_max.store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t uv_histogram::min() const
+	{
+		return count() > 0 ? m_min.load(std::memory_order_relaxed) : 0;
+	}
+
+	double uv_histogram::mean() const
+	{
+		uint64_t n = count();
+		return n > 0 ? (double)m_sum.load(std::memory_order_relaxed) / n : 0;
+	}
+
+	uint64_t uv_histogram::percentile(double percent) const
+	{
+		uint64_t total = 0;
+		for (size_t i = 0; i < BUCKETS; ++i)
+		{
+			total += m_counts[i].load(std::memory_order_relaxed);
+		}
+		if (total == 0)
+		{
+			return 0;
+		}
+
+		if (percent > 100)
+		{
+			percent = 100;
+		}
+		uint64_t rank = (uint64_t)(percent / 100 * total + 0.5);
+		if (rank < 1)
+		{
+			rank = 1;
+		}
+
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUCKETS; ++i)
+		{
+			seen += m_counts[i].load(std::memory_order_relaxed);
+			if (seen >= rank)
+			{
+				uint64_t value = highest(i);
+				uint64_t top = max();
+				return value < top ? value : top;
+			}
+		}
+		return max();
+	}
+}
@@ -0,0 +1,285 @@
+#include "uv_loop_mesh.h"
+#include "uv_loop_monitor.h"
+
+namespace uv
+{
+	uv_loop_mesh::uv_loop_mesh(uv_runtime* runtime, size_t capacity /*= 1024*/) :
+		m_runtime(runtime),
+		m_open(false),
+		m_rejected(0),
+		m_receive_callback(nullptr),
+		m_data(nullptr)
+	{
+		size_t count = runtime->size();
+		for (size_t i = 0; i < count; ++i)
+		{
+			node* n = new node();
+			n->mesh = this;
+			n->index = i;
+			n->closing = 0;
+			n->open = false;
+			n->signaled.store(false);
+			n->marked.resize(count, 0);
+			m_nodes.push_back(n);
+		}
+		for (size_t i = 0; i < count * count; ++i)
+		{
+			m_rings.push_back(new ring(capacity));
+		}
+		uv_sem_init(&m_done, 0);
+	}
+
+	uv_loop_mesh::~uv_loop_mesh()
+	{
+		close();
+		for (size_t i = 0; i < m_rings.size(); ++i)
+		{
+			delete m_rings[i];
+		}
+		m_rings.clear();
+		for (size_t i = 0; i < m_nodes.size(); ++i)
+		{
+			delete m_nodes[i];
+		}
+		m_nodes.clear();
+		uv_sem_destroy(&m_done);
+	}
+
+	bool uv_loop_mesh::open()
+	{
+		if (m_open)
+		{
+			return true;
+		}
+		//waiting on a loop thread would block the loop the attach task has to run on
+		if (uv_runtime::current() >= 0)
+		{
+			fprintf(stderr, "loop mesh: open from a runtime loop.\n");
+			return false;
+		}
+
+		bool result = true;
+		for (size_t i = 0; i < m_nodes.size(); ++i)
+		{
+			if (m_runtime->post(i, on_open, this) == false)
+			{
+				fprintf(stderr, "loop mesh: loop %d isn't running.\n", (int)i);
+				result = false;
+				break;
+			}
+			uv_sem_wait(&m_done);
+			if (m_nodes[i]->open == false)
+			{
+				result = false;
+				break;
+			}
+		}
+
+		m_open = true;
+		if (result == false)
+		{
+			close();
+		}
+		return result;
+	}
+
+	void uv_loop_mesh::close()
+	{
+		if (m_open == false || uv_runtime::current() >= 0)
+		{
+			return;
+		}
+
+		for (size_t i = 0; i < m_nodes.size(); ++i)
+		{
+			if (m_nodes[i]->open && m_runtime->post(i, on_close_task, this))
+			{
+				uv_sem_wait(&m_done);
+			}
+			m_nodes[i]->open = false;
+		}
+
+		//whatever is left was never delivered
+		uv_mesh_message messages[BATCH];
+		for (size_t i = 0; i < m_rings.size(); ++i)
+		{
+			m_rings[i]->publish();
+			while (m_rings[i]->pop(messages, BATCH) > 0);
+		}
+		m_open = false;
+	}
+
+	bool uv_loop_mesh::send(size_t to, const uv_mesh_message& message)
+	{
+		int from = uv_runtime::current();
+		if (from < 0 || (size_t)from >= m_nodes.size() || to >= m_nodes.size())
+		{
+			return false;
+		}
+
+		node* n = m_nodes[from];
+		if (n->open == false)
+		{
+			return false;
+		}
+
+		ring* r = get(from, to);
+		if (r->stage(message) == false)
+		{
+			//let the receiver make room, the caller decides what to do with this one
+			publish(n);
+			m_rejected.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		if (n->marked[to] == 0)
+		{
+			n->marked[to] = 1;
+			n->dirty.push_back(to);
+		}
+		return true;
+	}
+
+	void uv_loop_mesh::flush()
+	{
+		int from = uv_runtime::current();
+		if (from >= 0 && (size_t)from < m_nodes.size() && m_nodes[from]->open)
+		{
+			publish(m_nodes[from]);
+		}
+	}
+
+	void uv_loop_mesh::publish(node* n)
+	{
+		for (size_t i = 0; i < n->dirty.size(); ++i)
+		{
+			size_t to = n->dirty[i];
+			n->marked[to] = 0;
+			if (get(n->index, to)->publish() == 0)
+			{
+				continue;
+			}
+			//the receiver clears the flag before it drains, whoever sets it again wakes it
+			node* target = m_nodes[to];
+			if (target->signaled.exchange(true) == false)
+			{
+				uv_async_send(&target->async);
+			}
+		}
+		n->dirty.clear();
+	}
+
+	void uv_loop_mesh::drain(node* n)
+	{
+		n->signaled.exchange(false);
+
+		uv_mesh_message messages[BATCH];
+		bool more = false;
+		for (size_t from = 0; from < m_nodes.size(); ++from)
+		{
+			ring* r = get(from, n->index);
+			//one ring's worth per wakeup, a busy sender can't starve the others
+			size_t budget = r->capacity();
+			size_t count = 0;
+			while (budget > 0 && (count = r->pop(messages, budget < (size_t)BATCH ? budget : (size_t)BATCH)) > 0)
+			{
+				budget -= count;
+				for (size_t i = 0; i < count; ++i)
+				{
+					if (m_receive_callback != nullptr)
+					{
+						m_receive_callback(this, from, n->index, messages[i]);
+					}
+				}
+			}
+			if (budget == 0 && r->empty() == false)
+			{
+				more = true;
+			}
+		}
+
+		if (more && n->signaled.exchange(true) == false)
+		{
+			uv_async_send(&n->async);
+		}
+	}
+
+	void uv_loop_mesh::on_open(uv_runtime* runtime, size_t index, void* arg)
+	{
+		uv_loop_mesh* mesh = (uv_loop_mesh*)arg;
+		node* n = mesh->m_nodes[index];
+		uv_loop_t* loop = runtime->loop(index);
+
+		int r = uv_async_init(loop, &n->async, on_async);
+		if (r == 0)
+		{
+			uv_prepare_init(loop, &n->prepare);
+			uv_check_init(loop, &n->check);
+			n->async.data = n;
+			n->prepare.data = n;
+			n->check.data = n;
+
+			//sends of timers and idle callbacks go out before the poll, those of io callbacks after it
+			uv_prepare_start(&n->prepare, on_prepare);
+			uv_check_start(&n->check, on_check);
+			//the runtime keeps its loops alive, the mesh doesn't have to
+			uv_unref((uv_handle_t*)&n->async);
+			uv_unref((uv_handle_t*)&n->prepare);
+			uv_unref((uv_handle_t*)&n->check);
+			n->open = true;
+		}
+		else
+		{
+			fprintf(stderr, "loop mesh %d: %s\n", (int)index, uv_strerror(r));
+		}
+		uv_sem_post(&mesh->m_done);
+	}
+
+	void uv_loop_mesh::on_close_task(uv_runtime* /*runtime*/, size_t index, void* arg)
+	{
+		uv_loop_mesh* mesh = (uv_loop_mesh*)arg;
+		node* n = mesh->m_nodes[index];
+
+		n->open = false;
+		n->dirty.clear();
+		n->marked.assign(n->marked.size(), 0);
+		n->closing = 3;
+		uv_close((uv_handle_t*)&n->async, on_close);
+		uv_close((uv_handle_t*)&n->prepare, on_close);
+		uv_close((uv_handle_t*)&n->check, on_close);
+	}
+
+	void uv_loop_mesh::on_async(uv_async_t* handle)
+	{
+		uv_loop_monitor::mark();
+
+		node* n = (node*)handle->data;
+		n->mesh->drain(n);
+	}
+
+	void uv_loop_mesh::on_prepare(uv_prepare_t* handle)
+	{
+		node* n = (node*)handle->data;
+		if (n->dirty.empty() == false)
+		{
+			n->mesh->publish(n);
+		}
+	}
+
+	void uv_loop_mesh::on_check(uv_check_t* handle)
+	{
+		node* n = (node*)handle->data;
+		if (n->dirty.empty() == false)
+		{
+			n->mesh->publish(n);
+		}
+	}
+
+	void uv_loop_mesh::on_close(uv_handle_t* handle)
+	{
+		node* n = (node*)handle->data;
+		if (--n->closing == 0)
+		{
+			uv_sem_post(&n->mesh->m_done);
+		}
+	}
+}
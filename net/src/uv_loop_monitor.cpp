@@ -0,0 +1,245 @@
+#include "uv_loop_monitor.h"
+#include <string.h>
+
+namespace uv
+{
+	thread_local uv_loop_monitor* uv_loop_monitor::s_current = nullptr;
+	thread_local uint64_t uv_loop_monitor::s_dispatched = 0;
+
+	uv_loop_monitor::uv_loop_monitor(uv_loop_t* loop /*= uv_default_loop()*/) :
+		m_loop(loop),
+		m_started(false),
+		m_sample(50),
+		m_window(1000000000ull),
+		m_window_start(0),
+		m_due(0),
+		m_prepare_time(0),
+		m_check_time(0),
+		m_wake(0),
+		m_callbacks(0),
+		m_busy(0),
+		m_idle(0),
+		m_iterations(0),
+		m_iteration_callbacks(0),
+		m_iteration_max(0),
+		m_lag_sum(0),
+		m_lag_count(0),
+		m_lag_max(0),
+		m_has_average(false),
+		m_max_utilization(0),
+		m_max_lag(0),
+		m_threshold_callback(nullptr),
+		m_data(nullptr)
+	{
+		memset(&m_last, 0, sizeof(m_last));
+		memset(&m_average, 0, sizeof(m_average));
+	}
+
+	uv_loop_monitor::~uv_loop_monitor()
+	{
+		stop();
+	}
+
+	bool uv_loop_monitor::start(unsigned sample /*= 50*/, unsigned window /*= 1000*/)
+	{
+		if (m_started)
+		{
+			return true;
+		}
+
+		int r = uv_prepare_init(m_loop, &m_prepare);
+		if (r == 0)
+		{
+			r = uv_check_init(m_loop, &m_check);
+			if (r == 0)
+			{
+				r = uv_timer_init(m_loop, &m_timer);
+				if (r != 0)
+				{
+					uv_close((uv_handle_t*)&m_check, nullptr);
+				}
+			}
+			if (r != 0)
+			{
+				uv_close((uv_handle_t*)&m_prepare, nullptr);
+			}
+		}
+		if (r != 0)
+		{
+			fprintf(stderr, "loop monitor: %s\n", uv_strerror(r));
+			return false;
+		}
+
+		m_prepare.data = this;
+		m_check.data = this;
+		m_timer.data = this;
+		m_sample = sample > 0 ? sample : 1;
+		m_window = (uint64_t)(window > m_sample ? window : m_sample) * 1000000;
+
+		uint64_t now = uv_hrtime();
+		m_window_start = now;
+		m_prepare_time = 0;
+		m_check_time = 0;
+		m_due = now + (uint64_t)m_sample * 1000000;
+
+		uv_prepare_start(&m_prepare, on_prepare);
+		uv_check_start(&m_check, on_check);
+		uv_timer_start(&m_timer, on_timer, m_sample, 0);
+		//watching the loop doesn't keep it alive
+		uv_unref((uv_handle_t*)&m_prepare);
+		uv_unref((uv_handle_t*)&m_check);
+		uv_unref((uv_handle_t*)&m_timer);
+
+		m_started = true;
+		return true;
+	}
+
+	void uv_loop_monitor::stop()
+	{
+		if (m_started == false)
+		{
+			return;
+		}
+
+		if (s_current == this)
+		{
+			s_current = nullptr;
+		}
+		uv_close((uv_handle_t*)&m_prepare, nullptr);
+		uv_close((uv_handle_t*)&m_check, nullptr);
+		uv_close((uv_handle_t*)&m_timer, nullptr);
+		m_started = false;
+	}
+
+	void uv_loop_monitor::set_threshold(double utilization, uint64_t lag, threshold_callback callback)
+	{
+		m_max_utilization = utilization;
+		m_max_lag = lag;
+		m_threshold_callback = callback;
+	}
+
+	void uv_loop_monitor::roll()
+	{
+		uv_loop_stats stats;
+		uint64_t total = m_busy + m_idle;
+		stats.utilization = total > 0 ? (double)m_busy / (double)total : 0;
+		stats.busy = m_busy / 1000;
+		stats.idle = m_idle / 1000;
+		stats.iterations = m_iterations;
+		stats.callbacks = m_iterations > 0 ? (double)m_iteration_callbacks / (double)m_iterations : 0;
+		stats.iteration_max = m_iteration_max / 1000;
+		stats.lag_mean = m_lag_count > 0 ? m_lag_sum / m_lag_count / 1000 : 0;
+		stats.lag_max = m_lag_max / 1000;
+		m_last = stats;
+
+		if (m_has_average == false)
+		{
+			m_average = stats;
+			m_has_average = true;
+		}
+		else
+		{
+			//alpha 1/4, a burst shows within a few windows and one noisy window doesn't dominate
+			m_average.utilization += (stats.utilization - m_average.utilization) / 4;
+			m_average.busy = (m_average.busy * 3 + stats.busy) / 4;
+			m_average.idle = (m_average.idle * 3 + stats.idle) / 4;
+			m_average.iterations = (m_average.iterations * 3 + stats.iterations) / 4;
+			m_average.callbacks += (stats.callbacks - m_average.callbacks) / 4;
+			m_average.iteration_max = (m_average.iteration_max * 3 + stats.iteration_max) / 4;
+			m_average.lag_mean = (m_average.lag_mean * 3 + stats.lag_mean) / 4;
+			m_average.lag_max = (m_average.lag_max * 3 + stats.lag_max) / 4;
+		}
+
+		m_busy = 0;
+		m_idle = 0;
+		m_iterations = 0;
+		m_iteration_callbacks = 0;
+		m_iteration_max = 0;
+		m_lag_sum = 0;
+		m_lag_count = 0;
+		m_lag_max = 0;
+
+		if (m_threshold_callback != nullptr)
+		{
+			bool over = (m_max_utilization > 0 && stats.utilization > m_max_utilization) ||
+				(m_max_lag > 0 && stats.lag_mean > m_max_lag);
+			if (over)
+			{
+				m_threshold_callback(this, stats);
+			}
+		}
+	}
+
+	void uv_loop_monitor::on_prepare(uv_prepare_t* handle)
+	{
+		uv_loop_monitor* monitor = (uv_loop_monitor*)handle->data;
+		uint64_t now = uv_hrtime();
+
+		//timers, pending and idle callbacks since the last poll
+		if (monitor->m_check_time != 0)
+		{
+			monitor->m_busy += now - monitor->m_check_time;
+		}
+		monitor->m_prepare_time = now;
+		monitor->m_wake = 0;
+		monitor->m_callbacks = 0;
+		s_current = monitor;
+	}
+
+	void uv_loop_monitor::on_check(uv_check_t* handle)
+	{
+		uv_loop_monitor* monitor = (uv_loop_monitor*)handle->data;
+		uint64_t now = uv_hrtime();
+		if (s_current == monitor)
+		{
+			s_current = nullptr;
+		}
+		if (monitor->m_prepare_time == 0)
+		{
+			//started between prepare and check
+			monitor->m_check_time = now;
+			return;
+		}
+
+		uint64_t wake = monitor->m_wake != 0 ? monitor->m_wake : now;
+		monitor->m_idle += wake - monitor->m_prepare_time;
+		monitor->m_busy += now - wake;
+		monitor->m_iteration_callbacks += monitor->m_callbacks;
+		++monitor->m_iterations;
+
+		//the longest iteration without its wait
+		if (monitor->m_check_time != 0)
+		{
+			uint64_t iteration = now - monitor->m_check_time - (wake - monitor->m_prepare_time);
+			if (iteration > monitor->m_iteration_max)
+			{
+				monitor->m_iteration_max = iteration;
+			}
+		}
+		monitor->m_check_time = now;
+	}
+
+	void uv_loop_monitor::on_timer(uv_timer_t* handle)
+	{
+		uv_loop_monitor* monitor = (uv_loop_monitor*)handle->data;
+		uint64_t now = uv_hrtime();
+
+		uint64_t lag = now > monitor->m_due ? now - monitor->m_due : 0;
+		monitor->m_lag.record(lag / 1000);
+		monitor->m_lag_sum += lag;
+		++monitor->m_lag_count;
+		if (lag > monitor->m_lag_max)
+		{
+			monitor->m_lag_max = lag;
+		}
+
+		monitor->m_due = now + (uint64_t)monitor->m_sample * 1000000;
+		uv_timer_start(&monitor->m_timer, on_timer, monitor->m_sample, 0);
+
+		if (now - monitor->m_window_start >= monitor->m_window)
+		{
+			monitor->m_window_start = now;
+			monitor->roll();
+		}
+	}
+}
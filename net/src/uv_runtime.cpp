@@ -0,0 +1,285 @@
+#include "uv_runtime.h"
+#include "uv_loop_monitor.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace uv
+{
+	namespace
+	{
+#if defined(_MSC_VER)
+		__declspec(thread) int current_index = -1;
+#else
+		__thread int current_index = -1;
+#endif
+	}
+
+	uv_runtime::uv_runtime(const std::vector<int>& cpus /*= std::vector<int>()*/) :
+		m_started(false),
+		m_block_size(UDP_BUFFER_SIZE),
+		m_prefill(8),
+		m_max_free(64)
+	{
+		std::vector<int> list = cpus;
+		if (list.empty())
+		{
+			uv_cpu_info_t* info = nullptr;
+			int count = 0;
+			if (uv_cpu_info(&info, &count) == 0)
+			{
+				uv_free_cpu_info(info, count);
+			}
+			for (int i = 0; i < (count > 0 ? count : 1); ++i)
+			{
+				list.push_back(i);
+			}
+		}
+
+		for (size_t i = 0; i < list.size(); ++i)
+		{
+			loop_thread* t = new loop_thread();
+			t->runtime = this;
+			t->index = i;
+			t->cpu = list[i];
+			t->pinned = false;
+			t->running = false;
+			t->stopping = false;
+			t->error = 0;
+			t->pool = nullptr;
+			uv_mutex_init(&t->mutex);
+			m_loops.push_back(t);
+		}
+		uv_sem_init(&m_ready, 0);
+	}
+
+	uv_runtime::~uv_runtime()
+	{
+		stop();
+		for (size_t i = 0; i < m_loops.size(); ++i)
+		{
+			uv_mutex_destroy(&m_loops[i]->mutex);
+			delete m_loops[i];
+		}
+		m_loops.clear();
+		uv_sem_destroy(&m_ready);
+	}
+
+	void uv_runtime::set_buffer_pool(size_t block_size, size_t prefill, size_t max_free /*= 64*/)
+	{
+		m_block_size = block_size;
+		m_prefill = prefill;
+		m_max_free = max_free;
+	}
+
+	bool uv_runtime::start()
+	{
+		if (m_started)
+		{
+			return true;
+		}
+
+		for (size_t i = 0; i < m_loops.size(); ++i)
+		{
+			loop_thread* t = m_loops[i];
+			t->stopping = false;
+			t->error = 0;
+			int r = uv_thread_create(&t->thread, run_loop, t);
+			if (r != 0)
+			{
+				fprintf(stderr, "runtime thread %d: %s\n", (int)i, uv_strerror(r));
+				stop();
+				return false;
+			}
+			uv_sem_wait(&m_ready);
+
+			if (t->error != 0)
+			{
+				//the thread gave up before running its loop
+				uv_thread_join(&t->thread);
+				fprintf(stderr, "runtime loop %d: %s\n", (int)i, uv_strerror(t->error));
+				stop();
+				return false;
+			}
+			//post() may send to the async from now on
+			uv_mutex_lock(&t->mutex);
+			t->running = true;
+			uv_mutex_unlock(&t->mutex);
+		}
+
+		m_started = true;
+		return true;
+	}
+
+	void uv_runtime::stop()
+	{
+		for (size_t i = 0; i < m_loops.size(); ++i)
+		{
+			loop_thread* t = m_loops[i];
+			if (t->running)
+			{
+				uv_mutex_lock(&t->mutex);
+				t->stopping = true;
+				uv_mutex_unlock(&t->mutex);
+				uv_async_send(&t->async);
+			}
+		}
+
+		for (size_t i = 0; i < m_loops.size(); ++i)
+		{
+			loop_thread* t = m_loops[i];
+			if (t->running)
+			{
+				uv_thread_join(&t->thread);
+				t->running = false;
+			}
+		}
+		m_started = false;
+	}
+
+	bool uv_runtime::post(size_t index, task_callback callback, void* arg)
+	{
+		if (index >= m_loops.size() || callback == nullptr)
+		{
+			return false;
+		}
+
+		loop_thread* t = m_loops[index];
+		uv_mutex_lock(&t->mutex);
+		if (t->running == false || t->stopping)
+		{
+			uv_mutex_unlock(&t->mutex);
+			return false;
+		}
+		task item;
+		item.callback = callback;
+		item.arg = arg;
+		t->tasks.push_back(item);
+		uv_mutex_unlock(&t->mutex);
+
+		//several posts before the loop wakes up run in one callback
+		uv_async_send(&t->async);
+		return true;
+	}
+
+	uv_loop_t* uv_runtime::loop(size_t index) const
+	{
+		return index < m_loops.size() ? &m_loops[index]->loop : nullptr;
+	}
+
+	uv_buffer_pool* uv_runtime::buffer_pool(size_t index) const
+	{
+		return index < m_loops.size() ? m_loops[index]->pool : nullptr;
+	}
+
+	int uv_runtime::cpu(size_t index) const
+	{
+		return index < m_loops.size() ? m_loops[index]->cpu : -1;
+	}
+
+	bool uv_runtime::pinned(size_t index) const
+	{
+		return index < m_loops.size() ? m_loops[index]->pinned : false;
+	}
+
+	int uv_runtime::current()
+	{
+		return current_index;
+	}
+
+	bool uv_runtime::pin(int cpu)
+	{
+#if defined(_WIN32)
+		if (cpu < 0 || cpu >= (int)(sizeof(DWORD_PTR) * 8))
+		{
+			return false;
+		}
+		return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+		if (cpu < 0 || cpu >= CPU_SETSIZE)
+		{
+			return false;
+		}
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		//no hard affinity here, e.g. macos only takes hints
+		return false;
+#endif
+	}
+
+	void uv_runtime::run_loop(void* arg)
+	{
+		loop_thread* t = (loop_thread*)arg;
+		uv_runtime* runtime = t->runtime;
+
+		//pin before anything is allocated so the loop and pool memory is local
+		t->pinned = pin(t->cpu);
+		current_index = (int)t->index;
+
+		t->error = uv_loop_init(&t->loop);
+		if (t->error != 0)
+		{
+			current_index = -1;
+			uv_sem_post(&runtime->m_ready);
+			return;
+		}
+		t->error = uv_async_init(&t->loop, &t->async, on_async);
+		if (t->error != 0)
+		{
+			uv_loop_close(&t->loop);
+			current_index = -1;
+			uv_sem_post(&runtime->m_ready);
+			return;
+		}
+		t->async.data = t;
+
+		t->pool = new uv_buffer_pool(runtime->m_block_size, runtime->m_max_free);
+		t->pool->prefill(runtime->m_prefill);
+
+		uv_sem_post(&runtime->m_ready);
+
+		uv_run(&t->loop, UV_RUN_DEFAULT);
+
+		//handles that were closed on the way out still need their callbacks
+		uv_run(&t->loop, UV_RUN_NOWAIT);
+		if (uv_loop_close(&t->loop) != 0)
+		{
+			fprintf(stderr, "runtime loop %d closed with open handles.\n", (int)t->index);
+		}
+
+		t->pool->unref();
+		t->pool = nullptr;
+		current_index = -1;
+	}
+
+	void uv_runtime::on_async(uv_async_t* handle)
+	{
+		uv_loop_monitor::mark();
+
+		loop_thread* t = (loop_thread*)handle->data;
+
+		std::vector<task> tasks;
+		uv_mutex_lock(&t->mutex);
+		tasks.swap(t->tasks);
+		bool stopping = t->stopping;
+		uv_mutex_unlock(&t->mutex);
+
+		for (size_t i = 0; i < tasks.size(); ++i)
+		{
+			tasks[i].callback(t->runtime, t->index, tasks[i].arg);
+		}
+
+		if (stopping)
+		{
+			uv_close((uv_handle_t*)&t->async, nullptr);
+			uv_stop(&t->loop);
+		}
+	}
+}
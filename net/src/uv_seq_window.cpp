@@ -0,0 +1,315 @@
+#include "uv_seq_window.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace uv
+{
+	namespace
+	{
+		inline int32_t diff(uint32_t later, uint32_t earlier)
+		{
+			return (int32_t)(later - earlier);
+		}
+
+		//index of the lowest set bit, mask must not be 0
+		inline unsigned lowest(uint64_t mask)
+		{
+#if defined(_MSC_VER) && defined(_M_X64)
+			unsigned long index;
+			_BitScanForward64(&index, mask);
+			return (unsigned)index;
+#elif defined(__GNUC__)
+			return (unsigned)__builtin_ctzll(mask);
+#else
+			unsigned index = 0;
+			while ((mask & 1) == 0)
+			{
+				mask >>= 1;
+				++index;
+			}
+			return index;
+#endif
+		}
+	}
+
+	uv_seq_window::uv_seq_window() :
+		m_mask(0),
+		m_latest(0),
+		m_init(false),
+		m_latest_only(false),
+		m_duplicates(0),
+		m_stale(0)
+	{
+	}
+
+	int uv_seq_window::check(uint32_t seq) const
+	{
+		if (m_init == false)
+		{
+			return ACCEPT;
+		}
+
+		int32_t d = diff(seq, m_latest);
+		if (d > 0)
+		{
+			return ACCEPT;
+		}
+		if (d == 0)
+		{
+			return DUPLICATE;
+		}
+		if (m_latest_only || d <= -SIZE)
+		{
+			return STALE;
+		}
+		return (m_mask & ((uint64_t)1 << -d)) != 0 ? DUPLICATE : ACCEPT;
+	}
+
+	int uv_seq_window::update(uint32_t seq)
+	{
+		if (m_init == false)
+		{
+			m_init = true;
+			m_latest = seq;
+			m_mask = 1;
+			return ACCEPT;
+		}
+
+		int32_t d = diff(seq, m_latest);
+		if (d > 0)
+		{
+			m_mask = d < SIZE ? (m_mask << d) | 1 : 1;
+			m_latest = seq;
+			return ACCEPT;
+		}
+
+		int result = check(seq);
+		if (result == ACCEPT)
+		{
+			m_mask |= (uint64_t)1 << -d;
+		}
+		else if (result == DUPLICATE)
+		{
+			++m_duplicates;
+		}
+		else
+		{
+			++m_stale;
+		}
+		return result;
+	}
+
+	void uv_seq_window::reset()
+	{
+		m_mask = 0;
+		m_latest = 0;
+		m_init = false;
+	}
+
+	uv_seq_reorder::uv_seq_reorder(uv_loop_t* loop, size_t capacity /*= 16*/, unsigned hold /*= 50*/) :
+		m_loop(loop),
+		m_timer_init(false),
+		m_capacity(1),
+		m_mask(0),
+		m_next(0),
+		m_init(false),
+		m_hold(hold),
+		m_skipped(0),
+		m_dropped(0),
+		m_deliver_callback(nullptr),
+		m_data(nullptr)
+	{
+		while (m_capacity < capacity && m_capacity < uv_seq_window::SIZE)
+		{
+			m_capacity <<= 1;
+		}
+		m_slots.resize(m_capacity);
+	}
+
+	uv_seq_reorder::~uv_seq_reorder()
+	{
+	}
+
+	void uv_seq_reorder::close()
+	{
+		m_deliver_callback = nullptr;
+		m_mask = 0;
+		if (m_timer_init)
+		{
+			uv_timer_stop(&m_timer);
+			uv_close((uv_handle_t*)&m_timer, on_close);
+			m_timer_init = false;
+		}
+		else
+		{
+			delete this;
+		}
+	}
+
+	bool uv_seq_reorder::input(uint32_t seq, const char* data, const size_t length)
+	{
+		if (m_init == false)
+		{
+			m_init = true;
+			m_next = seq;
+		}
+
+		int32_t d = diff(seq, m_next);
+		if (d < 0)
+		{
+			++m_dropped;
+			return false;
+		}
+
+		if (d == 0)
+		{
+			deliver(seq, data, length);
+			m_mask >>= 1;
+			++m_next;
+			drain();
+			schedule();
+			return true;
+		}
+
+		//too far ahead, give up on as many gaps as it takes to fit seq in
+		if ((size_t)d >= m_capacity)
+		{
+			skip((uint32_t)d - (uint32_t)m_capacity + 1);
+			drain();
+			d = diff(seq, m_next);
+			if (d == 0)
+			{
+				deliver(seq, data, length);
+				m_mask >>= 1;
+				++m_next;
+				drain();
+				schedule();
+				return true;
+			}
+		}
+
+		uint64_t bit = (uint64_t)1 << d;
+		if (m_mask & bit)
+		{
+			++m_dropped;
+			return false;
+		}
+
+		slot& s = m_slots[seq & (m_capacity - 1)];
+		s.data.assign(data, length);
+		s.time = uv_now(m_loop);
+		m_mask |= bit;
+		schedule();
+		return true;
+	}
+
+	void uv_seq_reorder::flush()
+	{
+		while (m_mask != 0)
+		{
+			skip(lowest(m_mask));
+			drain();
+		}
+		schedule();
+	}
+
+	size_t uv_seq_reorder::held() const
+	{
+		size_t count = 0;
+		for (uint64_t mask = m_mask; mask != 0; mask &= mask - 1)
+		{
+			++count;
+		}
+		return count;
+	}
+
+	void uv_seq_reorder::deliver(uint32_t seq, const char* data, size_t length)
+	{
+		if (m_deliver_callback != nullptr)
+		{
+			m_deliver_callback(this, seq, data, length);
+		}
+	}
+
+	void uv_seq_reorder::drain()
+	{
+		while (m_mask & 1)
+		{
+			const slot& s = m_slots[m_next & (m_capacity - 1)];
+			deliver(m_next, s.data.data(), s.data.size());
+			m_mask >>= 1;
+			++m_next;
+		}
+	}
+
+	void uv_seq_reorder::skip(uint32_t count)
+	{
+		//held packets on the way still go out, only the holes count as skipped
+		while (count > 0 && m_mask != 0)
+		{
+			if (m_mask & 1)
+			{
+				const slot& s = m_slots[m_next & (m_capacity - 1)];
+				deliver(m_next, s.data.data(), s.data.size());
+			}
+			else
+			{
+				++m_skipped;
+			}
+			m_mask >>= 1;
+			++m_next;
+			--count;
+		}
+		m_skipped += count;
+		m_next += count;
+	}
+
+	void uv_seq_reorder::schedule()
+	{
+		if (m_mask == 0)
+		{
+			if (m_timer_init)
+			{
+				uv_timer_stop(&m_timer);
+			}
+			return;
+		}
+		if (m_timer_init == false)
+		{
+			int r = uv_timer_init(m_loop, &m_timer);
+			if (r != 0)
+			{
+				//the gap is only given up once the buffer runs out of room
+				fprintf(stderr, "reorder timer: %s\n", uv_strerror(r));
+				return;
+			}
+			m_timer.data = this;
+			m_timer_init = true;
+		}
+
+		//the lowest held sequence sits behind the oldest gap
+		const slot& s = m_slots[(m_next + lowest(m_mask)) & (m_capacity - 1)];
+		uint64_t now = uv_now(m_loop);
+		uint64_t deadline = s.time + m_hold;
+		uv_timer_start(&m_timer, on_timer, deadline > now ? deadline - now : 0, 0);
+	}
+
+	void uv_seq_reorder::on_timer(uv_timer_t* handle)
+	{
+		uv_seq_reorder* reorder = (uv_seq_reorder*)handle->data;
+		if (reorder->m_mask != 0)
+		{
+			reorder->skip(lowest(reorder->m_mask));
+			reorder->drain();
+		}
+		reorder->schedule();
+	}
+
+	void uv_seq_reorder::on_close(uv_handle_t* handle)
+	{
+		uv_seq_reorder* reorder = (uv_seq_reorder*)handle->data;
+		delete reorder;
+	}
+}
@@ -1,16 +1,46 @@
 #include "uv_tcp_client.h"
+#include "uv_loop_monitor.h"
 
 namespace uv
 {
 	uv_tcp_client::uv_tcp_client(uv_loop_t* loop /*= uv_default_loop()*/):
 		m_loop(loop),
-		m_init(false)
+		m_connect_callback(nullptr),
+		m_receive_callback(nullptr),
+		m_receive_view_callback(nullptr),
+		m_close_callback(nullptr),
+		m_buffer_pool(nullptr),
+		m_own_buffer_pool(nullptr),
+		m_connect_limiter(nullptr),
+		m_connect_timeout(0),
+		m_latency(nullptr),
+		m_send_head(0),
+		m_send_tail(0),
+		m_send_overflow(0),
+		m_untimed(0),
+		m_init(false),
+		m_queued(false),
+		m_admitted(false),
+		m_timed_out(false),
+		m_connect_pending(false),
+		m_connect_status(0),
+		m_closing(0),
+		m_attached(false),
+		m_defer_send(false),
+		m_data(nullptr)
 	{
 		
 	}
 	uv_tcp_client:: ~uv_tcp_client()
 	{
+		m_close_callback = nullptr;
 		close();
+		//retained buffers may still hold blocks of it
+		if (m_own_buffer_pool != nullptr)
+		{
+			m_own_buffer_pool->unref();
+		}
+		delete m_latency;
 		printf("tcp client exit.\n");
 	}
 
@@ -20,6 +50,34 @@ namespace uv
 		{
 			return true;
 		}
+
+		if (attach(ip, port) == false)
+		{
+			return false;
+		}
+		m_attached = false;
+
+		if (run() == false)
+		{
+			printf("tcp client run fail.\n");
+		}
+		
+
+		return true;
+	}
+
+	bool uv_tcp_client::attach(const char* ip, const unsigned port)
+	{
+		if (m_init)
+		{
+			return true;
+		}
+		//the handles of the last connection are still closing, they can't be initialized again yet
+		if (m_closing > 0)
+		{
+			error(UV_EBUSY);
+			return false;
+		}
 		close();
 
 		if (init() == false)
@@ -34,32 +92,46 @@ namespace uv
 			return false;
 		}
 
-		if (run() == false)
-		{
-			printf("tcp client run fail.\n");
-		}
-		
+		m_attached = true;
 
 		return true;
 	}
 
 	void uv_tcp_client::close()
 	{
+		if (m_queued)
+		{
+			m_connect_limiter->cancel(this);
+			m_queued = false;
+		}
+
+		bool was_open = m_init;
 		if (m_init)
 		{
+			//a connect in progress completes with UV_ECANCELED and gives back its slot
+			m_closing = 2;
+			uv_close((uv_handle_t*)&m_connect_timer, on_close);
 			uv_close((uv_handle_t*)&m_socket, on_close);
-			uv_loop_close(m_loop);
+			//the loop belongs to the caller when attached
+			if (m_attached == false)
+			{
+				uv_loop_close(m_loop);
+			}
 		}
 		m_init = false;
+		m_deferred.clear();
 
-		free(m_write_buffer.base);
-		free(m_read_buffer.base);
-
-		m_write_buffer.base = nullptr;
+		if (m_buffer_pool != nullptr)
+		{
+			m_buffer_pool->release(m_read_buffer.base);
+		}
 		m_read_buffer.base = nullptr;
-
-		m_write_buffer.len = 0;
 		m_read_buffer.len = 0;
+
+		if (was_open && m_close_callback != nullptr)
+		{
+			m_close_callback(this);
+		}
 	}
 
 	bool uv_tcp_client::init()
@@ -83,8 +155,25 @@ namespace uv
 
 		m_socket.data = this;
 
-		m_write_buffer = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE);
-		m_read_buffer = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE);
+		r = uv_timer_init(m_loop, &m_connect_timer);
+		if (r != 0)
+		{
+			error(r);
+			uv_close((uv_handle_t*)&m_socket, nullptr);
+			return false;
+		}
+		m_connect_timer.data = this;
+		m_timed_out = false;
+
+		if (m_buffer_pool == nullptr)
+		{
+			if (m_own_buffer_pool == nullptr)
+			{
+				m_own_buffer_pool = new uv_buffer_pool(READ_BLOCK_SIZE, 1);
+			}
+			m_buffer_pool = m_own_buffer_pool;
+		}
+		m_read_buffer = uv_buf_init(nullptr, 0);
 
 		m_init = true;
 
@@ -92,20 +181,69 @@ namespace uv
 	}
 	bool uv_tcp_client::connect(const char* ip, const unsigned port)
 	{
-		struct sockaddr_in addr;
-		int r = uv_ip4_addr(ip, port, &addr);
+		int r = uv_ip4_addr(ip, port, &m_addr);
 		if (r != 0)
 		{
 			error(r);
 			return false;
 		}
-		
+
+		if (m_connect_limiter != nullptr)
+		{
+			if (m_connect_limiter->acquire(this) == false)
+			{
+				//the limiter admits us once a slot frees up
+				m_queued = true;
+				return true;
+			}
+			m_admitted = true;
+		}
+
+		r = connect();
+		if (r != 0)
+		{
+			if (m_admitted)
+			{
+				m_admitted = false;
+				m_connect_limiter->release();
+			}
+			return false;
+		}
+		return true;
+	}
+
+	int uv_tcp_client::connect()
+	{
 		m_connect_req.data = this;
 
-		r = uv_tcp_connect(&m_connect_req, &m_socket, (const struct sockaddr*)&addr, on_connect);
+		int r = uv_tcp_connect(&m_connect_req, &m_socket, (const struct sockaddr*)&m_addr, on_connect);
 		if (r != 0)
 		{
 			error(r);
+			return r;
+		}
+
+		if (m_connect_timeout > 0)
+		{
+			uv_timer_start(&m_connect_timer, on_connect_timeout, m_connect_timeout, 0);
+		}
+		return 0;
+	}
+
+	bool uv_tcp_client::admit()
+	{
+		//the limiter already counted our slot
+		m_queued = false;
+		m_admitted = true;
+
+		int r = connect();
+		if (r != 0)
+		{
+			m_admitted = false;
+			if (m_connect_callback != nullptr)
+			{
+				m_connect_callback(this, r);
+			}
 			return false;
 		}
 		return true;
@@ -147,28 +285,127 @@ namespace uv
 
 	void uv_tcp_client::send(const char* data, const size_t length)
 	{
-		if (m_write_buffer.len < length)
+		if (m_defer_send)
 		{
-			//·ڴ
-			m_write_buffer.base = (char*)realloc(m_write_buffer.base, length);
-			m_write_buffer.len = length;
+			m_deferred.insert(m_deferred.end(), data, data + length);
 		}
-		else
+		else if (write(data, length) == false)
 		{
-			memset(m_write_buffer.base, 0, m_write_buffer.len);
+			return;
 		}
 
-		memcpy(m_write_buffer.base, data, length);
-		m_write_buffer.len = length;
+		if (m_latency != nullptr)
+		{
+			//too many outstanding, the oldest still waits for its response. stamping resumes once
+			//the untimed ones completed, so responses stay paired with their sends
+			if (m_send_overflow > 0 || m_send_head - m_send_tail == m_send_times.size())
+			{
+				++m_send_overflow;
+				++m_untimed;
+			}
+			else
+			{
+				m_send_times[m_send_head++ & (m_send_times.size() - 1)] = uv_hrtime();
+			}
+		}
+	}
 
-		int  r = uv_write(&m_write_req, (uv_stream_t*)&m_socket, &m_write_buffer, 1, on_send);
+	bool uv_tcp_client::write(const char* data, const size_t length)
+	{
+		uv_write_req* w = uv_write_req::create(data, length, this);
+		if (w == nullptr)
+		{
+			error(UV_ENOMEM);
+			return false;
+		}
+
+		int  r = uv_write(&w->req, (uv_stream_t*)&m_socket, &w->buf, 1, on_send);
 
 		if (r != 0)
 		{
+			uv_write_req::destroy(&w->req);
 			error(r);
+			return false;
+		}
+		return true;
+	}
+
+	void uv_tcp_client::set_defer_send(bool enable)
+	{
+		m_defer_send = enable;
+		if (enable == false)
+		{
+			flush();
 		}
 	}
 
+	bool uv_tcp_client::flush()
+	{
+		if (m_deferred.empty())
+		{
+			return true;
+		}
+		//still connecting
+		if (m_init == false || uv_is_writable((uv_stream_t*)&m_socket) == 0)
+		{
+			return false;
+		}
+
+		bool result = write(m_deferred.data(), m_deferred.size());
+		m_deferred.clear();
+		return result;
+	}
+
+	uv_tick_result uv_tcp_client::run_for(uint64_t budget)
+	{
+		flush();
+		uv_tick_result result = uv_run_for(m_loop, budget);
+		flush();
+
+		result.backlog = m_deferred.size();
+		if (m_init)
+		{
+			result.backlog += m_socket.write_queue_size;
+		}
+		return result;
+	}
+
+	void uv_tcp_client::enable_latency(bool enable)
+	{
+		if (enable && m_latency == nullptr)
+		{
+			m_latency = new uv_histogram();
+			m_send_times.assign(1024, 0);
+		}
+		else if (enable == false)
+		{
+			delete m_latency;
+			m_latency = nullptr;
+			m_send_times.clear();
+		}
+		m_send_head = 0;
+		m_send_tail = 0;
+		m_send_overflow = 0;
+	}
+
+	void uv_tcp_client::complete_request()
+	{
+		if (m_latency == nullptr)
+		{
+			return;
+		}
+		if (m_send_tail == m_send_head)
+		{
+			if (m_send_overflow > 0)
+			{
+				--m_send_overflow;
+			}
+			return;
+		}
+		uint64_t sent = m_send_times[m_send_tail++ & (m_send_times.size() - 1)];
+		m_latency->record((uv_hrtime() - sent) / 1000);
+	}
+
 	void uv_tcp_client::error(int status)
 	{
 		m_error = uv_strerror(status);
@@ -177,11 +414,29 @@ namespace uv
 
 	void uv_tcp_client::on_connect(uv_connect_t* req, int status)
 	{
+		uv_loop_monitor::mark();
+
 		if (req->data == nullptr)
 		{
 			return;
 		}
 		uv_tcp_client* client = (uv_tcp_client*)req->data;
+
+		if (client->m_admitted)
+		{
+			client->m_admitted = false;
+			client->m_connect_limiter->release();
+		}
+
+		//cancelled from inside the close of the socket, the handles aren't reusable until on_close
+		if (client->m_closing > 0)
+		{
+			client->m_connect_pending = true;
+			client->m_connect_status = client->m_timed_out && status == UV_ECANCELED ? UV_ETIMEDOUT : status;
+			return;
+		}
+		uv_timer_stop(&client->m_connect_timer);
+
 		if (status == 0)
 		{
 			int r = uv_read_start((uv_stream_t*)&client->m_socket, on_alloc_buffer, on_receive);
@@ -197,12 +452,23 @@ namespace uv
 
 		if (client->m_connect_callback != nullptr)
 		{
-			client->m_connect_callback(status);
+			client->m_connect_callback(client, status);
 		}
 	}
 
+	void uv_tcp_client::on_connect_timeout(uv_timer_t* handle)
+	{
+		uv_tcp_client* client = (uv_tcp_client*)handle->data;
+
+		//closing the socket cancels the connect, on_connect reports UV_ETIMEDOUT
+		client->m_timed_out = true;
+		client->close();
+	}
+
 	void uv_tcp_client::on_receive(uv_stream_t* req, ssize_t nread, const uv_buf_t* buf)
 	{
+		uv_loop_monitor::mark();
+
 		if (req->data == nullptr)
 		{
 			return;
@@ -212,9 +478,14 @@ namespace uv
 
 		if (nread > 0)
 		{
-			if (client->m_receive_callback!=nullptr)
+			if (client->m_receive_view_callback != nullptr)
+			{
+				uv_recv_view view(client->m_buffer_pool, &client->m_read_buffer, nread);
+				client->m_receive_view_callback(client, view);
+			}
+			else if (client->m_receive_callback!=nullptr)
 			{
-				client->m_receive_callback(buf->base, buf->len);
+				client->m_receive_callback(client, buf->base, nread);
 			}
 		}
 		else if (nread == 0)
@@ -241,11 +512,13 @@ namespace uv
 
 	void uv_tcp_client::on_send(uv_write_t* req, int status)
 	{
+		uv_loop_monitor::mark();
+
 		if (status < 0)
 		{
 			printf(uv_strerror(status));
 		}
-
+		uv_write_req::destroy(req);
 	}
 
 	void uv_tcp_client::on_alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
@@ -254,15 +527,33 @@ namespace uv
 
 		uv_tcp_client *client = (uv_tcp_client *)handle->data;
 
+		if (client->m_read_buffer.base == nullptr)
+		{
+			//first read or the last block was retained by a view
+			char* block = client->m_buffer_pool->acquire();
+			client->m_read_buffer = uv_buf_init(block, block != nullptr ? (unsigned int)client->m_buffer_pool->block_size() : 0);
+		}
 		*buf = client->read_buffer();
 	}
 
 	void uv_tcp_client::on_close(uv_handle_t* handle)
 	{
-		if (handle)
+		//the handles are members of the client, nothing to free here
+		uv_tcp_client* client = (uv_tcp_client*)handle->data;
+		if (--client->m_closing > 0)
 		{
-			free(handle);
+			return;
 		}
 		printf("tcp client close callback.\n");
+
+		if (client->m_connect_pending)
+		{
+			client->m_connect_pending = false;
+			client->error(client->m_connect_status);
+			if (client->m_connect_callback != nullptr)
+			{
+				client->m_connect_callback(client, client->m_connect_status);
+			}
+		}
 	}
 }
\ No newline at end of file
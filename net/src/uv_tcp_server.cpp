@@ -1,10 +1,13 @@
 #include "uv_tcp_server.h"
+#include "uv_loop_monitor.h"
 
 
 namespace uv
 {
 	uv_tcp_server::uv_tcp_server(uv_loop_t* loop /* = uv_default_loop() */):
-		m_connect_callback(nullptr),m_init(false)
+		m_connect_callback(nullptr),m_buffer_pool(nullptr),m_session_id(0),m_init(false),m_attached(false),
+		m_wheel(nullptr),m_own_wheel(nullptr),m_idle_timeout(0),m_handshake_timeout(0),m_heartbeat_interval(0),
+		m_heartbeat_callback(nullptr),m_timeout_callback(nullptr),m_executor(nullptr),m_defer_send(false)
 	{
 		m_loop = loop;
 	}
@@ -25,6 +28,45 @@ namespace uv
 	}
 
 	bool uv_tcp_server::start_ipv4(const char* ip, const unsigned port)
+	{
+		if (attach_ipv4(ip, port) == false)
+		{
+			return false;
+		}
+		m_attached = false;
+
+		LOG("tcp server starting.");
+
+		if (run() == false)
+		{
+			LOG("run tcp ipv4 server fail.");
+
+			return false;
+		}
+
+		
+
+		return true;
+	}
+
+	bool uv_tcp_server::start_ipv6(const char* ip, const unsigned port)
+	{
+		if (attach_ipv6(ip, port) == false)
+		{
+			return false;
+		}
+		m_attached = false;
+
+		if (run() == false)
+		{
+			LOG("run tcp ipv6 server fail.");
+			return false;
+		}
+
+		return true;
+	}
+
+	bool uv_tcp_server::attach_ipv4(const char* ip, const unsigned port)
 	{
 		close();
 		if (!init())
@@ -48,21 +90,12 @@ namespace uv
 			return false;
 		}
 
-		LOG("tcp server starting.");
-
-		if (run() == false)
-		{
-			LOG("run tcp ipv4 server fail.");
-
-			return false;
-		}
-
-		
+		m_attached = true;
 
 		return true;
 	}
 
-	bool uv_tcp_server::start_ipv6(const char* ip, const unsigned port)
+	bool uv_tcp_server::attach_ipv6(const char* ip, const unsigned port)
 	{
 		close();
 		if (!init())
@@ -83,11 +116,7 @@ namespace uv
 			return false;
 		}
 
-		if (run() == false)
-		{
-			LOG("run tcp ipv6 server fail.");
-			return false;
-		}
+		m_attached = true;
 
 		return true;
 	}
@@ -97,17 +126,35 @@ namespace uv
 		for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it)
 		{
 			auto c = it->second;
+			disarm(c);
 			uv_close((uv_handle_t*)c->handle(), on_client_close);
 		}
 		m_sessions.clear();
+		m_dirty.clear();
+
+		//libuv still closes the wheel's timer, it frees itself after that
+		if (m_own_wheel != nullptr)
+		{
+			m_own_wheel->destroy();
+			if (m_wheel == m_own_wheel)
+			{
+				m_wheel = nullptr;
+			}
+			m_own_wheel = nullptr;
+		}
 
 		if (m_init)
 		{
 			uv_close((uv_handle_t*)&m_server, on_close);	
-			uv_loop_close(m_loop);
+			//an attached server doesn't own the loop
+			if (m_attached == false)
+			{
+				uv_loop_close(m_loop);
+			}
 
 		}
 		m_init = false;
+		m_attached = false;
 		
 		uv_mutex_destroy(&m_mutex);
 	}
@@ -124,6 +171,7 @@ namespace uv
 		}
 
 		auto handle = it->second->handle();
+		disarm(it->second);
 
 		if (uv_is_active((uv_handle_t*)handle))
 		{
@@ -243,28 +291,86 @@ namespace uv
 			return;
 		}
 
-		auto buffer = it->second->write_buffer();
-
-		if (buffer.len < length)
+		uv_tcp_session* session = it->second;
+		if (m_defer_send)
 		{
-			//重新分配内存
-			buffer.base = (char*)realloc(buffer.base, length);
-			buffer.len = length;
+			if (session->m_deferred.empty())
+			{
+				m_dirty.push_back(sessionId);
+			}
+			session->m_deferred.insert(session->m_deferred.end(), data, data + length);
+			return;
 		}
-		else
+		write(session, data, length);
+	}
+
+	bool uv_tcp_server::write(uv_tcp_session* session, const char* data, const size_t length)
+	{
+		uv_write_req* w = uv_write_req::create(data, length, session);
+		if (w == nullptr)
 		{
-			memset(buffer.base, 0, buffer.len);
+			error(UV_ENOMEM);
+			return false;
 		}
-
-		memcpy(buffer.base, data, length);
-		buffer.len = length;
 	
-		int  r = uv_write(&it->second->req(), (uv_stream_t*)it->second->handle(), &buffer, 1, on_send);
+		int  r = uv_write(&w->req, (uv_stream_t*)session->handle(), &w->buf, 1, on_send);
 
 		if (r != 0)
 		{
+			uv_write_req::destroy(&w->req);
 			error(r);
+			return false;
 		}
+		return true;
+	}
+
+	void uv_tcp_server::set_defer_send(bool enable)
+	{
+		m_defer_send = enable;
+		if (enable == false)
+		{
+			flush();
+		}
+	}
+
+	size_t uv_tcp_server::flush()
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < m_dirty.size(); ++i)
+		{
+			//closed since, its queue went with it
+			auto it = m_sessions.find(m_dirty[i]);
+			if (it == m_sessions.end())
+			{
+				continue;
+			}
+
+			uv_tcp_session* session = it->second;
+			if (session->m_deferred.empty() == false)
+			{
+				if (write(session, session->m_deferred.data(), session->m_deferred.size()))
+				{
+					++count;
+				}
+				session->m_deferred.clear();
+			}
+		}
+		m_dirty.clear();
+		return count;
+	}
+
+	uv_tick_result uv_tcp_server::run_for(uint64_t budget)
+	{
+		//what the simulation sent since the last tick goes out before the poll
+		flush();
+		uv_tick_result result = uv_run_for(m_loop, budget);
+		flush();
+
+		for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it)
+		{
+			result.backlog += it->second->handle()->write_queue_size;
+		}
+		return result;
 	}
 
 	void uv_tcp_server::set_connect_callback(connect_callback callback)
@@ -308,6 +414,8 @@ namespace uv
 
 	void uv_tcp_server::on_receive(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf)
 	{
+		uv_loop_monitor::mark();
+
 		if (client->data == nullptr)
 		{
 			return;
@@ -317,6 +425,11 @@ namespace uv
 
 		if (nread > 0)
 		{
+			//the handshake timeout keeps running until the session is established
+			if (session->established())
+			{
+				session->server()->touch(session);
+			}
 			session->on_receive(buf->base, nread);
 		}
 		else if(nread == 0)
@@ -345,11 +458,13 @@ namespace uv
 
 	void uv_tcp_server::on_send(uv_write_t* req, int status)
 	{
+		uv_loop_monitor::mark();
+
 		if (status < 0)
 		{
 			printf(uv_strerror(status));
 		}
-		
+		uv_write_req::destroy(req);
 	}
 
 	void uv_tcp_server::on_alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
@@ -362,9 +477,9 @@ namespace uv
 	
 	}
 
-	void uv_tcp_server::on_close(uv_handle_t* handle) 
+	void uv_tcp_server::on_close(uv_handle_t* /*handle*/) 
 	{
-		free(handle);
+		//the server handle is a member, nothing to free here
 		LOG("tcp server close callback.\n");
 	}
 
@@ -373,17 +488,17 @@ namespace uv
 		uv_tcp_session* session = (uv_tcp_session*)handle->data;
 
 		
-		char* msg = "";
-		sprintf(msg, "client %d close callback.", session->id());
-		LOG(msg);
+		printf("client %d close callback.\n", session->id());
 
-		delete session;
+		session->release();
 	}
 
 	
 
 	void uv_tcp_server::on_accept(uv_stream_t* server, int status)
 	{
+		uv_loop_monitor::mark();
+
 		if (status != 0)
 		{
 			printf(uv_strerror(status));
@@ -407,11 +522,10 @@ namespace uv
 			return;
 		}
 
-		static int sessionId = 0;
-
-		++sessionId;
+		//per server, servers on other loop threads count on their own
+		int sessionId = ++tcp->m_session_id;
 
-		uv_tcp_session* session = new uv_tcp_session(sessionId, tcp);
+		uv_tcp_session* session = new uv_tcp_session(sessionId, tcp, tcp->m_buffer_pool);
 
 		session->server(tcp);
 	
@@ -437,6 +551,7 @@ namespace uv
 		}
 
 		tcp->m_sessions.insert(std::make_pair(sessionId, session));
+		tcp->arm(session);
 		if (tcp->m_connect_callback != nullptr)
 		{
 			tcp->m_connect_callback(session);
@@ -449,6 +564,103 @@ namespace uv
 		}
 	}
 
+	void uv_tcp_server::set_heartbeat(unsigned interval, heartbeat_callback callback)
+	{
+		m_heartbeat_interval = interval;
+		m_heartbeat_callback = callback;
+	}
+
+	void uv_tcp_server::touch(uv_tcp_session* session)
+	{
+		if (m_wheel == nullptr || session->m_closed)
+		{
+			return;
+		}
+		if (m_idle_timeout > 0)
+		{
+			m_wheel->schedule(&session->m_timeout_node, m_idle_timeout);
+		}
+		else if (session->m_established)
+		{
+			//the handshake timeout is done and there is no idle timeout to take over
+			m_wheel->cancel(&session->m_timeout_node);
+		}
+	}
+
+	void uv_tcp_server::arm(uv_tcp_session* session)
+	{
+		if (m_handshake_timeout == 0)
+		{
+			session->m_established = true;
+		}
+		if (m_idle_timeout == 0 && m_handshake_timeout == 0 && m_heartbeat_interval == 0)
+		{
+			return;
+		}
+		if (m_wheel == nullptr)
+		{
+			m_wheel = m_own_wheel = new uv_timer_wheel(m_loop);
+		}
+
+		session->m_timeout_node.callback = on_session_timeout;
+		session->m_heartbeat_node.callback = on_session_heartbeat;
+		if (m_handshake_timeout > 0)
+		{
+			m_wheel->schedule(&session->m_timeout_node, m_handshake_timeout);
+		}
+		else if (m_idle_timeout > 0)
+		{
+			m_wheel->schedule(&session->m_timeout_node, m_idle_timeout);
+		}
+		if (m_heartbeat_interval > 0)
+		{
+			m_wheel->schedule(&session->m_heartbeat_node, m_heartbeat_interval);
+		}
+	}
+
+	void uv_tcp_server::disarm(uv_tcp_session* session)
+	{
+		if (m_wheel != nullptr)
+		{
+			m_wheel->cancel(&session->m_timeout_node);
+			m_wheel->cancel(&session->m_heartbeat_node);
+		}
+	}
+
+	void uv_tcp_server::on_session_timeout(uv_timer_node* node)
+	{
+		uv_tcp_session* session = (uv_tcp_session*)node->data;
+		uv_tcp_server* server = session->server();
+		if (server == nullptr)
+		{
+			return;
+		}
+
+		int reason = session->established() ? uv_tcp_session::TIMEOUT_IDLE : uv_tcp_session::TIMEOUT_HANDSHAKE;
+		if (server->m_timeout_callback != nullptr)
+		{
+			server->m_timeout_callback(session, reason);
+		}
+		fprintf(stdout, "client %d timed out, close it.\n", session->id());
+		server->close(session->id());
+	}
+
+	void uv_tcp_server::on_session_heartbeat(uv_timer_node* node)
+	{
+		uv_tcp_session* session = (uv_tcp_session*)node->data;
+		uv_tcp_server* server = session->server();
+		if (server == nullptr)
+		{
+			return;
+		}
+
+		server->m_wheel->schedule(node, server->m_heartbeat_interval);
+		if (server->m_heartbeat_callback != nullptr)
+		{
+			server->m_heartbeat_callback(session);
+		}
+	}
+
 	const uv_tcp_session* uv_tcp_server::session(int sessionId) const
 	{
 		auto it = m_sessions.find(sessionId);
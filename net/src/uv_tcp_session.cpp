@@ -1,30 +1,52 @@
 #include "uv_tcp_session.h"
+#include "uv_loop_monitor.h"
 
 namespace uv
 {
-	uv_tcp_session::uv_tcp_session(int id, uv_tcp_server* server) :
+	uv_tcp_session::uv_tcp_session(int id, uv_tcp_server* server, uv_buffer_pool* pool /*= nullptr*/) :
 		m_id(id),
 		m_server(server),
-		m_receive_callback(nullptr)
+		m_buffer_pool(pool),
+		m_receive_callback(nullptr),
+		m_close_callback(nullptr),
+		m_data(nullptr),
+		m_pending(0),
+		m_closed(false),
+		m_established(false),
+		m_serial(nullptr)
 	{
+		m_timeout_node.data = this;
+		m_heartbeat_node.data = this;
 		m_handle = (uv_tcp_t*)malloc(sizeof(uv_tcp_t));
 		m_handle->data = this;
-		m_read_buffer = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE);
-		m_write_buffer = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE);
-
+		if (m_buffer_pool != nullptr)
+		{
+			m_read_buffer = uv_buf_init(m_buffer_pool->acquire(), (unsigned int)m_buffer_pool->block_size());
+		}
+		else
+		{
+			m_read_buffer = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE);
+		}
 	}
 	uv_tcp_session::~uv_tcp_session()
 	{
-		free(m_read_buffer.base);
-		free(m_write_buffer.base);
+		if (m_buffer_pool != nullptr)
+		{
+			m_buffer_pool->release(m_read_buffer.base);
+		}
+		else
+		{
+			free(m_read_buffer.base);
+		}
 
 		m_read_buffer.base = nullptr;
-		m_write_buffer.base = nullptr;
 		m_read_buffer.len = 0;
-		m_write_buffer.len = 0;
 
 		free(m_handle);
 		m_handle = nullptr;
+
+		delete m_serial;
+		m_serial = nullptr;
 	}
 	void uv_tcp_session::on_receive(const char* buf, size_t length)
 	{
@@ -42,4 +64,117 @@ namespace uv
 		}
 		m_server->send(m_id, data, length);
 	}
+
+	void uv_tcp_session::set_established()
+	{
+		if (m_established)
+		{
+			return;
+		}
+		m_established = true;
+		if (m_server != nullptr)
+		{
+			m_server->touch(this);
+		}
+	}
+
+	bool uv_tcp_session::defer(work_callback work, completion_callback completion, void* arg /*= nullptr*/)
+	{
+		if (work == nullptr || m_closed)
+		{
+			return false;
+		}
+
+		defer_req* d = new defer_req();
+		d->req.data = d;
+		d->session = this;
+		d->work = work;
+		d->completion = completion;
+		d->arg = arg;
+
+		uv_executor_port* port = m_server != nullptr ? m_server->executor() : nullptr;
+		if (port != nullptr)
+		{
+			if (m_serial == nullptr)
+			{
+				m_serial = new uv_serial_queue(port);
+			}
+			if (m_serial->submit(on_executor_work, on_executor_done, d) == false)
+			{
+				fprintf(stderr, "session %d defer: executor not running\n", m_id);
+				delete d;
+				return false;
+			}
+			++m_pending;
+			return true;
+		}
+
+		int r = uv_queue_work(m_handle->loop, &d->req, on_work, on_after_work);
+		if (r != 0)
+		{
+			fprintf(stderr, "session %d defer: %s\n", m_id, uv_strerror(r));
+			delete d;
+			return false;
+		}
+		++m_pending;
+		return true;
+	}
+
+	void uv_tcp_session::release()
+	{
+		if (m_close_callback != nullptr)
+		{
+			m_close_callback(this);
+		}
+		m_closed = true;
+		m_server = nullptr;
+		if (m_pending == 0)
+		{
+			delete this;
+		}
+	}
+
+	void uv_tcp_session::on_work(uv_work_t* req)
+	{
+		defer_req* d = (defer_req*)req->data;
+		d->work(d->arg);
+	}
+
+	void uv_tcp_session::on_after_work(uv_work_t* req, int status)
+	{
+		uv_loop_monitor::mark();
+
+		complete((defer_req*)req->data, status);
+	}
+
+	void uv_tcp_session::on_executor_work(void* arg)
+	{
+		defer_req* d = (defer_req*)arg;
+		d->work(d->arg);
+	}
+
+	void uv_tcp_session::on_executor_done(void* arg, int status)
+	{
+		complete((defer_req*)arg, status);
+	}
+
+	void uv_tcp_session::complete(defer_req* d, int status)
+	{
+		uv_tcp_session* session = d->session;
+
+		if (session->m_closed && status == 0)
+		{
+			status = UV_ECANCELED;
+		}
+		if (d->completion != nullptr)
+		{
+			d->completion(session, d->arg, status);
+		}
+		delete d;
+
+		if (--session->m_pending == 0 && session->m_closed)
+		{
+			delete session;
+		}
+	}
 }
\ No newline at end of file
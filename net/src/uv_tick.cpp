@@ -0,0 +1,46 @@
+#include "uv_tick.h"
+#include "uv_loop_monitor.h"
+
+namespace uv
+{
+	uv_tick_result uv_run_for(uv_loop_t* loop, uint64_t budget)
+	{
+		uv_tick_result result;
+		result.elapsed = 0;
+		result.iterations = 0;
+		result.callbacks = 0;
+		result.exhausted = false;
+		result.alive = false;
+		result.backlog = 0;
+
+		uint64_t start = uv_hrtime();
+		uint64_t deadline = start + budget * 1000;
+		uint64_t now = start;
+		int more = 1;
+
+		while (more != 0)
+		{
+			uint64_t before = uv_loop_monitor::dispatched();
+			more = uv_run(loop, UV_RUN_NOWAIT);
+			++result.iterations;
+			uint64_t ran = uv_loop_monitor::dispatched() - before;
+			result.callbacks += ran;
+			now = uv_hrtime();
+
+			//nothing was ready, polling again before the next tick finds nothing either
+			if (ran == 0)
+			{
+				break;
+			}
+			if (now >= deadline)
+			{
+				result.exhausted = true;
+				break;
+			}
+		}
+
+		result.elapsed = (now - start) / 1000;
+		result.alive = uv_loop_alive(loop) != 0;
+		return result;
+	}
+}
@@ -0,0 +1,259 @@
+#include "uv_timer_wheel.h"
+
+namespace uv
+{
+	uv_timer_wheel::uv_timer_wheel(uv_loop_t* loop, unsigned tick /*= 100*/) :
+		m_loop(loop),
+		m_init(false),
+		m_running(false),
+		m_tick(tick > 0 ? tick : 1),
+		m_current(0),
+		m_count(0)
+	{
+		for (unsigned l = 0; l < LEVELS; ++l)
+		{
+			for (unsigned i = 0; i < SLOTS; ++i)
+			{
+				m_slots[l][i].prev = &m_slots[l][i];
+				m_slots[l][i].next = &m_slots[l][i];
+			}
+		}
+	}
+
+	uv_timer_wheel::~uv_timer_wheel()
+	{
+		close();
+	}
+
+	bool uv_timer_wheel::schedule(uv_timer_node* node, uint64_t timeout)
+	{
+		if (node == nullptr)
+		{
+			return false;
+		}
+
+		if (m_init == false)
+		{
+			int r = uv_timer_init(m_loop, &m_timer);
+			if (r != 0)
+			{
+				fprintf(stderr, "timer wheel: %s\n", uv_strerror(r));
+				return false;
+			}
+			m_timer.data = this;
+			//the sessions keep the loop alive, not their timeouts
+			uv_unref((uv_handle_t*)&m_timer);
+			m_init = true;
+		}
+
+		cancel(node);
+
+		uint64_t now = uv_now(m_loop);
+		if (m_count == 0)
+		{
+			//every slot is empty, the wheel can jump to now
+			m_current = now / m_tick;
+		}
+		node->expire = (now + timeout + m_tick - 1) / m_tick;
+		add(node);
+		++m_count;
+
+		if (m_running == false)
+		{
+			uv_timer_start(&m_timer, on_timer, m_tick, m_tick);
+			m_running = true;
+		}
+		return true;
+	}
+
+	void uv_timer_wheel::cancel(uv_timer_node* node)
+	{
+		if (node != nullptr && node->pending())
+		{
+			unlink(node);
+			--m_count;
+		}
+	}
+
+	void uv_timer_wheel::close()
+	{
+		clear();
+
+		if (m_init)
+		{
+			uv_timer_stop(&m_timer);
+			uv_close((uv_handle_t*)&m_timer, nullptr);
+			m_init = false;
+			m_running = false;
+		}
+	}
+
+	void uv_timer_wheel::destroy()
+	{
+		clear();
+
+		if (m_init == false)
+		{
+			delete this;
+			return;
+		}
+		uv_timer_stop(&m_timer);
+		uv_close((uv_handle_t*)&m_timer, on_close);
+		m_init = false;
+		m_running = false;
+	}
+
+	void uv_timer_wheel::on_close(uv_handle_t* handle)
+	{
+		uv_timer_wheel* wheel = (uv_timer_wheel*)handle->data;
+		delete wheel;
+	}
+
+	void uv_timer_wheel::clear()
+	{
+		for (unsigned l = 0; l < LEVELS; ++l)
+		{
+			for (unsigned i = 0; i < SLOTS; ++i)
+			{
+				uv_timer_node* head = &m_slots[l][i];
+				while (head->next != head)
+				{
+					unlink(head->next);
+				}
+			}
+		}
+		m_count = 0;
+	}
+
+	void uv_timer_wheel::add(uv_timer_node* node)
+	{
+		int64_t delta = (int64_t)(node->expire - m_current);
+		uv_timer_node* head;
+		if (delta < 0)
+		{
+			//already due, the next tick runs it
+			head = &m_slots[0][m_current & (SLOTS - 1)];
+		}
+		else
+		{
+			unsigned level = 0;
+			while (level < LEVELS - 1 && (uint64_t)delta >= ((uint64_t)1 << (SLOT_BITS * (level + 1))))
+			{
+				++level;
+			}
+			uint64_t expire = node->expire;
+			if ((uint64_t)delta >= ((uint64_t)1 << (SLOT_BITS * LEVELS)))
+			{
+				//past the last level, park it as far out as it goes and let cascading bring it back
+				expire = m_current + ((uint64_t)1 << (SLOT_BITS * LEVELS)) - 1;
+			}
+			head = &m_slots[level][(expire >> (SLOT_BITS * level)) & (SLOTS - 1)];
+		}
+		link(head, node);
+	}
+
+	void uv_timer_wheel::cascade(unsigned level, unsigned index)
+	{
+		uv_timer_node* head = &m_slots[level][index];
+		uv_timer_node list;
+		if (head->next == head)
+		{
+			return;
+		}
+
+		//move the whole slot out first, add may put nodes back on this level
+		list.next = head->next;
+		list.prev = head->prev;
+		list.next->prev = &list;
+		list.prev->next = &list;
+		head->next = head;
+		head->prev = head;
+
+		while (list.next != &list)
+		{
+			uv_timer_node* node = list.next;
+			unlink(node);
+			add(node);
+		}
+	}
+
+	void uv_timer_wheel::advance(uint64_t target)
+	{
+		while (m_current <= target && m_count > 0)
+		{
+			unsigned index = (unsigned)(m_current & (SLOTS - 1));
+			if (index == 0)
+			{
+				for (unsigned l = 1; l < LEVELS; ++l)
+				{
+					unsigned i = (unsigned)((m_current >> (SLOT_BITS * l)) & (SLOTS - 1));
+					cascade(l, i);
+					if (i != 0)
+					{
+						break;
+					}
+				}
+			}
+
+			uv_timer_node* head = &m_slots[0][index];
+			uv_timer_node list;
+			list.next = &list;
+			list.prev = &list;
+			if (head->next != head)
+			{
+				list.next = head->next;
+				list.prev = head->prev;
+				list.next->prev = &list;
+				list.prev->next = &list;
+				head->next = head;
+				head->prev = head;
+			}
+			//callbacks that schedule again with no delay land on the next tick
+			++m_current;
+
+			while (list.next != &list)
+			{
+				uv_timer_node* node = list.next;
+				unlink(node);
+				--m_count;
+				if (node->callback != nullptr)
+				{
+					node->callback(node);
+				}
+			}
+		}
+
+		if (m_count == 0)
+		{
+			m_current = target + 1;
+		}
+	}
+
+	void uv_timer_wheel::link(uv_timer_node* head, uv_timer_node* node)
+	{
+		node->prev = head->prev;
+		node->next = head;
+		head->prev->next = node;
+		head->prev = node;
+	}
+
+	void uv_timer_wheel::unlink(uv_timer_node* node)
+	{
+		node->prev->next = node->next;
+		node->next->prev = node->prev;
+		node->prev = nullptr;
+		node->next = nullptr;
+	}
+
+	void uv_timer_wheel::on_timer(uv_timer_t* handle)
+	{
+		uv_timer_wheel* wheel = (uv_timer_wheel*)handle->data;
+		wheel->advance(uv_now(wheel->m_loop) / wheel->m_tick);
+
+		if (wheel->m_count == 0 && wheel->m_running)
+		{
+			uv_timer_stop(&wheel->m_timer);
+			wheel->m_running = false;
+		}
+	}
+}
@@ -0,0 +1,518 @@
+#include "uv_udp_batch.h"
+#include "uv_loop_monitor.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef UV_UDP_HAVE_MMSG
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif // UV_UDP_HAVE_MMSG
+
+namespace uv
+{
+#ifdef UV_UDP_HAVE_MMSG
+	struct uv_udp_batch_headers
+	{
+		struct mmsghdr			msgs[uv_udp_batch::MAX_BATCH];
+		struct iovec			iovs[uv_udp_batch::MAX_BATCH];
+		struct sockaddr_storage	addrs[uv_udp_batch::MAX_BATCH];
+		struct sockaddr_storage	locals[uv_udp_batch::MAX_BATCH];
+		char					controls[uv_udp_batch::MAX_BATCH][128];
+	};
+
+	//kernel limits for one gso send
+	static const size_t UDP_MAX_SEGMENTS = 64;
+	static const size_t UDP_MAX_PAYLOAD = 65507;
+#endif // UV_UDP_HAVE_MMSG
+
+	static size_t address_length(const struct sockaddr* addr)
+	{
+		return addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+	}
+
+	bool uv_udp_batch::supported()
+	{
+#ifdef UV_UDP_HAVE_MMSG
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	uv_udp_batch::uv_udp_batch(uv_udp_client* client) :
+		m_client(client),
+		m_callback(nullptr),
+		m_fd(-1),
+		m_count(0),
+		m_slot_size(0),
+		m_slots(nullptr),
+		m_headers(nullptr),
+		m_send_headers(nullptr),
+		m_events(0),
+		m_error(0),
+		m_send_error(0),
+		m_open(false),
+		m_receiving(false),
+		m_gso(supported()),
+		m_gro(false),
+		m_pktinfo(false)
+	{
+	}
+
+	uv_udp_batch::~uv_udp_batch()
+	{
+#ifdef UV_UDP_HAVE_MMSG
+		if (m_fd >= 0)
+		{
+			::close(m_fd);
+		}
+		delete (uv_udp_batch_headers*)m_headers;
+		delete (uv_udp_batch_headers*)m_send_headers;
+#endif // UV_UDP_HAVE_MMSG
+		free(m_slots);
+	}
+
+	bool uv_udp_batch::open(uv_loop_t* loop, uv_os_fd_t fd)
+	{
+#ifdef UV_UDP_HAVE_MMSG
+		m_fd = dup(fd);
+		if (m_fd < 0)
+		{
+			m_error = -errno;
+			return false;
+		}
+
+		int r = uv_poll_init(loop, &m_poll, m_fd);
+		if (r != 0)
+		{
+			m_error = r;
+			return false;
+		}
+		m_poll.data = this;
+		m_open = true;
+		return true;
+#else
+		m_error = UV_ENOSYS;
+		return false;
+#endif // UV_UDP_HAVE_MMSG
+	}
+
+	bool uv_udp_batch::start_receive(receive_batch_callback callback, size_t count, size_t slot_size)
+	{
+#ifdef UV_UDP_HAVE_MMSG
+		if (count < 1 || count > MAX_BATCH)
+		{
+			count = MAX_BATCH;
+		}
+		m_callback = callback;
+		m_count = count;
+		m_slot_size = slot_size;
+
+		m_slots = (char*)malloc(m_count * m_slot_size);
+		if (m_slots == nullptr)
+		{
+			m_error = UV_ENOMEM;
+			return false;
+		}
+
+		uv_udp_batch_headers* headers = new uv_udp_batch_headers();
+		m_headers = headers;
+		for (size_t i = 0; i < m_count; ++i)
+		{
+			headers->iovs[i].iov_base = m_slots + i * m_slot_size;
+			headers->iovs[i].iov_len = m_slot_size;
+			headers->msgs[i].msg_hdr.msg_iov = &headers->iovs[i];
+			headers->msgs[i].msg_hdr.msg_iovlen = 1;
+			headers->msgs[i].msg_hdr.msg_name = &headers->addrs[i];
+		}
+
+		m_receiving = true;
+		return update() == 0;
+#else
+		m_error = UV_ENOSYS;
+		return false;
+#endif // UV_UDP_HAVE_MMSG
+	}
+
+	size_t uv_udp_batch::send(const uv_udp_datagram* datagrams, size_t count)
+	{
+		size_t failed = 0;
+		size_t sent = 0;
+
+		//keep the order of what is already waiting
+		if (m_backlog.empty())
+		{
+			sent = send_now(datagrams, count, failed);
+		}
+
+		for (size_t i = sent + failed; i < count; ++i)
+		{
+			queued_datagram queued;
+			memset(&queued.addr, 0, sizeof(queued.addr));
+			memcpy(&queued.addr, datagrams[i].addr, address_length(datagrams[i].addr));
+			queued.data.assign(datagrams[i].data, datagrams[i].data + datagrams[i].length);
+			m_backlog.push_back(std::move(queued));
+		}
+
+		update();
+		return count - failed;
+	}
+
+	size_t uv_udp_batch::send_now(const uv_udp_datagram* datagrams, size_t count, size_t& failed)
+	{
+#ifdef UV_UDP_HAVE_MMSG
+		uv_udp_batch_headers* headers = (uv_udp_batch_headers*)m_send_headers;
+		if (headers == nullptr)
+		{
+			headers = new uv_udp_batch_headers();
+			m_send_headers = headers;
+		}
+
+		//sent and failed datagrams always form a prefix of the array
+		size_t next = 0;
+		size_t sent = 0;
+		while (next < count)
+		{
+			size_t chunk = count - next < (size_t)MAX_BATCH ? count - next : (size_t)MAX_BATCH;
+			for (size_t i = 0; i < chunk; ++i)
+			{
+				const uv_udp_datagram& datagram = datagrams[next + i];
+				headers->iovs[i].iov_base = (void*)datagram.data;
+				headers->iovs[i].iov_len = datagram.length;
+
+				struct msghdr& hdr = headers->msgs[i].msg_hdr;
+				memset(&hdr, 0, sizeof(hdr));
+				hdr.msg_name = (void*)datagram.addr;
+				hdr.msg_namelen = (socklen_t)address_length(datagram.addr);
+				hdr.msg_iov = &headers->iovs[i];
+				hdr.msg_iovlen = 1;
+			}
+
+			int n;
+			do
+			{
+				n = sendmmsg(m_fd, headers->msgs, (unsigned int)chunk, MSG_DONTWAIT);
+			} while (n < 0 && errno == EINTR);
+
+			if (n < 0)
+			{
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+				{
+					//socket buffer is full, the rest waits for writable
+					break;
+				}
+				//the first datagram of the chunk was refused, drop it and retry the others
+				m_send_error = -errno;
+				++failed;
+				++next;
+				continue;
+			}
+			next += (size_t)n;
+			sent += (size_t)n;
+			m_send_error = 0;
+		}
+		return sent;
+#else
+		failed = count;
+		return 0;
+#endif // UV_UDP_HAVE_MMSG
+	}
+
+	size_t uv_udp_batch::send_segmented(const struct sockaddr* addr, const char* data, size_t length, size_t segment_size)
+	{
+#ifdef UV_UDP_HAVE_MMSG
+		//queued datagrams go first, and a single segment needs no offload
+		if (m_gso == false || m_backlog.empty() == false || segment_size == 0 || length <= segment_size)
+		{
+			return 0;
+		}
+
+		size_t per_call = UDP_MAX_PAYLOAD / segment_size;
+		if (per_call > UDP_MAX_SEGMENTS)
+		{
+			per_call = UDP_MAX_SEGMENTS;
+		}
+
+		char control[CMSG_SPACE(sizeof(uint16_t))];
+		size_t done = 0;
+		while (length - done > segment_size)
+		{
+			size_t chunk = length - done;
+			if (chunk > per_call * segment_size)
+			{
+				chunk = per_call * segment_size;
+			}
+
+			struct iovec iov;
+			iov.iov_base = (void*)(data + done);
+			iov.iov_len = chunk;
+
+			struct msghdr hdr;
+			memset(&hdr, 0, sizeof(hdr));
+			memset(control, 0, sizeof(control));
+			hdr.msg_name = (void*)addr;
+			hdr.msg_namelen = (socklen_t)address_length(addr);
+			hdr.msg_iov = &iov;
+			hdr.msg_iovlen = 1;
+			hdr.msg_control = control;
+			hdr.msg_controllen = sizeof(control);
+
+			struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t size = (uint16_t)segment_size;
+			memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+
+			ssize_t n;
+			do
+			{
+				n = sendmsg(m_fd, &hdr, MSG_DONTWAIT);
+			} while (n < 0 && errno == EINTR);
+
+			if (n < 0)
+			{
+				if (errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP)
+				{
+					//the route or kernel can't segment, stop trying
+					m_gso = false;
+				}
+				else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+				{
+					m_send_error = -errno;
+				}
+				break;
+			}
+			done += chunk;
+			m_send_error = 0;
+		}
+		return done;
+#else
+		return 0;
+#endif // UV_UDP_HAVE_MMSG
+	}
+
+	bool uv_udp_batch::set_gro(bool enable)
+	{
+#ifdef UV_UDP_HAVE_MMSG
+		int value = enable ? 1 : 0;
+		if (setsockopt(m_fd, SOL_UDP, UDP_GRO, &value, sizeof(value)) != 0)
+		{
+			m_error = -errno;
+			return false;
+		}
+		m_gro = enable;
+		return true;
+#else
+		m_error = UV_ENOSYS;
+		return false;
+#endif // UV_UDP_HAVE_MMSG
+	}
+
+	bool uv_udp_batch::set_pktinfo(bool enable)
+	{
+#ifdef UV_UDP_HAVE_MMSG
+		//the socket is one family or dual stack, one of the two is enough
+		int value = enable ? 1 : 0;
+		bool v4 = setsockopt(m_fd, IPPROTO_IP, IP_PKTINFO, &value, sizeof(value)) == 0;
+		bool v6 = setsockopt(m_fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &value, sizeof(value)) == 0;
+		if (v4 == false && v6 == false)
+		{
+			m_error = -errno;
+			return false;
+		}
+		m_pktinfo = enable;
+		return true;
+#else
+		m_error = UV_ENOSYS;
+		return false;
+#endif // UV_UDP_HAVE_MMSG
+	}
+
+	void uv_udp_batch::flush()
+	{
+		uv_udp_datagram datagrams[MAX_BATCH];
+
+		while (m_backlog.empty() == false)
+		{
+			size_t chunk = m_backlog.size() < (size_t)MAX_BATCH ? m_backlog.size() : (size_t)MAX_BATCH;
+			for (size_t i = 0; i < chunk; ++i)
+			{
+				queued_datagram& queued = m_backlog[i];
+				datagrams[i].addr = (const struct sockaddr*)&queued.addr;
+				datagrams[i].data = queued.data.data();
+				datagrams[i].length = queued.data.size();
+			}
+
+			size_t failed = 0;
+			size_t sent = send_now(datagrams, chunk, failed);
+			m_backlog.erase(m_backlog.begin(), m_backlog.begin() + (sent + failed));
+			if (sent + failed < chunk)
+			{
+				break;
+			}
+		}
+		update();
+	}
+
+	int uv_udp_batch::update()
+	{
+		if (m_open == false)
+		{
+			return 0;
+		}
+
+		int events = (m_receiving ? UV_READABLE : 0) | (m_backlog.empty() ? 0 : UV_WRITABLE);
+		if (events == m_events)
+		{
+			return 0;
+		}
+		m_events = events;
+
+		int r = events != 0 ? uv_poll_start(&m_poll, events, on_poll) : uv_poll_stop(&m_poll);
+		if (r != 0)
+		{
+			m_error = r;
+		}
+		return r;
+	}
+
+	void uv_udp_batch::close()
+	{
+		m_backlog.clear();
+		if (m_open)
+		{
+			m_open = false;
+			uv_close((uv_handle_t*)&m_poll, on_close);
+		}
+		else
+		{
+			delete this;
+		}
+	}
+
+	void uv_udp_batch::receive()
+	{
+#ifdef UV_UDP_HAVE_MMSG
+		uv_udp_batch_headers* headers = (uv_udp_batch_headers*)m_headers;
+
+		//bounded like libuv's own read loop so one busy socket can't starve the loop
+		for (int round = 0; round < 16 && m_open; ++round)
+		{
+			for (size_t i = 0; i < m_count; ++i)
+			{
+				struct msghdr& hdr = headers->msgs[i].msg_hdr;
+				hdr.msg_namelen = sizeof(headers->addrs[i]);
+				hdr.msg_flags = 0;
+				bool control = m_gro || m_pktinfo;
+				hdr.msg_control = control ? headers->controls[i] : nullptr;
+				hdr.msg_controllen = control ? sizeof(headers->controls[i]) : 0;
+			}
+
+			int n;
+			do
+			{
+				n = recvmmsg(m_fd, headers->msgs, (unsigned int)m_count, MSG_DONTWAIT, nullptr);
+			} while (n < 0 && errno == EINTR);
+
+			if (n <= 0)
+			{
+				if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+				{
+					m_error = -errno;
+				}
+				return;
+			}
+
+			for (int i = 0; i < n; ++i)
+			{
+				uv_udp_message& message = m_messages[i];
+				message.data = m_slots + i * m_slot_size;
+				message.length = headers->msgs[i].msg_len;
+				message.addr = (const struct sockaddr*)&headers->addrs[i];
+				message.flags = (headers->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? UV_UDP_PARTIAL : 0;
+				message.segment_size = 0;
+				message.local = nullptr;
+
+				struct msghdr& hdr = headers->msgs[i].msg_hdr;
+				for (struct cmsghdr* cmsg = hdr.msg_control != nullptr ? CMSG_FIRSTHDR(&hdr) : nullptr; cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+				{
+					if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+					{
+						int size;
+						memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+						message.segment_size = (size_t)size;
+					}
+					else if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+					{
+						struct in_pktinfo info;
+						memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+						struct sockaddr_in* local = (struct sockaddr_in*)&headers->locals[i];
+						memset(local, 0, sizeof(*local));
+						local->sin_family = AF_INET;
+						local->sin_addr = info.ipi_addr;
+						message.local = (const struct sockaddr*)local;
+					}
+					else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO)
+					{
+						struct in6_pktinfo info;
+						memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+						struct sockaddr_in6* local = (struct sockaddr_in6*)&headers->locals[i];
+						memset(local, 0, sizeof(*local));
+						local->sin6_family = AF_INET6;
+						local->sin6_addr = info.ipi6_addr;
+						message.local = (const struct sockaddr*)local;
+					}
+				}
+			}
+
+			m_callback(m_client, m_messages, (size_t)n);
+
+			if ((size_t)n < m_count)
+			{
+				return;
+			}
+		}
+#endif // UV_UDP_HAVE_MMSG
+	}
+
+	void uv_udp_batch::on_poll(uv_poll_t* handle, int status, int events)
+	{
+		uv_loop_monitor::mark();
+
+		uv_udp_batch* batch = (uv_udp_batch*)handle->data;
+		if (status != 0)
+		{
+			batch->m_error = status;
+			return;
+		}
+		if (events & UV_WRITABLE)
+		{
+			batch->flush();
+		}
+		if ((events & UV_READABLE) && batch->m_open)
+		{
+			batch->receive();
+		}
+	}
+
+	void uv_udp_batch::on_close(uv_handle_t* handle)
+	{
+		uv_udp_batch* batch = (uv_udp_batch*)handle->data;
+		delete batch;
+	}
+}
@@ -1,19 +1,90 @@
 #include "uv_udp_client.h"
+#include "uv_loop_monitor.h"
+#include <string.h>
+#if !defined(_WIN32)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
 namespace uv
 {
 	uv_udp_client::uv_udp_client(uv_loop_t* loop /*= uv_default_loop()*/):
 		m_loop(loop),
+		m_receive_callback(nullptr),
+		m_receive_view_callback(nullptr),
+		m_buffer_pool(nullptr),
+		m_own_buffer_pool(nullptr),
+		m_receive_batch_callback(nullptr),
+		m_batch(nullptr),
+		m_batch_count(uv_udp_batch::MAX_BATCH),
+		m_batch_slot_size(UDP_BUFFER_SIZE),
+		m_gro(false),
+		m_start_callback(nullptr),
+		m_fragmenter(nullptr),
+		m_fragment_mtu(0),
+		m_fragment_timeout(3000),
+		m_fragment_max_pending(256),
+		m_pacer(nullptr),
+		m_pacing_rate(0),
+		m_pacing_burst(0),
+		m_pacing_peer_rate(0),
+		m_pacing_peer_burst(0),
+		m_pacing_queue_limit(1024),
+		m_pacing_drop_oldest(false),
+		m_reuse_port(false),
+		m_shard(0),
+		m_defer_send(false),
 		m_init(false),
-		m_receive_callback(nullptr)
+		m_attached(false),
+		m_data(nullptr)
 	{
 	}
 
 	uv_udp_client::~uv_udp_client()
 	{
 		close();
+		//retained buffers may still hold blocks of it
+		if (m_own_buffer_pool != nullptr)
+		{
+			m_own_buffer_pool->unref();
+		}
 	}
 
 	bool uv_udp_client::start_ipv4(const char* ip, const unsigned port , bool broadcast)
+	{
+		if (attach_ipv4(ip, port, broadcast) == false)
+		{
+			return false;
+		}
+		m_attached = false;
+
+		if (run() == false)
+		{
+			LOG("udp client run fail.");
+			return false;
+		}
+
+		return true;
+	}
+
+	bool uv_udp_client::start_ipv6(const char* ip, const unsigned port, bool broadcast)
+	{
+		if (attach_ipv6(ip, port, broadcast) == false)
+		{
+			return false;
+		}
+		m_attached = false;
+
+		if (run() == false)
+		{
+			LOG("udp client run fail.");
+			return false;
+		}
+
+		return true;
+	}
+
+	bool uv_udp_client::attach_ipv4(const char* ip, const unsigned port , bool broadcast)
 	{
 		close();
 		if (init() ==false)
@@ -22,7 +93,8 @@ namespace uv
 			return false;
 		}
 		
-		if (ip != nullptr && port > 0)
+		//a socket listen() binds by itself has no SO_REUSEPORT, nothing could share its port
+		if (ip != nullptr && (port > 0 || m_reuse_port))
 		{
 			if (bind_ipv4(ip, port) == false)
 			{
@@ -47,21 +119,17 @@ namespace uv
 
 		LOG("udp client running.");
 
+		m_attached = true;
+
 		if (m_start_callback != nullptr)
 		{
 			m_start_callback(this);
 		}
 
-		if (run() == false)
-		{
-			LOG("udp client run fail.");
-			return false;
-		}
-
 		return true;
 	}
 
-	bool uv_udp_client::start_ipv6(const char* ip, const unsigned port, bool broadcast)
+	bool uv_udp_client::attach_ipv6(const char* ip, const unsigned port, bool broadcast)
 	{
 		close();
 		if (init() == false)
@@ -70,7 +138,8 @@ namespace uv
 			return false;
 		}
 
-		if (ip != nullptr && port > 0) 
+		//a socket listen() binds by itself has no SO_REUSEPORT, nothing could share its port
+		if (ip != nullptr && (port > 0 || m_reuse_port)) 
 		{
 			if (bind_ipv6(ip, port) == false)
 			{
@@ -95,17 +164,13 @@ namespace uv
 
 		LOG("udp client running.");
 
+		m_attached = true;
+
 		if (m_start_callback != nullptr)
 		{
 			m_start_callback(this);
 		}
 
-		if (run() == false)
-		{
-			LOG("udp client run fail.");
-			return false;
-		}
-
 		return true;
 	}
 
@@ -122,19 +187,38 @@ namespace uv
 
 	void uv_udp_client::close()
 	{
+		if (m_batch != nullptr)
+		{
+			m_batch->close();
+			m_batch = nullptr;
+		}
+
+		if (m_fragmenter != nullptr)
+		{
+			m_fragmenter->close();
+			m_fragmenter = nullptr;
+		}
+
+		if (m_pacer != nullptr)
+		{
+			m_pacer->close();
+			m_pacer = nullptr;
+		}
+
+		//memberships go away with the socket
+		m_groups.clear();
+		m_deferred.clear();
+		m_deferred_data.clear();
+
 		if (m_init)
 		{
 			uv_close((uv_handle_t*)&m_handle, on_close);
 
 			m_init = false;
 
-			free(m_write_buffer.base);
-			free(m_read_buffer.base);
+			m_buffer_pool->release(m_read_buffer.base);
 
-			m_write_buffer.base = nullptr;
 			m_read_buffer.base = nullptr;
-
-			m_write_buffer.len = 0;
 			m_read_buffer.len = 0;
 		}
 	}
@@ -166,23 +250,59 @@ namespace uv
 
 	void uv_udp_client::send(const sockaddr* addr, const char* data, const size_t length)
 	{
-		if (m_write_buffer.len < length)
+		if (m_fragmenter != nullptr)
 		{
-			//·ڴ
-			m_write_buffer.base = (char*)realloc(m_write_buffer.base, length);
-			m_write_buffer.len = length;
+			if (m_fragmenter->send(addr, data, length) == false)
+			{
+				error(UV_EMSGSIZE);
+			}
+			return;
 		}
-		else
+		send_paced(addr, data, length);
+	}
+
+	void uv_udp_client::send_paced(const sockaddr* addr, const char* data, const size_t length)
+	{
+		if (m_pacer != nullptr)
 		{
-			memset(m_write_buffer.base, 0, m_write_buffer.len);
+			m_pacer->send(addr, data, length);
+			return;
 		}
+		send_datagram(addr, data, length);
+	}
 
-		memcpy(m_write_buffer.base, data, length);
-		m_write_buffer.len = length;
+	void uv_udp_client::send_datagram(const sockaddr* addr, const char* data, const size_t length)
+	{
+		if (m_defer_send == false)
+		{
+			write_datagram(addr, data, length);
+			return;
+		}
 
-		int r = uv_udp_send(&m_req, &m_handle, &m_write_buffer, 1, addr, on_send);
+		deferred_datagram d;
+		memset(&d.addr, 0, sizeof(d.addr));
+		memcpy(&d.addr, addr, addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		d.offset = m_deferred_data.size();
+		d.length = length;
+		m_deferred.push_back(d);
+		m_deferred_data.insert(m_deferred_data.end(), data, data + length);
+	}
+
+	void uv_udp_client::write_datagram(const sockaddr* addr, const char* data, const size_t length)
+	{
+		//every send owns its request and payload until on_send gives them back
+		uv_udp_send_pool::node* n = m_send_pool.acquire(data, length);
+		if (n == nullptr)
+		{
+			error(UV_ENOMEM);
+			return;
+		}
+		n->req.data = this;
+
+		int r = uv_udp_send(&n->req, &m_handle, &n->buf, 1, addr, on_send);
 		if (r != 0)
 		{
+			m_send_pool.release(n);
 			error(r);
 		}
 	}
@@ -207,8 +327,35 @@ namespace uv
 
 		m_handle.data = this;
 
-		m_write_buffer = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE);
-		m_read_buffer = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE);
+		if (m_buffer_pool == nullptr)
+		{
+			if (m_own_buffer_pool == nullptr)
+			{
+				m_own_buffer_pool = new uv_buffer_pool(UDP_BUFFER_SIZE, 1);
+			}
+			m_buffer_pool = m_own_buffer_pool;
+		}
+		m_read_buffer = uv_buf_init(nullptr, 0);
+
+		if (m_fragment_mtu > 0)
+		{
+			m_fragmenter = new uv_udp_fragmenter(m_loop, m_fragment_mtu, m_fragment_timeout, m_fragment_max_pending);
+			m_fragmenter->set_data(this);
+			m_fragmenter->set_output_callback(on_fragment_output);
+			m_fragmenter->set_message_callback(on_fragment_message);
+			m_fragmenter->start();
+		}
+
+		if (m_pacing_rate > 0 || m_pacing_peer_rate > 0)
+		{
+			m_pacer = new uv_udp_pacer(m_loop);
+			m_pacer->set_data(this);
+			m_pacer->set_rate(m_pacing_rate, m_pacing_burst);
+			m_pacer->set_peer_rate(m_pacing_peer_rate, m_pacing_peer_burst);
+			m_pacer->set_queue_limit(m_pacing_queue_limit, m_pacing_drop_oldest);
+			m_pacer->set_output_callback(on_pacer_output);
+			m_pacer->start();
+		}
 
 		m_init = true;
 
@@ -224,39 +371,384 @@ namespace uv
 			return false;
 		}
 
-		r = uv_udp_bind(&m_handle, (const sockaddr*)&addr, 0);
+		return bind((const sockaddr*)&addr);
+	}
+
+	bool uv_udp_client::bind_ipv6(const char* ip, const unsigned port)
+	{
+		struct sockaddr_in6 addr;
+		int r = uv_ip6_addr(ip, port, &addr);
 		if (r != 0)
 		{
 			error(r);
 			return false;
 		}
 
+		return bind((const sockaddr*)&addr);
+	}
+
+	bool uv_udp_client::bind(const struct sockaddr* addr)
+	{
+		if (m_reuse_port == false)
+		{
+			int r = uv_udp_bind(&m_handle, addr, 0);
+			if (r != 0)
+			{
+				error(r);
+				return false;
+			}
+			return true;
+		}
+
+#if !defined(_WIN32) && defined(SO_REUSEPORT)
+		//libuv only sets SO_REUSEADDR on linux, build the socket by hand and give it to the handle
+		int fd = ::socket(addr->sa_family, SOCK_DGRAM, 0);
+		if (fd < 0)
+		{
+			error(-errno);
+			return false;
+		}
+
+		int on = 1;
+		if (::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+			::bind(fd, addr, addr->sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in)) != 0)
+		{
+			error(-errno);
+			::close(fd);
+			return false;
+		}
+
+		int r = uv_udp_open(&m_handle, fd);
+		if (r != 0)
+		{
+			error(r);
+			::close(fd);
+			return false;
+		}
 		return true;
+#else
+		error(UV_ENOTSUP);
+		return false;
+#endif
 	}
 
-	bool uv_udp_client::bind_ipv6(const char* ip, const unsigned port)
+	bool uv_udp_client::listen()
 	{
-		struct sockaddr_in6 addr;
-		int r = uv_ip6_addr(ip, port, &addr);
+		if (m_receive_batch_callback != nullptr && uv_udp_batch::supported())
+		{
+			return listen_batch(m_receive_batch_callback);
+		}
+
+		int r = uv_udp_recv_start(&m_handle, on_alloc_buffer, on_receive);
 		if (r != 0)
 		{
 			error(r);
 			return false;
 		}
+		return true;
+	}
 
-		r = uv_udp_bind(&m_handle, (const sockaddr*)&addr, 0);
+	bool uv_udp_client::listen_batch(receive_batch_callback callback)
+	{
+		if (open_batch(AF_INET) == false)
+		{
+			return false;
+		}
+
+		if (m_groups.empty() == false && m_batch->set_pktinfo(true) == false)
+		{
+			error(m_batch->error());
+			return false;
+		}
+
+		size_t slot_size = m_batch_slot_size;
+		if (m_gro)
+		{
+			if (m_batch->set_gro(true) == false)
+			{
+				error(m_batch->error());
+				return false;
+			}
+			//coalesced segments arrive as one datagram of up to 64k
+			if (slot_size < UDP_BUFFER_SIZE)
+			{
+				slot_size = UDP_BUFFER_SIZE;
+			}
+		}
+
+		if (m_batch->start_receive(callback, m_batch_count, slot_size) == false)
+		{
+			error(m_batch->error());
+			return false;
+		}
+		return true;
+	}
+
+	bool uv_udp_client::open_batch(int family)
+	{
+		if (m_batch != nullptr)
+		{
+			return true;
+		}
+
+		uv_os_fd_t fd;
+		int r = uv_fileno((uv_handle_t*)&m_handle, &fd);
+		if (r == UV_EBADF)
+		{
+			//not bound yet, bind any port like libuv would on first use
+			if ((family == AF_INET6 ? bind_ipv6("::", 0) : bind_ipv4("0.0.0.0", 0)) == false)
+			{
+				return false;
+			}
+			r = uv_fileno((uv_handle_t*)&m_handle, &fd);
+		}
 		if (r != 0)
 		{
 			error(r);
 			return false;
 		}
 
+		m_batch = new uv_udp_batch(this);
+		if (m_batch->open(m_loop, fd) == false)
+		{
+			error(m_batch->error());
+			m_batch->close();
+			m_batch = nullptr;
+			return false;
+		}
 		return true;
 	}
 
-	bool uv_udp_client::listen()
+	bool uv_udp_client::send_segmented(const sockaddr* addr, const char* data, const size_t length, const size_t segment_size)
 	{
-		int r = uv_udp_recv_start(&m_handle, on_alloc_buffer, on_receive);
+		if (m_init == false || segment_size == 0)
+		{
+			return false;
+		}
+
+		size_t done = 0;
+		if (uv_udp_batch::supported() && open_batch(addr->sa_family))
+		{
+			done = m_batch->send_segmented(addr, data, length, segment_size);
+		}
+
+		//whatever gso did not take goes out as plain datagrams
+		uv_udp_datagram datagrams[uv_udp_batch::MAX_BATCH];
+		while (done < length)
+		{
+			size_t count = 0;
+			for (; count < uv_udp_batch::MAX_BATCH && done < length; ++count)
+			{
+				size_t size = length - done < segment_size ? length - done : segment_size;
+				datagrams[count].addr = addr;
+				datagrams[count].data = data + done;
+				datagrams[count].length = size;
+				done += size;
+			}
+			if (send_batch(datagrams, count) < count)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	size_t uv_udp_client::send_batch(const uv_udp_datagram* datagrams, size_t count)
+	{
+		if (m_init == false || count == 0)
+		{
+			return 0;
+		}
+
+		if (uv_udp_batch::supported())
+		{
+			if (open_batch(datagrams[0].addr->sa_family) == false)
+			{
+				return 0;
+			}
+			return m_batch->send(datagrams, count);
+		}
+
+		//no sendmmsg, try each datagram inline and let libuv queue the ones that would block
+		size_t accepted = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			uv_buf_t buf = uv_buf_init((char*)datagrams[i].data, (unsigned int)datagrams[i].length);
+			int r = uv_udp_try_send(&m_handle, &buf, 1, datagrams[i].addr);
+			if (r >= 0)
+			{
+				++accepted;
+			}
+			else if (r == UV_EAGAIN || r == UV_ENOSYS)
+			{
+				write_datagram(datagrams[i].addr, datagrams[i].data, datagrams[i].length);
+				++accepted;
+			}
+			else
+			{
+				error(r);
+			}
+		}
+		return accepted;
+	}
+
+	void uv_udp_client::set_defer_send(bool enable)
+	{
+		m_defer_send = enable;
+		if (enable == false)
+		{
+			flush();
+		}
+	}
+
+	size_t uv_udp_client::flush()
+	{
+		if (m_deferred.empty())
+		{
+			return 0;
+		}
+
+		//the data vector doesn't grow while the list points into it
+		m_flush_list.resize(m_deferred.size());
+		for (size_t i = 0; i < m_deferred.size(); ++i)
+		{
+			m_flush_list[i].addr = (const struct sockaddr*)&m_deferred[i].addr;
+			m_flush_list[i].data = m_deferred_data.data() + m_deferred[i].offset;
+			m_flush_list[i].length = m_deferred[i].length;
+		}
+		size_t sent = send_batch(m_flush_list.data(), m_flush_list.size());
+
+		m_deferred.clear();
+		m_deferred_data.clear();
+		return sent;
+	}
+
+	uv_tick_result uv_udp_client::run_for(uint64_t budget)
+	{
+		flush();
+		uv_tick_result result = uv_run_for(m_loop, budget);
+		flush();
+
+		if (m_init)
+		{
+			result.backlog = uv_udp_get_send_queue_count(&m_handle);
+		}
+		if (m_batch != nullptr)
+		{
+			result.backlog += m_batch->queued();
+		}
+		return result;
+	}
+
+	bool uv_udp_client::join_group(const char* group, const char* iface, receive_callback callback)
+	{
+		struct sockaddr_storage addr;
+		if (m_init == false || parse_group(group, addr) == false)
+		{
+			return false;
+		}
+
+		int r = uv_udp_set_membership(&m_handle, group, iface, UV_JOIN_GROUP);
+		if (r != 0)
+		{
+			error(r);
+			return false;
+		}
+
+		bool known = false;
+		for (auto it = m_groups.begin(); it != m_groups.end(); ++it)
+		{
+			if (memcmp(&it->addr, &addr, sizeof(addr)) == 0)
+			{
+				it->callback = callback;
+				known = true;
+			}
+		}
+		if (known == false)
+		{
+			uv_udp_client::group entry;
+			entry.addr = addr;
+			entry.callback = callback;
+			m_groups.push_back(entry);
+		}
+
+		if (uv_udp_batch::supported() == false)
+		{
+			return true;
+		}
+
+		if (m_batch != nullptr && m_batch->receiving())
+		{
+			if (m_batch->set_pktinfo(true) == false)
+			{
+				error(m_batch->error());
+				return false;
+			}
+		}
+		else if (callback != nullptr)
+		{
+			//libuv can't tell the destination of a datagram, hand the reads to the batch engine
+			uv_udp_recv_stop(&m_handle);
+			if (listen_batch(on_group_batch) == false)
+			{
+				uv_udp_recv_start(&m_handle, on_alloc_buffer, on_receive);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool uv_udp_client::leave_group(const char* group, const char* iface)
+	{
+		struct sockaddr_storage addr;
+		if (m_init == false || parse_group(group, addr) == false)
+		{
+			return false;
+		}
+
+		int r = uv_udp_set_membership(&m_handle, group, iface, UV_LEAVE_GROUP);
+		if (r != 0)
+		{
+			error(r);
+			return false;
+		}
+
+		for (auto it = m_groups.begin(); it != m_groups.end(); ++it)
+		{
+			if (memcmp(&it->addr, &addr, sizeof(addr)) == 0)
+			{
+				m_groups.erase(it);
+				break;
+			}
+		}
+		return true;
+	}
+
+	bool uv_udp_client::set_multicast_ttl(int ttl)
+	{
+		int r = uv_udp_set_multicast_ttl(&m_handle, ttl);
+		if (r != 0)
+		{
+			error(r);
+			return false;
+		}
+		return true;
+	}
+
+	bool uv_udp_client::set_multicast_loop(bool enable)
+	{
+		int r = uv_udp_set_multicast_loop(&m_handle, enable ? 1 : 0);
+		if (r != 0)
+		{
+			error(r);
+			return false;
+		}
+		return true;
+	}
+
+	bool uv_udp_client::set_multicast_interface(const char* iface)
+	{
+		int r = uv_udp_set_multicast_interface(&m_handle, iface);
 		if (r != 0)
 		{
 			error(r);
@@ -265,6 +757,74 @@ namespace uv
 		return true;
 	}
 
+	unsigned uv_udp_client::port()
+	{
+		struct sockaddr_storage addr;
+		int length = sizeof(addr);
+		int r = uv_udp_getsockname(&m_handle, (struct sockaddr*)&addr, &length);
+		if (r != 0)
+		{
+			error(r);
+			return 0;
+		}
+		if (addr.ss_family == AF_INET6)
+		{
+			return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+		}
+		return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+	}
+
+	bool uv_udp_client::parse_group(const char* group, struct sockaddr_storage& addr)
+	{
+		memset(&addr, 0, sizeof(addr));
+		if (group == nullptr)
+		{
+			error(UV_EINVAL);
+			return false;
+		}
+		if (uv_ip4_addr(group, 0, (struct sockaddr_in*)&addr) == 0)
+		{
+			return true;
+		}
+		memset(&addr, 0, sizeof(addr));
+		int r = uv_ip6_addr(group, 0, (struct sockaddr_in6*)&addr);
+		if (r != 0)
+		{
+			error(r);
+			return false;
+		}
+		return true;
+	}
+
+	uv_udp_client::receive_callback uv_udp_client::group_callback(const struct sockaddr* local) const
+	{
+		if (local == nullptr)
+		{
+			return nullptr;
+		}
+
+		for (auto it = m_groups.begin(); it != m_groups.end(); ++it)
+		{
+			const struct sockaddr* addr = (const struct sockaddr*)&it->addr;
+			if (addr->sa_family != local->sa_family)
+			{
+				continue;
+			}
+			if (addr->sa_family == AF_INET)
+			{
+				if (((const sockaddr_in*)addr)->sin_addr.s_addr == ((const sockaddr_in*)local)->sin_addr.s_addr)
+				{
+					return it->callback;
+				}
+			}
+			else if (memcmp(&((const sockaddr_in6*)addr)->sin6_addr, &((const sockaddr_in6*)local)->sin6_addr, sizeof(struct in6_addr)) == 0)
+			{
+				return it->callback;
+			}
+		}
+		return nullptr;
+	}
+
 	bool uv_udp_client::run()
 	{
 		int r = uv_run(m_loop, UV_RUN_DEFAULT);
@@ -287,29 +847,53 @@ namespace uv
 	{
 		assert(handle->data != nullptr);
 		uv_udp_client* client = (uv_udp_client*)handle->data;
+		if (client->m_read_buffer.base == nullptr)
+		{
+			//first read or the last block was retained by a view
+			char* block = client->m_buffer_pool->acquire();
+			client->m_read_buffer = uv_buf_init(block, block != nullptr ? (unsigned int)client->m_buffer_pool->block_size() : 0);
+		}
 		*buf = client->read_buffer();
 	}
 	void uv_udp_client::on_send(uv_udp_send_t* req, int status)
 	{
+		uv_loop_monitor::mark();
+
 		if (status != 0)
 		{
 			fprintf(stderr, "%s\n", uv_strerror(status));
 		}
-		else
-		{
-			LOG("send success callback.");
-		}
+
+		uv_udp_client* client = (uv_udp_client*)req->data;
+		client->m_send_pool.release(uv_udp_send_pool::from(req));
 	}
 
 	void uv_udp_client::on_receive(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const struct sockaddr* addr, unsigned flags)
 	{
+		uv_loop_monitor::mark();
+
 		uv_udp_client* client = (uv_udp_client*)handle->data;
 
 		if (nread > 0)
 		{
-			if (client->m_receive_callback != nullptr)
+			if (client->m_receive_batch_callback != nullptr)
 			{
-				client->m_receive_callback(buf->base, buf->len, addr, flags);
+				//platforms without recvmmsg get batches of one
+				uv_udp_message message = { buf->base, (size_t)nread, addr, flags, 0, nullptr };
+				client->m_receive_batch_callback(client, &message, 1);
+			}
+			else if (client->m_fragmenter != nullptr && client->m_fragmenter->input(addr, buf->base, nread))
+			{
+				//consumed, complete messages come back through on_fragment_message
+			}
+			else if (client->m_receive_view_callback != nullptr)
+			{
+				uv_recv_view view(client->m_buffer_pool, &client->m_read_buffer, nread);
+				client->m_receive_view_callback(client, view, addr, flags);
+			}
+			else if (client->m_receive_callback != nullptr)
+			{
+				client->m_receive_callback(client, buf->base, nread, addr, flags);
 			}
 		}
 		else if (nread == 0)
@@ -334,13 +918,64 @@ namespace uv
 		}
 	}
 
-	void uv_udp_client::on_close(uv_handle_t* handle)
+	void uv_udp_client::on_close(uv_handle_t* /*handle*/)
+	{
+		//the handle is a member of the client, nothing to free here
+		LOG("udp client close.");
+	}
+
+	void uv_udp_client::on_group_batch(uv_udp_client* client, uv_udp_message* messages, size_t count)
 	{
-		if (handle)
+		for (size_t i = 0; i < count; ++i)
 		{
-			free(handle);
+			uv_udp_message& message = messages[i];
+			receive_callback callback = client->group_callback(message.local);
+			if (callback != nullptr)
+			{
+				callback(client, message.data, message.length, message.addr, message.flags);
+			}
+			//everything else takes the same way as in on_receive
+			else if (client->m_fragmenter != nullptr && client->m_fragmenter->input(message.addr, message.data, message.length))
+			{
+				//consumed, complete messages come back through on_fragment_message
+			}
+			else if (client->m_receive_view_callback != nullptr)
+			{
+				//the batch engine reuses its buffers, so retain copies
+				uv_recv_view view(message.data, message.length);
+				client->m_receive_view_callback(client, view, message.addr, message.flags);
+			}
+			else if (client->m_receive_callback != nullptr)
+			{
+				client->m_receive_callback(client, message.data, message.length, message.addr, message.flags);
+			}
 		}
+	}
 
-		LOG("udp client close.");
+	void uv_udp_client::on_fragment_output(uv_udp_fragmenter* fragmenter, const struct sockaddr* addr, const char* data, size_t length)
+	{
+		uv_udp_client* client = (uv_udp_client*)fragmenter->data();
+		client->send_paced(addr, data, length);
+	}
+
+	void uv_udp_client::on_pacer_output(uv_udp_pacer* pacer, const struct sockaddr* addr, const char* data, size_t length)
+	{
+		uv_udp_client* client = (uv_udp_client*)pacer->data();
+		client->send_datagram(addr, data, length);
+	}
+
+	void uv_udp_client::on_fragment_message(uv_udp_fragmenter* fragmenter, const char* data, size_t length, const struct sockaddr* addr)
+	{
+		uv_udp_client* client = (uv_udp_client*)fragmenter->data();
+		if (client->m_receive_view_callback != nullptr)
+		{
+			//reassembled or behind a fragment header, not a block of its own, so retain copies
+			uv_recv_view view(data, length);
+			client->m_receive_view_callback(client, view, addr, 0);
+		}
+		else if (client->m_receive_callback != nullptr)
+		{
+			client->m_receive_callback(client, (char*)data, length, addr, 0);
+		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,429 @@
+#include "uv_udp_fec.h"
+#include "uv_udp_client.h"
+#include "uv_gf256.h"
+#include <string.h>
+
+namespace uv
+{
+	namespace
+	{
+		const uint16_t FEC_MAGIC = 0xf7ec;
+		const size_t MAX_PAYLOAD = 65507 - uv_udp_fec::HEADER_SIZE - 2;
+
+		inline int32_t diff(uint32_t later, uint32_t earlier)
+		{
+			return (int32_t)(later - earlier);
+		}
+
+		inline uint16_t read16(const char* p)
+		{
+			const unsigned char* u = (const unsigned char*)p;
+			return (uint16_t)(u[0] | (u[1] << 8));
+		}
+
+		inline uint32_t read32(const char* p)
+		{
+			const unsigned char* u = (const unsigned char*)p;
+			return (uint32_t)u[0] | ((uint32_t)u[1] << 8) | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+		}
+
+		inline void write16(char* p, uint16_t v)
+		{
+			p[0] = (char)(v & 0xff);
+			p[1] = (char)(v >> 8);
+		}
+
+		inline void write32(char* p, uint32_t v)
+		{
+			p[0] = (char)(v & 0xff);
+			p[1] = (char)((v >> 8) & 0xff);
+			p[2] = (char)((v >> 16) & 0xff);
+			p[3] = (char)(v >> 24);
+		}
+	}
+
+	uv_udp_fec::uv_udp_fec(uv_udp_client* client, const struct sockaddr* peer, unsigned k /*= 8*/, unsigned m /*= 2*/) :
+		m_client(client),
+		m_k(k > 0 ? k : 1),
+		m_m(m > 0 ? m : 1),
+		m_started(false),
+		m_flush_delay(20),
+		m_send_group(0),
+		m_recovered(0),
+		m_unrecoverable(0),
+		m_receive_callback(nullptr),
+		m_data(nullptr)
+	{
+		if (m_k + m_m > MAX_SHARDS)
+		{
+			m_m = m_m < MAX_SHARDS / 2 ? m_m : MAX_SHARDS / 2;
+			m_k = MAX_SHARDS - m_m;
+		}
+
+		memset(&m_peer, 0, sizeof(m_peer));
+		if (peer != nullptr)
+		{
+			memcpy(&m_peer, peer, peer->sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+		}
+
+		for (size_t i = 0; i < WINDOW; ++i)
+		{
+			m_groups[i].id = 0;
+			m_groups[i].used = false;
+			m_groups[i].done = false;
+			m_groups[i].count = 0;
+			m_groups[i].parity = 0;
+			m_groups[i].data_received = 0;
+			m_groups[i].parity_received = 0;
+		}
+		m_send_shards.reserve(m_k);
+	}
+
+	uv_udp_fec::~uv_udp_fec()
+	{
+	}
+
+	bool uv_udp_fec::start()
+	{
+		if (m_started)
+		{
+			return true;
+		}
+
+		int r = uv_timer_init(m_client->loop(), &m_timer);
+		if (r != 0)
+		{
+			fprintf(stderr, "fec timer: %s\n", uv_strerror(r));
+			return false;
+		}
+		m_timer.data = this;
+		m_started = true;
+		return true;
+	}
+
+	void uv_udp_fec::close()
+	{
+		m_receive_callback = nullptr;
+		if (m_started)
+		{
+			uv_timer_stop(&m_timer);
+			uv_close((uv_handle_t*)&m_timer, on_close);
+			m_started = false;
+		}
+		else
+		{
+			delete this;
+		}
+	}
+
+	bool uv_udp_fec::send(const char* data, const size_t length)
+	{
+		if (length > MAX_PAYLOAD)
+		{
+			return false;
+		}
+
+		unsigned index = (unsigned)m_send_shards.size();
+		m_packet.resize(HEADER_SIZE + length);
+		//the count isn't known before the group closes, data packets carry the planned k
+		write_header(m_packet.data(), m_send_group, index, m_k, m_m);
+		if (length > 0)
+		{
+			memcpy(m_packet.data() + HEADER_SIZE, data, length);
+		}
+		output(m_packet.data(), m_packet.size());
+
+		std::string shard;
+		shard.resize(2 + length);
+		write16(&shard[0], (uint16_t)length);
+		if (length > 0)
+		{
+			memcpy(&shard[2], data, length);
+		}
+		m_send_shards.push_back(std::move(shard));
+
+		if (m_send_shards.size() >= m_k)
+		{
+			flush();
+		}
+		else if (index == 0 && m_started)
+		{
+			uv_timer_start(&m_timer, on_timer, m_flush_delay, 0);
+		}
+		return true;
+	}
+
+	void uv_udp_fec::flush()
+	{
+		if (m_started)
+		{
+			uv_timer_stop(&m_timer);
+		}
+		if (m_send_shards.empty())
+		{
+			return;
+		}
+
+		unsigned count = (unsigned)m_send_shards.size();
+		size_t size = 0;
+		for (size_t j = 0; j < m_send_shards.size(); ++j)
+		{
+			if (m_send_shards[j].size() > size)
+			{
+				size = m_send_shards[j].size();
+			}
+		}
+
+		//parity over the shards zero padded to the longest one
+		m_parity.assign(m_m * size, 0);
+		m_padded.resize(size);
+		for (unsigned j = 0; j < count; ++j)
+		{
+			const std::string& shard = m_send_shards[j];
+			memcpy(m_padded.data(), shard.data(), shard.size());
+			memset(m_padded.data() + shard.size(), 0, size - shard.size());
+			for (unsigned i = 0; i < m_m; ++i)
+			{
+				uv_gf256::mul_add_region(&m_parity[i * size], m_padded.data(), coefficient(i, j, count, m_m), size);
+			}
+		}
+
+		m_packet.resize(HEADER_SIZE + size);
+		for (unsigned i = 0; i < m_m; ++i)
+		{
+			write_header(m_packet.data(), m_send_group, count + i, count, m_m);
+			memcpy(m_packet.data() + HEADER_SIZE, &m_parity[i * size], size);
+			output(m_packet.data(), m_packet.size());
+		}
+
+		m_send_shards.clear();
+		m_send_group++;
+	}
+
+	bool uv_udp_fec::input(const char* data, const size_t length)
+	{
+		if (data == nullptr || length < HEADER_SIZE || read16(data) != FEC_MAGIC)
+		{
+			return false;
+		}
+
+		uint32_t id = read32(data + 2);
+		unsigned index = (unsigned char)data[6];
+		unsigned count = (unsigned char)data[7];
+		unsigned parity = (unsigned char)data[8];
+		if (count == 0 || parity == 0 || count + parity > MAX_SHARDS || index >= count + parity)
+		{
+			return false;
+		}
+
+		const char* payload = data + HEADER_SIZE;
+		size_t size = length - HEADER_SIZE;
+
+		group& g = m_groups[id % WINDOW];
+		if (g.used == false || diff(id, g.id) > 0)
+		{
+			if (g.used && g.done == false && g.data_received < g.count)
+			{
+				++m_unrecoverable;
+			}
+			g.id = id;
+			g.used = true;
+			g.done = false;
+			g.count = count;
+			g.parity = parity;
+			g.shards.assign(count + parity, std::string());
+			g.present.assign(count + parity, false);
+			g.data_received = 0;
+			g.parity_received = 0;
+		}
+		else if (diff(id, g.id) < 0)
+		{
+			//too old, its slot already belongs to a newer group
+			return true;
+		}
+
+		//data packets carry the planned k, parity the real count of a group closed early.
+		//no data was sent past that count, so the slots in between are still empty
+		if (index >= count && count < g.count)
+		{
+			g.count = count;
+			g.shards.resize(count + parity);
+			g.present.resize(count + parity);
+		}
+		if (index >= g.count + g.parity || g.present[index])
+		{
+			return true;
+		}
+
+		if (index < g.count)
+		{
+			g.shards[index].resize(2 + size);
+			write16(&g.shards[index][0], (uint16_t)size);
+			if (size > 0)
+			{
+				memcpy(&g.shards[index][2], payload, size);
+			}
+			g.present[index] = true;
+			g.data_received++;
+
+			if (m_receive_callback != nullptr)
+			{
+				m_receive_callback(this, payload, size);
+			}
+		}
+		else
+		{
+			g.shards[index].assign(payload, size);
+			g.present[index] = true;
+			g.parity_received++;
+		}
+
+		if (g.done == false)
+		{
+			if (g.data_received == g.count)
+			{
+				g.done = true;
+			}
+			else if (g.parity_received > 0 && g.data_received + g.parity_received >= g.count)
+			{
+				recover(g);
+			}
+		}
+		return true;
+	}
+
+	uint8_t uv_udp_fec::coefficient(unsigned row, unsigned column, unsigned count, unsigned parity) const
+	{
+		if (parity == 1)
+		{
+			return 1;
+		}
+		//cauchy matrix 1 / (x_i + y_j) with x_i = count + i and y_j = j, every square submatrix is invertible
+		return uv_gf256::inv((uint8_t)((count + row) ^ column));
+	}
+
+	void uv_udp_fec::write_header(char* p, uint32_t id, unsigned index, unsigned count, unsigned parity) const
+	{
+		write16(p, FEC_MAGIC);
+		write32(p + 2, id);
+		p[6] = (char)index;
+		p[7] = (char)count;
+		p[8] = (char)parity;
+		p[9] = 0;
+	}
+
+	void uv_udp_fec::recover(group& g)
+	{
+		std::vector<unsigned> missing;
+		std::vector<unsigned> rows;
+		for (unsigned j = 0; j < g.count; ++j)
+		{
+			if (g.present[j] == false)
+			{
+				missing.push_back(j);
+			}
+		}
+		for (unsigned i = 0; i < g.parity && rows.size() < missing.size(); ++i)
+		{
+			if (g.present[g.count + i])
+			{
+				rows.push_back(i);
+			}
+		}
+		if (rows.size() < missing.size())
+		{
+			return;
+		}
+
+		size_t size = g.shards[g.count + rows[0]].size();
+		for (size_t r = 0; r < rows.size(); ++r)
+		{
+			if (g.shards[g.count + rows[r]].size() != size)
+			{
+				return;
+			}
+		}
+
+		//syndromes: parity minus the contribution of the data we have
+		size_t e = missing.size();
+		std::vector<uint8_t> syndromes(e * size);
+		std::vector<uint8_t> padded(size);
+		for (size_t r = 0; r < e; ++r)
+		{
+			memcpy(&syndromes[r * size], g.shards[g.count + rows[r]].data(), size);
+		}
+		for (unsigned j = 0; j < g.count; ++j)
+		{
+			if (g.present[j] == false)
+			{
+				continue;
+			}
+			const std::string& shard = g.shards[j];
+			if (shard.size() > size)
+			{
+				return;
+			}
+			memcpy(padded.data(), shard.data(), shard.size());
+			memset(padded.data() + shard.size(), 0, size - shard.size());
+			for (size_t r = 0; r < e; ++r)
+			{
+				uv_gf256::mul_add_region(&syndromes[r * size], padded.data(), coefficient(rows[r], j, g.count, g.parity), size);
+			}
+		}
+
+		std::vector<uint8_t> matrix(e * e);
+		for (size_t r = 0; r < e; ++r)
+		{
+			for (size_t c = 0; c < e; ++c)
+			{
+				matrix[r * e + c] = coefficient(rows[r], missing[c], g.count, g.parity);
+			}
+		}
+		if (uv_gf256::invert_matrix(matrix.data(), e) == false)
+		{
+			return;
+		}
+
+		g.done = true;
+		std::vector<uint8_t> shard(size);
+		for (size_t c = 0; c < e; ++c)
+		{
+			memset(shard.data(), 0, size);
+			for (size_t r = 0; r < e; ++r)
+			{
+				uv_gf256::mul_add_region(shard.data(), &syndromes[r * size], matrix[c * e + r], size);
+			}
+
+			size_t length = size >= 2 ? read16((const char*)shard.data()) : size;
+			if (size < 2 || length > size - 2)
+			{
+				continue;
+			}
+			g.present[missing[c]] = true;
+			g.data_received++;
+			m_recovered++;
+
+			if (m_receive_callback != nullptr)
+			{
+				m_receive_callback(this, (const char*)shard.data() + 2, length);
+			}
+		}
+	}
+
+	void uv_udp_fec::output(const char* data, size_t length)
+	{
+		m_client->send((const struct sockaddr*)&m_peer, data, length);
+	}
+
+	void uv_udp_fec::on_timer(uv_timer_t* handle)
+	{
+		uv_udp_fec* fec = (uv_udp_fec*)handle->data;
+		fec->flush();
+	}
+
+	void uv_udp_fec::on_close(uv_handle_t* handle)
+	{
+		uv_udp_fec* fec = (uv_udp_fec*)handle->data;
+		delete fec;
+	}
+}
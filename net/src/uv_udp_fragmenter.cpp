@@ -0,0 +1,312 @@
+#include "uv_udp_fragmenter.h"
+#include <string.h>
+
+namespace uv
+{
+	namespace
+	{
+		const uint16_t FRAGMENT_MAGIC = 0xf7a9;
+
+		inline char* encode16(char* p, uint16_t v)
+		{
+			p[0] = (char)(v & 0xff);
+			p[1] = (char)(v >> 8);
+			return p + 2;
+		}
+
+		inline char* encode32(char* p, uint32_t v)
+		{
+			p[0] = (char)(v & 0xff);
+			p[1] = (char)((v >> 8) & 0xff);
+			p[2] = (char)((v >> 16) & 0xff);
+			p[3] = (char)(v >> 24);
+			return p + 4;
+		}
+
+		inline const char* decode16(const char* p, uint16_t& v)
+		{
+			const unsigned char* u = (const unsigned char*)p;
+			v = (uint16_t)(u[0] | (u[1] << 8));
+			return p + 2;
+		}
+
+		inline const char* decode32(const char* p, uint32_t& v)
+		{
+			const unsigned char* u = (const unsigned char*)p;
+			v = (uint32_t)u[0] | ((uint32_t)u[1] << 8) | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+			return p + 4;
+		}
+	}
+
+	bool uv_udp_fragmenter::key::operator<(const key& other) const
+	{
+		return memcmp(this, &other, sizeof(key)) < 0;
+	}
+
+	uv_udp_fragmenter::uv_udp_fragmenter(uv_loop_t* loop, size_t mtu /*= 1400*/, unsigned timeout /*= 3000*/, size_t max_pending /*= 256*/, size_t max_message /*= 1024 * 1024*/) :
+		m_loop(loop),
+		m_started(false),
+		m_mtu(mtu > HEADER_SIZE ? mtu : HEADER_SIZE + 1),
+		m_timeout(timeout > 0 ? timeout : 1),
+		m_max_pending(max_pending > 0 ? max_pending : 1),
+		m_max_message(max_message),
+		m_next_id((uint32_t)uv_hrtime()),
+		m_expired(0),
+		m_fragment(m_mtu),
+		m_output_callback(nullptr),
+		m_message_callback(nullptr),
+		m_data(nullptr)
+	{
+	}
+
+	uv_udp_fragmenter::~uv_udp_fragmenter()
+	{
+		m_pending.clear();
+	}
+
+	bool uv_udp_fragmenter::start()
+	{
+		if (m_started)
+		{
+			return true;
+		}
+
+		int r = uv_timer_init(m_loop, &m_timer);
+		if (r != 0)
+		{
+			fprintf(stderr, "fragmenter timer: %s\n", uv_strerror(r));
+			return false;
+		}
+		m_timer.data = this;
+
+		//half the timeout is precise enough, a message lives between 1 and 1.5 timeouts
+		uint64_t period = m_timeout / 2 > 0 ? m_timeout / 2 : 1;
+		uv_timer_start(&m_timer, on_timer, period, period);
+		//only the udp handle should keep the loop alive
+		uv_unref((uv_handle_t*)&m_timer);
+
+		m_started = true;
+		return true;
+	}
+
+	void uv_udp_fragmenter::close()
+	{
+		m_pending.clear();
+		m_output_callback = nullptr;
+		m_message_callback = nullptr;
+
+		if (m_started)
+		{
+			uv_timer_stop(&m_timer);
+			uv_close((uv_handle_t*)&m_timer, on_close);
+			m_started = false;
+		}
+		else
+		{
+			delete this;
+		}
+	}
+
+	bool uv_udp_fragmenter::send(const struct sockaddr* addr, const char* data, size_t length)
+	{
+		size_t payload = m_mtu - HEADER_SIZE;
+		size_t count = length <= payload ? 1 : (length + payload - 1) / payload;
+		if (count > MAX_FRAGMENTS)
+		{
+			return false;
+		}
+
+		uint32_t id = m_next_id++;
+		for (size_t i = 0; i < count; ++i)
+		{
+			size_t offset = i * payload;
+			size_t size = length - offset < payload ? length - offset : payload;
+
+			char* p = m_fragment.data();
+			p = encode16(p, FRAGMENT_MAGIC);
+			p = encode32(p, id);
+			p = encode16(p, (uint16_t)i);
+			p = encode16(p, (uint16_t)count);
+			if (size > 0)
+			{
+				memcpy(p, data + offset, size);
+			}
+
+			if (m_output_callback != nullptr)
+			{
+				m_output_callback(this, addr, m_fragment.data(), HEADER_SIZE + size);
+			}
+		}
+		return true;
+	}
+
+	bool uv_udp_fragmenter::input(const struct sockaddr* addr, const char* data, size_t length)
+	{
+		if (data == nullptr || length < HEADER_SIZE)
+		{
+			return false;
+		}
+
+		uint16_t magic = 0;
+		uint32_t id = 0;
+		uint16_t index = 0;
+		uint16_t count = 0;
+		const char* p = data;
+		p = decode16(p, magic);
+		p = decode32(p, id);
+		p = decode16(p, index);
+		p = decode16(p, count);
+		if (magic != FRAGMENT_MAGIC || count == 0 || index >= count)
+		{
+			return false;
+		}
+
+		size_t size = length - HEADER_SIZE;
+		if (count == 1)
+		{
+			//not split, straight from the read buffer
+			if (m_message_callback != nullptr)
+			{
+				m_message_callback(this, p, size, addr);
+			}
+			return true;
+		}
+
+		key k;
+		if (make_key(addr, id, k) == false)
+		{
+			return true;
+		}
+
+		auto it = m_pending.find(k);
+		if (it == m_pending.end())
+		{
+			//every fragment but the last is full, a count that can't fit in max_message is
+			//dropped before anything is allocated for it
+			size_t payload = m_mtu - HEADER_SIZE;
+			if ((size_t)(count - 1) * payload >= m_max_message)
+			{
+				++m_expired;
+				return true;
+			}
+			if (m_pending.size() >= m_max_pending)
+			{
+				evict_oldest();
+			}
+			it = m_pending.insert(std::make_pair(k, message())).first;
+			it->second.created = uv_now(m_loop);
+			it->second.received = 0;
+			it->second.bytes = 0;
+			it->second.fragments.resize(count);
+			it->second.present.resize(count, false);
+		}
+
+		message& m = it->second;
+		if (m.fragments.size() != count || m.bytes + size > m_max_message)
+		{
+			//inconsistent or oversize, give up on the whole message
+			m_pending.erase(it);
+			++m_expired;
+			return true;
+		}
+		if (m.present[index])
+		{
+			return true;
+		}
+
+		m.fragments[index].assign(p, size);
+		m.present[index] = true;
+		m.bytes += size;
+		if (++m.received < count)
+		{
+			return true;
+		}
+
+		m_message.clear();
+		m_message.reserve(m.bytes);
+		for (size_t i = 0; i < m.fragments.size(); ++i)
+		{
+			m_message.append(m.fragments[i]);
+		}
+		m_pending.erase(it);
+
+		if (m_message_callback != nullptr)
+		{
+			m_message_callback(this, m_message.data(), m_message.size(), addr);
+		}
+		return true;
+	}
+
+	bool uv_udp_fragmenter::make_key(const struct sockaddr* addr, uint32_t id, key& k)
+	{
+		memset(&k, 0, sizeof(k));
+		k.id = id;
+		if (addr == nullptr)
+		{
+			return false;
+		}
+
+		k.family = addr->sa_family;
+		if (addr->sa_family == AF_INET)
+		{
+			const sockaddr_in* in = (const sockaddr_in*)addr;
+			k.port = in->sin_port;
+			memcpy(k.addr, &in->sin_addr, sizeof(in->sin_addr));
+			return true;
+		}
+		if (addr->sa_family == AF_INET6)
+		{
+			const sockaddr_in6* in6 = (const sockaddr_in6*)addr;
+			k.port = in6->sin6_port;
+			memcpy(k.addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+			return true;
+		}
+		return false;
+	}
+
+	void uv_udp_fragmenter::evict_oldest()
+	{
+		auto oldest = m_pending.begin();
+		for (auto it = m_pending.begin(); it != m_pending.end(); ++it)
+		{
+			if (it->second.created < oldest->second.created)
+			{
+				oldest = it;
+			}
+		}
+		if (oldest != m_pending.end())
+		{
+			m_pending.erase(oldest);
+			++m_expired;
+		}
+	}
+
+	void uv_udp_fragmenter::sweep()
+	{
+		uint64_t now = uv_now(m_loop);
+		for (auto it = m_pending.begin(); it != m_pending.end();)
+		{
+			if (now - it->second.created >= m_timeout)
+			{
+				it = m_pending.erase(it);
+				++m_expired;
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	void uv_udp_fragmenter::on_timer(uv_timer_t* handle)
+	{
+		uv_udp_fragmenter* fragmenter = (uv_udp_fragmenter*)handle->data;
+		fragmenter->sweep();
+	}
+
+	void uv_udp_fragmenter::on_close(uv_handle_t* handle)
+	{
+		uv_udp_fragmenter* fragmenter = (uv_udp_fragmenter*)handle->data;
+		delete fragmenter;
+	}
+}
@@ -0,0 +1,392 @@
+#include "uv_udp_pacer.h"
+#include <string.h>
+
+namespace uv
+{
+	namespace
+	{
+		const uint64_t NS_PER_SECOND = 1000000000ull;
+		const uint64_t SWEEP_INTERVAL = NS_PER_SECOND;
+		const size_t FREE_MAX = 1024;
+	}
+
+	void uv_udp_pacer::bucket::refill(uint64_t now)
+	{
+		if (rate == 0)
+		{
+			return;
+		}
+		if (stamp == 0)
+		{
+			tokens = burst;
+			stamp = now;
+			return;
+		}
+		if (tokens >= burst || now <= stamp)
+		{
+			stamp = now;
+			return;
+		}
+
+		//whole tokens only, the remainder of the interval is kept for the next refill
+		uint64_t elapsed = now - stamp;
+		uint64_t need = (uint64_t)(burst - tokens);
+		if (elapsed >= need * NS_PER_SECOND / rate)
+		{
+			tokens = burst;
+			stamp = now;
+			return;
+		}
+		uint64_t add = elapsed * rate / NS_PER_SECOND;
+		tokens += (int64_t)add;
+		stamp += add * NS_PER_SECOND / rate;
+	}
+
+	bool uv_udp_pacer::bucket::allows(size_t length) const
+	{
+		//a datagram bigger than the burst still goes once the bucket is full
+		return rate == 0 || tokens >= (int64_t)length || tokens >= burst;
+	}
+
+	void uv_udp_pacer::bucket::take(size_t length)
+	{
+		if (rate != 0)
+		{
+			tokens -= (int64_t)length;
+		}
+	}
+
+	bool uv_udp_pacer::key::operator<(const key& other) const
+	{
+		return memcmp(this, &other, sizeof(key)) < 0;
+	}
+
+	uv_udp_pacer::uv_udp_pacer(uv_loop_t* loop) :
+		m_loop(loop),
+		m_started(false),
+		m_ticking(false),
+		m_peer_rate(0),
+		m_peer_burst(0),
+		m_queue_limit(1024),
+		m_drop_oldest(false),
+		m_queued(0),
+		m_dropped(0),
+		m_last_sweep(0),
+		m_output_callback(nullptr),
+		m_data(nullptr)
+	{
+		m_global.rate = 0;
+		m_global.burst = 0;
+		m_global.tokens = 0;
+		m_global.stamp = 0;
+	}
+
+	uv_udp_pacer::~uv_udp_pacer()
+	{
+		for (auto it = m_peers.begin(); it != m_peers.end(); ++it)
+		{
+			for (size_t i = 0; i < it->second.queue.size(); ++i)
+			{
+				delete it->second.queue[i];
+			}
+		}
+		m_peers.clear();
+		m_active.clear();
+
+		for (size_t i = 0; i < m_free.size(); ++i)
+		{
+			delete m_free[i];
+		}
+		m_free.clear();
+	}
+
+	bool uv_udp_pacer::start()
+	{
+		if (m_started)
+		{
+			return true;
+		}
+
+		int r = uv_timer_init(m_loop, &m_timer);
+		if (r != 0)
+		{
+			fprintf(stderr, "pacer timer: %s\n", uv_strerror(r));
+			return false;
+		}
+		m_timer.data = this;
+		m_started = true;
+		return true;
+	}
+
+	void uv_udp_pacer::close()
+	{
+		m_output_callback = nullptr;
+		if (m_started)
+		{
+			uv_timer_stop(&m_timer);
+			uv_close((uv_handle_t*)&m_timer, on_close);
+			m_started = false;
+		}
+		else
+		{
+			delete this;
+		}
+	}
+
+	void uv_udp_pacer::set_rate(uint64_t rate, size_t burst)
+	{
+		m_global.rate = rate;
+		m_global.burst = (int64_t)burst;
+		m_global.tokens = (int64_t)burst;
+		m_global.stamp = 0;
+	}
+
+	void uv_udp_pacer::set_peer_rate(uint64_t rate, size_t burst)
+	{
+		m_peer_rate = rate;
+		m_peer_burst = burst;
+	}
+
+	void uv_udp_pacer::set_queue_limit(size_t limit, bool drop_oldest)
+	{
+		m_queue_limit = limit > 0 ? limit : 1;
+		m_drop_oldest = drop_oldest;
+	}
+
+	bool uv_udp_pacer::send(const struct sockaddr* addr, const char* data, size_t length)
+	{
+		uint64_t now = uv_hrtime();
+		m_global.refill(now);
+
+		//nothing to pace per peer and nobody waiting, skip the peer lookup
+		if (m_peer_rate == 0 && m_active.empty() && m_global.allows(length))
+		{
+			m_global.take(length);
+			if (m_output_callback != nullptr)
+			{
+				m_output_callback(this, addr, data, length);
+			}
+			return true;
+		}
+
+		peer* p = find_peer(addr);
+		if (p == nullptr)
+		{
+			++m_dropped;
+			return false;
+		}
+		p->tokens.refill(now);
+
+		//others waiting for the global budget go first
+		bool global_free = m_global.rate == 0 || m_active.empty();
+		if (p->queue.empty() && global_free && m_global.allows(length) && p->tokens.allows(length))
+		{
+			m_global.take(length);
+			p->tokens.take(length);
+			if (m_output_callback != nullptr)
+			{
+				m_output_callback(this, addr, data, length);
+			}
+			sweep(now);
+			return true;
+		}
+
+		if (p->queue.size() >= m_queue_limit)
+		{
+			++m_dropped;
+			if (m_drop_oldest == false)
+			{
+				return false;
+			}
+			release(p->queue.front());
+			p->queue.pop_front();
+			--m_queued;
+		}
+
+		datagram* d = acquire(data, length);
+		p->queue.push_back(d);
+		++m_queued;
+		if (p->active == false)
+		{
+			p->active = true;
+			m_active.push_back(p);
+		}
+
+		if (m_ticking == false && m_started)
+		{
+			uv_timer_start(&m_timer, on_timer, 1, 1);
+			m_ticking = true;
+		}
+		return true;
+	}
+
+	void uv_udp_pacer::make_key(const struct sockaddr* addr, key& k)
+	{
+		memset(&k, 0, sizeof(k));
+		k.family = addr->sa_family;
+		if (addr->sa_family == AF_INET6)
+		{
+			const sockaddr_in6* in6 = (const sockaddr_in6*)addr;
+			k.port = in6->sin6_port;
+			memcpy(k.addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+		}
+		else
+		{
+			const sockaddr_in* in = (const sockaddr_in*)addr;
+			k.port = in->sin_port;
+			memcpy(k.addr, &in->sin_addr, sizeof(in->sin_addr));
+		}
+	}
+
+	uv_udp_pacer::peer* uv_udp_pacer::find_peer(const struct sockaddr* addr)
+	{
+		if (addr == nullptr)
+		{
+			return nullptr;
+		}
+
+		key k;
+		make_key(addr, k);
+		auto it = m_peers.find(k);
+		if (it != m_peers.end())
+		{
+			return &it->second;
+		}
+
+		peer& p = m_peers[k];
+		memset(&p.addr, 0, sizeof(p.addr));
+		memcpy(&p.addr, addr, addr->sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+		p.tokens.rate = m_peer_rate;
+		p.tokens.burst = (int64_t)m_peer_burst;
+		p.tokens.tokens = (int64_t)m_peer_burst;
+		p.tokens.stamp = 0;
+		p.active = false;
+		return &p;
+	}
+
+	uv_udp_pacer::datagram* uv_udp_pacer::acquire(const char* data, size_t length)
+	{
+		datagram* d = nullptr;
+		if (m_free.empty() == false)
+		{
+			d = m_free.back();
+			m_free.pop_back();
+		}
+		else
+		{
+			d = new datagram();
+		}
+		//keeps the capacity of earlier datagrams
+		d->data.assign(data, length);
+		return d;
+	}
+
+	void uv_udp_pacer::release(datagram* d)
+	{
+		if (m_free.size() < FREE_MAX)
+		{
+			m_free.push_back(d);
+		}
+		else
+		{
+			delete d;
+		}
+	}
+
+	void uv_udp_pacer::release_queued()
+	{
+		uint64_t now = uv_hrtime();
+		m_global.refill(now);
+
+		//round robin over the peers with a backlog until the global budget or every peer budget is spent
+		bool progress = true;
+		while (progress && m_active.empty() == false)
+		{
+			progress = false;
+			size_t rounds = m_active.size();
+			for (size_t i = 0; i < rounds && m_active.empty() == false; ++i)
+			{
+				peer* p = m_active.front();
+				m_active.pop_front();
+
+				datagram* d = p->queue.front();
+				if (m_global.allows(d->data.size()) == false)
+				{
+					m_active.push_front(p);
+					progress = false;
+					break;
+				}
+
+				p->tokens.refill(now);
+				if (p->tokens.allows(d->data.size()) == false)
+				{
+					m_active.push_back(p);
+					continue;
+				}
+
+				p->queue.pop_front();
+				--m_queued;
+				if (p->queue.empty())
+				{
+					p->active = false;
+				}
+				else
+				{
+					m_active.push_back(p);
+				}
+
+				m_global.take(d->data.size());
+				p->tokens.take(d->data.size());
+				if (m_output_callback != nullptr)
+				{
+					m_output_callback(this, (const struct sockaddr*)&p->addr, d->data.data(), d->data.size());
+				}
+				release(d);
+				progress = true;
+			}
+		}
+
+		if (m_active.empty() && m_ticking)
+		{
+			uv_timer_stop(&m_timer);
+			m_ticking = false;
+		}
+		sweep(now);
+	}
+
+	void uv_udp_pacer::sweep(uint64_t now)
+	{
+		if (now - m_last_sweep < SWEEP_INTERVAL)
+		{
+			return;
+		}
+		m_last_sweep = now;
+
+		//a peer whose bucket is full again carries no state worth keeping
+		for (auto it = m_peers.begin(); it != m_peers.end();)
+		{
+			peer& p = it->second;
+			p.tokens.refill(now);
+			if (p.active == false && p.queue.empty() && (p.tokens.rate == 0 || p.tokens.tokens >= p.tokens.burst))
+			{
+				it = m_peers.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	void uv_udp_pacer::on_timer(uv_timer_t* handle)
+	{
+		uv_udp_pacer* pacer = (uv_udp_pacer*)handle->data;
+		pacer->release_queued();
+	}
+
+	void uv_udp_pacer::on_close(uv_handle_t* handle)
+	{
+		uv_udp_pacer* pacer = (uv_udp_pacer*)handle->data;
+		delete pacer;
+	}
+}
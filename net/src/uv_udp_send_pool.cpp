@@ -0,0 +1,86 @@
+#include "uv_udp_send_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace uv
+{
+	uv_udp_send_pool::uv_udp_send_pool(size_t slot_size /*= 2048*/, size_t max_free /*= 1024*/) :
+		m_free(nullptr),
+		m_free_count(0),
+		m_slot_size(slot_size),
+		m_max_free(max_free),
+		m_outstanding(0)
+	{
+	}
+
+	uv_udp_send_pool::~uv_udp_send_pool()
+	{
+		while (m_free != nullptr)
+		{
+			node* n = m_free;
+			m_free = n->next;
+			free(n);
+		}
+		m_free_count = 0;
+	}
+
+	uv_udp_send_pool::node* uv_udp_send_pool::acquire(const char* data, size_t length)
+	{
+		node* n = m_free;
+		if (n != nullptr)
+		{
+			m_free = n->next;
+			--m_free_count;
+		}
+		else
+		{
+			n = (node*)malloc(sizeof(node) + m_slot_size);
+			if (n == nullptr)
+			{
+				return nullptr;
+			}
+		}
+
+		char* payload = (char*)(n + 1);
+		n->heap = nullptr;
+		if (length > m_slot_size)
+		{
+			n->heap = (char*)malloc(length);
+			if (n->heap == nullptr)
+			{
+				n->next = m_free;
+				m_free = n;
+				++m_free_count;
+				return nullptr;
+			}
+			payload = n->heap;
+		}
+
+		memcpy(payload, data, length);
+		n->buf = uv_buf_init(payload, (unsigned int)length);
+		n->next = nullptr;
+		++m_outstanding;
+		return n;
+	}
+
+	void uv_udp_send_pool::release(node* n)
+	{
+		if (n == nullptr)
+		{
+			return;
+		}
+		--m_outstanding;
+
+		free(n->heap);
+		n->heap = nullptr;
+
+		if (m_free_count >= m_max_free)
+		{
+			free(n);
+			return;
+		}
+		n->next = m_free;
+		m_free = n;
+		++m_free_count;
+	}
+}
@@ -0,0 +1,377 @@
+#include "uv_udp_server.h"
+#include <string.h>
+
+namespace uv
+{
+	namespace
+	{
+		const size_t TABLE_INITIAL = 64;
+		const unsigned SWEEP_MIN = 10;
+	}
+
+	uv_udp_server::uv_udp_server(uv_loop_t* loop /*= uv_default_loop()*/) :
+		m_loop(loop),
+		m_client(loop),
+		m_timer_init(false),
+		m_count(0),
+		m_max_sessions(0),
+		m_next_id(0),
+		m_idle_timeout(30000),
+		m_connect_callback(nullptr),
+		m_disconnect_callback(nullptr),
+		m_receive_callback(nullptr)
+	{
+		slot empty = { 0, nullptr };
+		m_table.assign(TABLE_INITIAL, empty);
+		m_client.set_data(this);
+		m_client.set_receive_callback(on_receive);
+	}
+
+	uv_udp_server::~uv_udp_server()
+	{
+		close();
+	}
+
+	bool uv_udp_server::start_ipv4(const char* ip, const unsigned port)
+	{
+		if (attach_ipv4(ip, port) == false)
+		{
+			return false;
+		}
+		int r = uv_run(m_loop, UV_RUN_DEFAULT);
+		if (r != 0)
+		{
+			m_error = uv_strerror(r);
+			return false;
+		}
+		return true;
+	}
+
+	bool uv_udp_server::start_ipv6(const char* ip, const unsigned port)
+	{
+		if (attach_ipv6(ip, port) == false)
+		{
+			return false;
+		}
+		int r = uv_run(m_loop, UV_RUN_DEFAULT);
+		if (r != 0)
+		{
+			m_error = uv_strerror(r);
+			return false;
+		}
+		return true;
+	}
+
+	bool uv_udp_server::attach_ipv4(const char* ip, const unsigned port)
+	{
+		if (init() == false)
+		{
+			return false;
+		}
+		if (m_client.attach_ipv4(ip, port) == false)
+		{
+			m_error = m_client.error();
+			return false;
+		}
+		return true;
+	}
+
+	bool uv_udp_server::attach_ipv6(const char* ip, const unsigned port)
+	{
+		if (init() == false)
+		{
+			return false;
+		}
+		if (m_client.attach_ipv6(ip, port) == false)
+		{
+			m_error = m_client.error();
+			return false;
+		}
+		return true;
+	}
+
+	void uv_udp_server::close()
+	{
+		for (size_t i = 0; i < m_table.size(); ++i)
+		{
+			uv_udp_session* session = m_table[i].session;
+			if (session != nullptr)
+			{
+				m_table[i].session = nullptr;
+				if (m_disconnect_callback != nullptr)
+				{
+					m_disconnect_callback(session);
+				}
+				delete session;
+			}
+		}
+		m_count = 0;
+
+		if (m_timer_init)
+		{
+			uv_timer_stop(&m_timer);
+			uv_close((uv_handle_t*)&m_timer, nullptr);
+			m_timer_init = false;
+		}
+		m_client.close();
+	}
+
+	void uv_udp_server::send(uv_udp_session* session, const char* data, const size_t length)
+	{
+		if (session != nullptr)
+		{
+			m_client.send(session->addr(), data, length);
+		}
+	}
+
+	void uv_udp_server::disconnect(uv_udp_session* session)
+	{
+		if (session == nullptr)
+		{
+			return;
+		}
+		size_t index = locate(session->addr(), hash(session->addr()));
+		if (m_table[index].session != session)
+		{
+			return;
+		}
+		erase(index);
+
+		if (m_disconnect_callback != nullptr)
+		{
+			m_disconnect_callback(session);
+		}
+		delete session;
+	}
+
+	uv_udp_session* uv_udp_server::find(const struct sockaddr* addr) const
+	{
+		if (addr == nullptr)
+		{
+			return nullptr;
+		}
+		return m_table[locate(addr, hash(addr))].session;
+	}
+
+	bool uv_udp_server::init()
+	{
+		if (m_timer_init || m_idle_timeout == 0)
+		{
+			return true;
+		}
+
+		int r = uv_timer_init(m_loop, &m_timer);
+		if (r != 0)
+		{
+			m_error = uv_strerror(r);
+			return false;
+		}
+		m_timer.data = this;
+
+		//coarse on purpose: a session lives between 1 and 1.25 timeouts once idle
+		uint64_t period = m_idle_timeout / 4 > SWEEP_MIN ? m_idle_timeout / 4 : SWEEP_MIN;
+		uv_timer_start(&m_timer, on_timer, period, period);
+		uv_unref((uv_handle_t*)&m_timer);
+		m_timer_init = true;
+		return true;
+	}
+
+	uint32_t uv_udp_server::hash(const struct sockaddr* addr)
+	{
+		//fnv-1a over port and address, then mixed so the low bits are usable as an index
+		const unsigned char* p = nullptr;
+		size_t length = 0;
+		uint16_t port = 0;
+		if (addr->sa_family == AF_INET6)
+		{
+			const sockaddr_in6* in6 = (const sockaddr_in6*)addr;
+			p = (const unsigned char*)&in6->sin6_addr;
+			length = sizeof(in6->sin6_addr);
+			port = in6->sin6_port;
+		}
+		else
+		{
+			const sockaddr_in* in = (const sockaddr_in*)addr;
+			p = (const unsigned char*)&in->sin_addr;
+			length = sizeof(in->sin_addr);
+			port = in->sin_port;
+		}
+
+		uint32_t h = 2166136261u;
+		h = (h ^ (port & 0xff)) * 16777619u;
+		h = (h ^ (port >> 8)) * 16777619u;
+		for (size_t i = 0; i < length; ++i)
+		{
+			h = (h ^ p[i]) * 16777619u;
+		}
+
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
+
+	bool uv_udp_server::same(const struct sockaddr* a, const struct sockaddr* b)
+	{
+		if (a->sa_family != b->sa_family)
+		{
+			return false;
+		}
+		if (a->sa_family == AF_INET6)
+		{
+			const sockaddr_in6* x = (const sockaddr_in6*)a;
+			const sockaddr_in6* y = (const sockaddr_in6*)b;
+			return x->sin6_port == y->sin6_port && memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+		}
+		const sockaddr_in* x = (const sockaddr_in*)a;
+		const sockaddr_in* y = (const sockaddr_in*)b;
+		return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+	}
+
+	size_t uv_udp_server::locate(const struct sockaddr* addr, uint32_t h) const
+	{
+		//linear probing, the table is never more than half full so an empty slot always ends the run
+		size_t mask = m_table.size() - 1;
+		size_t index = h & mask;
+		while (m_table[index].session != nullptr)
+		{
+			if (m_table[index].hash == h && same(m_table[index].session->addr(), addr))
+			{
+				break;
+			}
+			index = (index + 1) & mask;
+		}
+		return index;
+	}
+
+	uv_udp_session* uv_udp_server::insert(const struct sockaddr* addr)
+	{
+		if ((m_count + 1) * 2 > m_table.size())
+		{
+			grow();
+		}
+
+		uint32_t h = hash(addr);
+		size_t index = locate(addr, h);
+		if (m_table[index].session == nullptr)
+		{
+			m_table[index].hash = h;
+			m_table[index].session = new uv_udp_session(++m_next_id, this, addr);
+			++m_count;
+		}
+		return m_table[index].session;
+	}
+
+	void uv_udp_server::erase(size_t index)
+	{
+		//backward shift instead of tombstones: pull later entries of the run into the hole
+		//unless their home slot lies cyclically after it
+		size_t mask = m_table.size() - 1;
+		size_t hole = index;
+		size_t next = index;
+		for (;;)
+		{
+			next = (next + 1) & mask;
+			if (m_table[next].session == nullptr)
+			{
+				break;
+			}
+			size_t home = m_table[next].hash & mask;
+			bool movable = hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+			if (movable)
+			{
+				m_table[hole] = m_table[next];
+				hole = next;
+			}
+		}
+		m_table[hole].session = nullptr;
+		m_table[hole].hash = 0;
+		--m_count;
+	}
+
+	void uv_udp_server::grow()
+	{
+		std::vector<slot> old;
+		old.swap(m_table);
+
+		slot empty = { 0, nullptr };
+		m_table.assign(old.size() * 2, empty);
+
+		size_t mask = m_table.size() - 1;
+		for (size_t i = 0; i < old.size(); ++i)
+		{
+			if (old[i].session == nullptr)
+			{
+				continue;
+			}
+			size_t index = old[i].hash & mask;
+			while (m_table[index].session != nullptr)
+			{
+				index = (index + 1) & mask;
+			}
+			m_table[index] = old[i];
+		}
+	}
+
+	void uv_udp_server::sweep()
+	{
+		uint64_t now = uv_now(m_loop);
+		std::vector<uv_udp_session*> idle;
+		for (size_t i = 0; i < m_table.size(); ++i)
+		{
+			uv_udp_session* session = m_table[i].session;
+			if (session != nullptr && now - session->last_active() >= m_idle_timeout)
+			{
+				idle.push_back(session);
+			}
+		}
+
+		for (size_t i = 0; i < idle.size(); ++i)
+		{
+			disconnect(idle[i]);
+		}
+	}
+
+	void uv_udp_server::on_receive(uv_udp_client* client, char* data, size_t length, const struct sockaddr* addr, unsigned /*flags*/)
+	{
+		uv_udp_server* server = (uv_udp_server*)client->data();
+		if (addr == nullptr)
+		{
+			return;
+		}
+
+		uv_udp_session* session = server->find(addr);
+		if (session == nullptr)
+		{
+			if (server->m_max_sessions > 0 && server->m_count >= server->m_max_sessions)
+			{
+				return;
+			}
+			session = server->insert(addr);
+			session->touch(uv_now(server->m_loop));
+			if (server->m_connect_callback != nullptr)
+			{
+				server->m_connect_callback(session);
+			}
+			//the connect callback may have refused it
+			if (server->find(addr) != session)
+			{
+				return;
+			}
+		}
+		session->touch(uv_now(server->m_loop));
+
+		if (server->m_receive_callback != nullptr)
+		{
+			server->m_receive_callback(session, data, length);
+		}
+	}
+
+	void uv_udp_server::on_timer(uv_timer_t* handle)
+	{
+		uv_udp_server* server = (uv_udp_server*)handle->data;
+		server->sweep();
+	}
+}
@@ -0,0 +1,30 @@
+#include "uv_udp_session.h"
+#include "uv_udp_server.h"
+#include <string.h>
+
+namespace uv
+{
+	uv_udp_session::uv_udp_session(int id, uv_udp_server* server, const struct sockaddr* addr) :
+		m_id(id),
+		m_server(server),
+		m_last_active(0),
+		m_data(nullptr)
+	{
+		memset(&m_addr, 0, sizeof(m_addr));
+		memcpy(&m_addr, addr, addr->sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+	}
+
+	uv_udp_session::~uv_udp_session()
+	{
+		m_server = nullptr;
+		m_data = nullptr;
+	}
+
+	void uv_udp_session::send(const char* data, const size_t length)
+	{
+		if (m_server != nullptr)
+		{
+			m_server->send(this, data, length);
+		}
+	}
+}
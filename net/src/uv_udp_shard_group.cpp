@@ -0,0 +1,173 @@
+#include "uv_udp_shard_group.h"
+
+namespace uv
+{
+	uv_udp_shard_group::uv_udp_shard_group(size_t shards) :
+		m_port(0),
+		m_ipv6(false),
+		m_started(false),
+		m_receive_callback(nullptr),
+		m_start_callback(nullptr)
+	{
+		if (shards < 1)
+		{
+			shards = 1;
+		}
+		for (size_t i = 0; i < shards; ++i)
+		{
+			shard* s = new shard();
+			s->group = this;
+			s->index = i;
+			s->client = nullptr;
+			s->running = false;
+			s->ok = false;
+			m_shards.push_back(s);
+		}
+		uv_sem_init(&m_ready, 0);
+	}
+
+	uv_udp_shard_group::~uv_udp_shard_group()
+	{
+		stop();
+		for (size_t i = 0; i < m_shards.size(); ++i)
+		{
+			delete m_shards[i];
+		}
+		m_shards.clear();
+		uv_sem_destroy(&m_ready);
+	}
+
+	bool uv_udp_shard_group::start_ipv4(const char* ip, const unsigned port)
+	{
+		return start(ip, port, false);
+	}
+
+	bool uv_udp_shard_group::start_ipv6(const char* ip, const unsigned port)
+	{
+		return start(ip, port, true);
+	}
+
+	bool uv_udp_shard_group::start(const char* ip, const unsigned port, bool ipv6)
+	{
+		if (m_started)
+		{
+			return false;
+		}
+		m_ip = ip != nullptr ? ip : (ipv6 ? "::" : "0.0.0.0");
+		m_port = port;
+		m_ipv6 = ipv6;
+		m_started = true;
+
+		for (size_t i = 0; i < m_shards.size(); ++i)
+		{
+			shard* s = m_shards[i];
+			s->running = true;
+			int r = uv_thread_create(&s->thread, run_shard, s);
+			if (r != 0)
+			{
+				s->running = false;
+				s->error = uv_strerror(r);
+				continue;
+			}
+			//one at a time, so a failed bind is known before the next shard starts
+			uv_sem_wait(&m_ready);
+		}
+
+		for (size_t i = 0; i < m_shards.size(); ++i)
+		{
+			if (m_shards[i]->ok == false)
+			{
+				m_error = m_shards[i]->error;
+				stop();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void uv_udp_shard_group::stop()
+	{
+		for (size_t i = 0; i < m_shards.size(); ++i)
+		{
+			shard* s = m_shards[i];
+			if (s->running && s->ok)
+			{
+				uv_async_send(&s->stop);
+			}
+		}
+		join();
+	}
+
+	void uv_udp_shard_group::join()
+	{
+		for (size_t i = 0; i < m_shards.size(); ++i)
+		{
+			shard* s = m_shards[i];
+			if (s->running)
+			{
+				uv_thread_join(&s->thread);
+				s->running = false;
+			}
+		}
+		m_started = false;
+	}
+
+	uv_udp_client* uv_udp_shard_group::client(size_t shard) const
+	{
+		return shard < m_shards.size() ? m_shards[shard]->client : nullptr;
+	}
+
+	void uv_udp_shard_group::run_shard(void* arg)
+	{
+		shard* s = (shard*)arg;
+		uv_udp_shard_group* group = s->group;
+
+		uv_loop_init(&s->loop);
+		uv_async_init(&s->loop, &s->stop, on_stop);
+		s->stop.data = s;
+
+		s->client = new uv_udp_client(&s->loop);
+		s->client->set_reuse_port(true);
+		s->client->set_shard(s->index);
+		s->client->set_receive_callback(group->m_receive_callback);
+		s->client->set_start_callback(group->m_start_callback);
+
+		s->ok = group->m_ipv6 ? s->client->attach_ipv6(group->m_ip.c_str(), group->m_port) : s->client->attach_ipv4(group->m_ip.c_str(), group->m_port);
+		if (s->ok == false)
+		{
+			s->error = s->client->error();
+		}
+		else if (group->m_port == 0)
+		{
+			//the first shard got an ephemeral port, the others have to share it. start() waits
+			//for this post before it creates the next shard
+			group->m_port = s->client->port();
+			if (group->m_port == 0)
+			{
+				s->ok = false;
+				s->error = s->client->error();
+			}
+		}
+		uv_sem_post(&group->m_ready);
+
+		if (s->ok == false)
+		{
+			s->client->close();
+			uv_close((uv_handle_t*)&s->stop, nullptr);
+		}
+		uv_run(&s->loop, UV_RUN_DEFAULT);
+
+		delete s->client;
+		s->client = nullptr;
+		//handles closed by the client's destructor
+		uv_run(&s->loop, UV_RUN_DEFAULT);
+		uv_loop_close(&s->loop);
+	}
+
+	void uv_udp_shard_group::on_stop(uv_async_t* handle)
+	{
+		shard* s = (shard*)handle->data;
+		s->client->close();
+		uv_close((uv_handle_t*)&s->stop, nullptr);
+	}
+}
@@ -1,9 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
 #include <uv.h>
 #include "uv_tcp_client.h"
-#include "uv_udp_client.h"
+#include "uv_histogram.h"
 
 #ifdef _MSC_VER
 
@@ -12,62 +17,420 @@
 
 #define  DEFAULT_PORT 7000
 
-uv::uv_tcp_client client;
+/*
+* Load generator against an echo server (uvServer).
+*
+* closed-loop: every connection keeps `concurrency` messages in flight.
+* open-loop:   messages are scheduled at `rate` per second over all connections,
+*              latency is measured from the scheduled time so a stalled server
+*              is not hidden by the generator slowing down.
+*/
+struct options
+{
+	const char*		host;
+	unsigned		port;
+	int				connections;
+	int				threads;
+	size_t			size;
+	double			rate;
+	int				concurrency;
+	double			duration;
+	double			json_interval;
+	unsigned int	connect_timeout;
+	size_t			max_connecting;
+};
+
+struct worker;
+
+struct connection
+{
+	worker*				owner;
+	uv::uv_tcp_client*	client;
+	std::vector<uint64_t> send_times;	//ring of send timestamps, power of two
+	size_t				head;
+	size_t				tail;
+	size_t				received;
+	bool				connected;
+};
+
+struct worker
+{
+	int						index;
+	uv_loop_t				loop;
+	uv_thread_t				thread;
+	uv_timer_t				rate_timer;
+	uv_timer_t				stop_timer;
+	std::vector<connection>	conns;
+	uv::uv_connect_limiter*	limiter;
+	uv::uv_histogram		latency;
+	std::atomic<uint64_t>	sent;
+	std::atomic<uint64_t>	completed;
+	std::atomic<uint64_t>	errors;
+	double					rate;
+	uint64_t				start;
+	uint64_t				stop;
+	uint64_t				scheduled;
+	size_t					next;
+	int						pending_connects;
+	bool					stopping;
+};
+
+static options				opts;
+static std::vector<char>	payload;
+static std::atomic<int>		finished(0);
+
+static size_t ring_capacity()
+{
+	size_t want = opts.rate > 0 ? 4096 : (size_t)opts.concurrency;
+	size_t capacity = 1;
+	while (capacity < want)
+	{
+		capacity <<= 1;
+	}
+	return capacity;
+}
+
+static void send_message(connection* conn, uint64_t stamp)
+{
+	worker* w = conn->owner;
+	if (conn->head - conn->tail == conn->send_times.size())
+	{
+		//too many messages in flight on this connection
+		++w->errors;
+		return;
+	}
+	conn->send_times[conn->head & (conn->send_times.size() - 1)] = stamp;
+	++conn->head;
+
+	conn->client->send(payload.data(), payload.size());
+	++w->sent;
+}
+
+static void on_stop(uv_timer_t* handle)
+{
+	worker* w = (worker*)handle->data;
+	w->stopping = true;
+	w->stop = uv_hrtime();
+
+	for (auto& conn : w->conns)
+	{
+		conn.client->close();
+	}
+	uv_close((uv_handle_t*)&w->rate_timer, nullptr);
+	uv_close((uv_handle_t*)&w->stop_timer, nullptr);
+}
 
-void on_tcp_connect_callback(int status)
+static void on_rate(uv_timer_t* handle)
 {
+	worker* w = (worker*)handle->data;
+	uint64_t now = uv_hrtime();
+	uint64_t due = (uint64_t)((now - w->start) * w->rate / 1e9);
+
+	while (w->scheduled < due)
+	{
+		uint64_t intended = w->start + (uint64_t)(w->scheduled * 1e9 / w->rate);
+		++w->scheduled;
+
+		connection* target = nullptr;
+		for (size_t i = 0; i < w->conns.size(); ++i)
+		{
+			connection* conn = &w->conns[w->next++ % w->conns.size()];
+			if (conn->connected)
+			{
+				target = conn;
+				break;
+			}
+		}
+		if (target == nullptr)
+		{
+			++w->errors;
+			continue;
+		}
+		send_message(target, intended);
+	}
+}
+
+static void begin(worker* w)
+{
+	w->start = uv_hrtime();
+
+	if (opts.rate > 0)
+	{
+		uv_timer_start(&w->rate_timer, on_rate, 1, 1);
+	}
+	else
+	{
+		for (auto& conn : w->conns)
+		{
+			for (int i = 0; conn.connected && i < opts.concurrency; ++i)
+			{
+				send_message(&conn, w->start);
+			}
+		}
+	}
+	uv_timer_start(&w->stop_timer, on_stop, (uint64_t)(opts.duration * 1000), 0);
+}
+
+static void on_connect(uv::uv_tcp_client* client, int status)
+{
+	connection* conn = (connection*)client->data();
+	worker* w = conn->owner;
+
 	if (status == 0)
 	{
-		printf("on connect callback.\n");
-		char* msg = "Hello World";
-		client.send(msg, strlen(msg));
+		conn->connected = true;
+		client->set_no_delay(true);
 	}
 	else
 	{
+		++w->errors;
+	}
 
+	if (--w->pending_connects == 0)
+	{
+		begin(w);
 	}
 }
 
-void on_tcp_receive_callback(char* data, std::size_t length)
+static void on_receive(uv::uv_tcp_client* client, char* /*data*/, size_t length)
 {
-	printf("receive:%s\n", data);
+	connection* conn = (connection*)client->data();
+	worker* w = conn->owner;
+	uint64_t now = uv_hrtime();
+
+	conn->received += length;
+	while (conn->received >= opts.size && conn->tail != conn->head)
+	{
+		uint64_t stamp = conn->send_times[conn->tail & (conn->send_times.size() - 1)];
+		++conn->tail;
+		conn->received -= opts.size;
+
+		w->latency.record((now - stamp) / 1000);
+		++w->completed;
+
+		if (opts.rate <= 0 && w->stopping == false)
+		{
+			send_message(conn, now);
+		}
+	}
 }
 
-void test_tcp_client()
+static void run_worker(void* arg)
 {
-	client.set_connect_callback(on_tcp_connect_callback);
-	client.set_receive_callback(on_tcp_receive_callback);
+	worker* w = (worker*)arg;
 
-	client.start("127.0.0.1", DEFAULT_PORT);
+	uv_loop_init(&w->loop);
+	uv_timer_init(&w->loop, &w->rate_timer);
+	uv_timer_init(&w->loop, &w->stop_timer);
+	w->rate_timer.data = w;
+	w->stop_timer.data = w;
+
+	w->limiter = opts.max_connecting > 0 ? new uv::uv_connect_limiter(opts.max_connecting) : nullptr;
+
+	w->pending_connects = (int)w->conns.size();
+	for (auto& conn : w->conns)
+	{
+		conn.client = new uv::uv_tcp_client(&w->loop);
+		conn.client->set_data(&conn);
+		conn.client->set_connect_callback(on_connect);
+		conn.client->set_receive_callback(on_receive);
+		conn.client->set_connect_timeout(opts.connect_timeout);
+		conn.client->set_connect_limiter(w->limiter);
+		if (conn.client->attach(opts.host, opts.port) == false)
+		{
+			++w->errors;
+			--w->pending_connects;
+		}
+	}
+	if (w->pending_connects == 0)
+	{
+		begin(w);
+	}
+
+	uv_run(&w->loop, UV_RUN_DEFAULT);
+
+	for (auto& conn : w->conns)
+	{
+		delete conn.client;
+		conn.client = nullptr;
+	}
+	delete w->limiter;
+	uv_loop_close(&w->loop);
+
+	++finished;
 }
-void on_udp_receive_callback(char* data, size_t length, const struct sockaddr* addr, unsigned flags)
-{
-	printf("udp client receive %d : %s\n",length, data);
 
-	
+static void print_json(double elapsed, uint64_t sent, uint64_t completed, uint64_t errors, double rps, const uv::uv_histogram& latency)
+{
+	printf("{\"elapsed\":%.3f,\"sent\":%llu,\"completed\":%llu,\"errors\":%llu,\"rps\":%.1f,"
+		"\"p50_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu,\"max_us\":%llu}\n",
+		elapsed, (unsigned long long)sent, (unsigned long long)completed, (unsigned long long)errors, rps,
+		(unsigned long long)latency.percentile(50), (unsigned long long)latency.percentile(99),
+		(unsigned long long)latency.percentile(99.9), (unsigned long long)latency.max());
+	fflush(stdout);
 }
 
-void on_udp_start_callback(uv::uv_udp_client* client)
+static void usage(const char* name)
 {
-	printf("udp start callback.\n");
-	char* msg = "Hello udp client.";
-	client->send_ipv4("127.0.0.1", 7000, msg, strlen(msg));
+	printf("usage: %s [options]\n"
+		"  -h host          server address (127.0.0.1)\n"
+		"  -p port          server port (%d)\n"
+		"  -c connections   total connections (1)\n"
+		"  -t threads       loop threads (1)\n"
+		"  -s size          message size in bytes (64)\n"
+		"  -r rate          open-loop messages per second, 0 for closed-loop (0)\n"
+		"  -n concurrency   closed-loop messages in flight per connection (1)\n"
+		"  -d duration      seconds (10)\n"
+		"  -j interval      print periodic json every interval seconds (0 = off)\n"
+		"  -T timeout       connect timeout in ms (0 = os default)\n"
+		"  -m connecting    max connects in progress per thread (0 = unlimited)\n",
+		name, DEFAULT_PORT);
 }
 
-void test_udp_client()
+static bool parse(int argc, char** argv)
 {
-	uv::uv_udp_client udp;
-	udp.set_receive_callback(on_udp_receive_callback);
-	udp.set_start_callback(on_udp_start_callback);
-	udp.start_ipv4("127.0.0.1", 8000);
+	opts.host = "127.0.0.1";
+	opts.port = DEFAULT_PORT;
+	opts.connections = 1;
+	opts.threads = 1;
+	opts.size = 64;
+	opts.rate = 0;
+	opts.concurrency = 1;
+	opts.duration = 10;
+	opts.json_interval = 0;
+	opts.connect_timeout = 0;
+	opts.max_connecting = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (argv[i][0] != '-' || argv[i][1] == 0 || argv[i][2] != 0 || i + 1 >= argc)
+		{
+			return false;
+		}
+		const char* value = argv[++i];
+		switch (argv[i - 1][1])
+		{
+		case 'h': opts.host = value; break;
+		case 'p': opts.port = (unsigned)atoi(value); break;
+		case 'c': opts.connections = atoi(value); break;
+		case 't': opts.threads = atoi(value); break;
+		case 's': opts.size = (size_t)atol(value); break;
+		case 'r': opts.rate = atof(value); break;
+		case 'n': opts.concurrency = atoi(value); break;
+		case 'd': opts.duration = atof(value); break;
+		case 'j': opts.json_interval = atof(value); break;
+		case 'T': opts.connect_timeout = (unsigned int)atoi(value); break;
+		case 'm': opts.max_connecting = (size_t)atol(value); break;
+		default: return false;
+		}
+	}
+
+	if (opts.connections < 1 || opts.threads < 1 || opts.size < 1 || opts.concurrency < 1 || opts.duration <= 0)
+	{
+		return false;
+	}
+	if (opts.threads > opts.connections)
+	{
+		opts.threads = opts.connections;
+	}
+	return true;
 }
 
-int main()
+int main(int argc, char** argv)
 {
-	
+	if (parse(argc, argv) == false)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	payload.assign(opts.size, 'x');
 
-	test_tcp_client();
+	std::vector<worker*> workers;
+	for (int i = 0; i < opts.threads; ++i)
+	{
+		worker* w = new worker();
+		w->index = i;
+		workers.push_back(w);
+	}
+	for (int i = 0; i < opts.connections; ++i)
+	{
+		connection conn = {};
+		conn.owner = workers[i % opts.threads];
+		conn.send_times.resize(ring_capacity());
+		conn.owner->conns.push_back(conn);
+	}
+	for (auto w : workers)
+	{
+		w->rate = opts.rate * w->conns.size() / opts.connections;
+	}
+
+	uint64_t begin_time = uv_hrtime();
+	for (auto w : workers)
+	{
+		uv_thread_create(&w->thread, run_worker, w);
+	}
+
+	if (opts.json_interval > 0)
+	{
+		uint64_t last_completed = 0;
+		uint64_t last_time = begin_time;
+		while (finished.load() < opts.threads)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds((int64_t)(opts.json_interval * 1000)));
+
+			uint64_t sent = 0, completed = 0, errors = 0;
+			uv::uv_histogram latency;
+			for (auto w : workers)
+			{
+				sent += w->sent;
+				completed += w->completed;
+				errors += w->errors;
+				latency.merge(w->latency);
+			}
+			uint64_t now = uv_hrtime();
+			double rps = (completed - last_completed) * 1e9 / (double)(now - last_time);
+			print_json((now - begin_time) / 1e9, sent, completed, errors, rps, latency);
+			last_completed = completed;
+			last_time = now;
+		}
+	}
+
+	for (auto w : workers)
+	{
+		uv_thread_join(&w->thread);
+	}
+
+	uint64_t sent = 0, completed = 0, errors = 0;
+	double elapsed = 0;
+	uv::uv_histogram latency;
+	for (auto w : workers)
+	{
+		sent += w->sent;
+		completed += w->completed;
+		errors += w->errors;
+		if (w->stop > w->start)
+		{
+			elapsed = std::max(elapsed, (w->stop - w->start) / 1e9);
+		}
+		latency.merge(w->latency);
+		delete w;
+	}
+
+	double rps = elapsed > 0 ? completed / elapsed : 0;
+	printf("connections %d, threads %d, size %zu, %s\n", opts.connections, opts.threads, opts.size,
+		opts.rate > 0 ? "open-loop" : "closed-loop");
+	printf("sent %llu, completed %llu, errors %llu in %.3fs\n",
+		(unsigned long long)sent, (unsigned long long)completed, (unsigned long long)errors, elapsed);
+	printf("throughput %.1f msg/s, %.2f MB/s\n", rps, rps * opts.size / (1024 * 1024));
+	printf("latency us p50 %llu, p99 %llu, p999 %llu, max %llu\n",
+		(unsigned long long)latency.percentile(50), (unsigned long long)latency.percentile(99),
+		(unsigned long long)latency.percentile(99.9), (unsigned long long)latency.max());
+
+	if (opts.json_interval > 0)
+	{
+		print_json(elapsed, sent, completed, errors, rps, latency);
+	}
 
-	//test_udp_client();
 	return  0;
-}
\ No newline at end of file
+}
@@ -20,11 +20,9 @@ using namespace uv;
 static uv_tcp_server server;
 void on_tcp_receive_callback(uv_tcp_session* session, const char* buf, size_t length)
 {
-	printf("session %d receive %d  %s.\n", session->id(), length, buf);
+	//plain echo, uvClient measures latency against it
 	uv_tcp_server* server = session->server();
 	server->send(session->id(), buf, length);
-	const char* a = "aaaaslslsl";
-	server->send(session->id(), a, strlen(a));
 }
 
 void on_tcp_connection(uv_tcp_session* session)
@@ -44,11 +42,11 @@ void test_tcp_server()
 
 static uv::uv_udp_client udp;
 
-void on_udp_receive_callback(char* data, size_t length, const struct sockaddr* addr, unsigned flags)
+void on_udp_receive_callback(uv_udp_client* /*client*/, char* data, size_t length, const struct sockaddr* addr, unsigned /*flags*/)
 {
-	printf("udp client receive %d : %s\n", strlen(data), data);
+	printf("udp client receive %d : %.*s\n", (int)length, (int)length, data);
 
-	udp.send(addr, data, strlen(data));
+	udp.send(addr, data, length);
 }
 
 void test_udp_server()